@@ -0,0 +1,172 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "configuration.h"
+
+#include "logger.h"
+#include "utils.h"
+#include <QFile>
+#include <QReadWriteLock>
+#include <QSettings>
+#include <QSocketNotifier>
+#include <QThread>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct ConfigurationPrivate {
+        QReadWriteLock lock;
+        QSharedPointer<const ConfigurationSnapshot> snapshot;
+
+        QSocketNotifier* reloadNotifier = nullptr;
+        static int reloadSignalFd[2];
+};
+
+int ConfigurationPrivate::reloadSignalFd[2] = {-1, -1};
+
+Configuration::Configuration(QObject* parent) :
+    QObject(parent) {
+    d = new ConfigurationPrivate();
+    d->snapshot = load();
+}
+
+Configuration::~Configuration() {
+    delete d;
+}
+
+Configuration* Configuration::instance() {
+    static auto* instance = new Configuration();
+    return instance;
+}
+
+QSharedPointer<const ConfigurationSnapshot> Configuration::current() {
+    auto* configuration = instance();
+    QReadLocker locker(&configuration->d->lock);
+    return configuration->d->snapshot;
+}
+
+bool Configuration::reload() {
+    if (!QFile::exists(Utils::settingsFile())) {
+        Logger::error() << "Configuration file " << Utils::settingsFile() << " does not exist; keeping the current configuration\n";
+        return false;
+    }
+
+    auto snapshot = load();
+    {
+        QWriteLocker locker(&d->lock);
+        d->snapshot = snapshot;
+    }
+
+    Logger::log() << "Configuration reloaded\n";
+    emit reloaded();
+    return true;
+}
+
+void Configuration::watchForReloadSignal() {
+    if (d->reloadNotifier) return;
+
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, ConfigurationPrivate::reloadSignalFd) != 0) {
+        Logger::error() << "Could not set up the SIGHUP handler\n";
+        return;
+    }
+
+    // Signal handlers can't safely do any real work, so forward the signal to the event loop
+    d->reloadNotifier = new QSocketNotifier(ConfigurationPrivate::reloadSignalFd[1], QSocketNotifier::Read, this);
+    connect(d->reloadNotifier, &QSocketNotifier::activated, this, [this] {
+        d->reloadNotifier->setEnabled(false);
+        char signal;
+        ::read(ConfigurationPrivate::reloadSignalFd[1], &signal, sizeof(signal));
+        this->reload();
+        d->reloadNotifier->setEnabled(true);
+    });
+
+    struct sigaction hup = {};
+    hup.sa_handler = [](int) {
+        char signal = 1;
+        ::write(ConfigurationPrivate::reloadSignalFd[0], &signal, sizeof(signal));
+    };
+    sigemptyset(&hup.sa_mask);
+    hup.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &hup, nullptr);
+}
+
+QSharedPointer<const ConfigurationSnapshot> Configuration::load() {
+    QSettings settings(Utils::settingsFile(), QSettings::IniFormat);
+
+    auto snapshot = QSharedPointer<ConfigurationSnapshot>::create();
+    snapshot->dedicatedBus = settings.value("dbus/bus").toString() == "dedicated";
+    snapshot->dbusConfiguration = qEnvironmentVariable("DBUS_CONFIGURATION_FILE", settings.value("dbus/configuration").toString());
+
+    snapshot->databaseDriver = qEnvironmentVariable("ACCOUNTS_DB_DRIVER", settings.value("database/driver").toString());
+    snapshot->databaseHostname = qEnvironmentVariable("ACCOUNTS_DB_HOSTNAME", settings.value("database/hostname").toString());
+    snapshot->databaseName = qEnvironmentVariable("ACCOUNTS_DB_DATABASE", settings.value("database/database").toString());
+    snapshot->databaseUsername = qEnvironmentVariable("ACCOUNTS_DB_USERNAME", settings.value("database/username").toString());
+    snapshot->databasePassword = qEnvironmentVariable("ACCOUNTS_DB_PASSWORD", settings.value("database/password").toString());
+    snapshot->databasePoolSize = qEnvironmentVariable("ACCOUNTS_DB_POOLSIZE", settings.value("database/poolsize", QThread::idealThreadCount() + 1).toString()).toInt();
+    snapshot->databaseHealthCheckInterval = settings.value("database/healthcheckinterval", 60).toInt() * 1000;
+    snapshot->databaseCheckoutTimeout = settings.value("database/checkouttimeout", 30).toInt() * 1000;
+
+    snapshot->mailDir = qEnvironmentVariable("MAIL_MAILDIR", settings.value("mail/maildir").toString());
+    snapshot->smtpHost = qEnvironmentVariable("SMTP_HOST", settings.value("mail/host").toString());
+    snapshot->smtpPort = qEnvironmentVariable("SMTP_PORT", settings.value("mail/port").toString()).toInt();
+    snapshot->smtpSecurity = qEnvironmentVariable("SMTP_SECURITY", settings.value("mail/security").toString());
+    snapshot->smtpUsername = qEnvironmentVariable("SMTP_USERNAME", settings.value("mail/username").toString());
+    snapshot->smtpPassword = qEnvironmentVariable("SMTP_PASSWORD", settings.value("mail/password").toString());
+    snapshot->smtpSenderEmail = qEnvironmentVariable("SMTP_SENDER_EMAIL", settings.value("mail/senderemail").toString());
+    snapshot->smtpSenderName = qEnvironmentVariable("SMTP_SENDER_NAME", settings.value("mail/sendername").toString());
+    snapshot->mailConnections = settings.value("mail/connections", 2).toInt();
+    snapshot->mailMessagesPerSession = settings.value("mail/messagespersession", 100).toInt();
+    snapshot->mailIdleTimeout = settings.value("mail/idletimeout", 30).toInt() * 1000;
+    snapshot->mailRetries = settings.value("mail/retries", 5).toInt();
+
+    snapshot->fidoExecutable = settings.value("fido/executable").toString();
+    snapshot->fidoTimeout = settings.value("fido/timeout", 30).toInt() * 1000;
+
+    snapshot->otpWindow = qMax(0, settings.value("otp/window", 1).toInt());
+    snapshot->backupKeySecret = qEnvironmentVariable("ACCOUNTS_BACKUP_KEY_SECRET", settings.value("otp/backupkeysecret").toString()).toUtf8();
+
+    snapshot->passwordHashTarget = settings.value("passwords/hashtarget", 100).toInt();
+    snapshot->passwordMinimumIterations = qMax(1, settings.value("passwords/miniterations", 10000).toInt());
+
+    snapshot->tokenCacheSize = settings.value("tokens/cachesize", 10000).toInt();
+    snapshot->tokenCacheTtl = settings.value("tokens/cachettl", 60).toInt() * 1000;
+    snapshot->tokenLifetime = settings.value("tokens/lifetime", 90).toLongLong() * 24 * 60 * 60 * 1000;
+    snapshot->tokenMaxPerUser = settings.value("tokens/maxperuser", 50).toInt();
+
+    snapshot->reaperInterval = settings.value("reaper/interval", 60).toInt() * 1000;
+    snapshot->reaperBatchSize = settings.value("reaper/batchsize", 500).toInt();
+    snapshot->reaperDutyCycle = settings.value("reaper/dutycycle", 10).toInt();
+
+    snapshot->admissionMaxPending = settings.value("admission/maxpending", 64).toInt();
+    snapshot->admissionSenderRate = settings.value("admission/senderrate", 0).toDouble();
+    snapshot->admissionSenderBurst = settings.value("admission/senderburst", 0).toDouble();
+    snapshot->admissionUsernameRate = settings.value("admission/usernamerate", 0.2).toDouble();
+    snapshot->admissionUsernameBurst = settings.value("admission/usernameburst", 5).toDouble();
+
+    snapshot->userCacheMemory = settings.value("users/cachememory", 1024).toInt() * 1024;
+    snapshot->userCacheAccountCost = settings.value("users/accountcost", 4096).toInt();
+
+    snapshot->metricsSocket = qEnvironmentVariable("ACCOUNTS_METRICS_SOCKET", settings.value("metrics/socket").toString());
+
+    snapshot->logLevel = qEnvironmentVariable("ACCOUNTS_LOG_LEVEL", settings.value("logging/level", "info").toString());
+    snapshot->logFormat = qEnvironmentVariable("ACCOUNTS_LOG_FORMAT", settings.value("logging/format", "text").toString());
+    snapshot->logRateLimit = settings.value("logging/ratelimit", 20).toInt();
+
+    return snapshot;
+}
@@ -0,0 +1,108 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef CONFIGURATION_H
+#define CONFIGURATION_H
+
+#include <QObject>
+#include <QSharedPointer>
+
+struct ConfigurationSnapshot {
+        bool dedicatedBus;
+        QString dbusConfiguration;
+
+        QString databaseDriver;
+        QString databaseHostname;
+        QString databaseName;
+        QString databaseUsername;
+        QString databasePassword;
+        int databasePoolSize;
+        int databaseHealthCheckInterval;
+        int databaseCheckoutTimeout;
+
+        QString mailDir;
+        QString smtpHost;
+        int smtpPort;
+        QString smtpSecurity;
+        QString smtpUsername;
+        QString smtpPassword;
+        QString smtpSenderEmail;
+        QString smtpSenderName;
+        int mailConnections;
+        int mailMessagesPerSession;
+        int mailIdleTimeout;
+        int mailRetries;
+
+        QString fidoExecutable;
+        int fidoTimeout;
+
+        int otpWindow;
+        QByteArray backupKeySecret;
+
+        int passwordHashTarget;
+        int passwordMinimumIterations;
+
+        int tokenCacheSize;
+        int tokenCacheTtl;
+        qint64 tokenLifetime;
+        int tokenMaxPerUser;
+
+        int reaperInterval;
+        int reaperBatchSize;
+        int reaperDutyCycle;
+
+        int admissionMaxPending;
+        double admissionSenderRate;
+        double admissionSenderBurst;
+        double admissionUsernameRate;
+        double admissionUsernameBurst;
+
+        int userCacheMemory;
+        int userCacheAccountCost;
+
+        QString metricsSocket;
+
+        QString logLevel;
+        QString logFormat;
+        int logRateLimit;
+};
+
+struct ConfigurationPrivate;
+class Configuration : public QObject {
+        Q_OBJECT
+    public:
+        ~Configuration();
+
+        static Configuration* instance();
+        static QSharedPointer<const ConfigurationSnapshot> current();
+
+        bool reload();
+        void watchForReloadSignal();
+
+    signals:
+        void reloaded();
+
+    private:
+        ConfigurationPrivate* d;
+
+        explicit Configuration(QObject* parent = nullptr);
+        static QSharedPointer<const ConfigurationSnapshot> load();
+};
+
+#endif // CONFIGURATION_H
@@ -19,35 +19,133 @@
  * *************************************/
 #include "database.h"
 
+#include "configuration.h"
 #include "logger.h"
-#include "utils.h"
+#include "metrics.h"
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QFile>
-#include <QSettings>
+#include <QMutex>
+#include <QSemaphore>
 #include <QSqlDatabase>
+#include <QSqlDriver>
 #include <QSqlQuery>
 #include <QThread>
+#include <QThreadStorage>
+
+struct DatabaseConnection {
+        DatabaseConnection(QString name, QSharedPointer<QSemaphore> freeSlots) :
+            name(name), freeSlots(freeSlots) {
+        }
+
+        ~DatabaseConnection() {
+            clearStatements();
+            {
+                QSqlDatabase db = QSqlDatabase::database(name, false);
+                db.close();
+            }
+            QSqlDatabase::removeDatabase(name);
+            freeSlots->release();
+        }
+
+        void clearStatements() {
+            // Prepared statements belong to the server session, so they go when the connection does
+            qDeleteAll(statements);
+            statements.clear();
+        }
+
+        QString name;
+
+        // Shared so that a connection cleaned up when its thread exits can still give its slot back after the pool is gone
+        QSharedPointer<QSemaphore> freeSlots;
+        qint64 lastUsed = 0;
+        QHash<QString, QSqlQuery*> statements;
+};
+
+struct StatementStatistics {
+        quint64 prepares = 0;
+        quint64 executions = 0;
+        quint64 failures = 0;
+        qint64 totalNsecs = 0;
+        qint64 maxNsecs = 0;
+};
+
+struct DatabasePrivate {
+        static Database* instance;
+
+        QString driver;
+        QString hostname;
+        QString database;
+        QString username;
+        QString password;
+
+        int poolSize;
+        int healthCheckInterval;
+        int checkoutTimeout;
+
+        QSharedPointer<QSemaphore> freeSlots = QSharedPointer<QSemaphore>::create();
+        QThreadStorage<DatabaseConnection*> connections;
+        QAtomicInteger<quint64> nextConnection = 0;
+
+        QMutex statisticsLock;
+        QHash<QString, StatementStatistics> statistics;
+
+        void recordExecution(const QString& sql, qint64 nsecs, bool success) {
+            QMutexLocker locker(&statisticsLock);
+            auto& stats = statistics[sql];
+            stats.executions++;
+            if (!success) stats.failures++;
+            stats.totalNsecs += nsecs;
+            stats.maxNsecs = qMax(stats.maxNsecs, nsecs);
+        }
+};
+
+Database* DatabasePrivate::instance = nullptr;
 
 Database::Database(QObject* parent) :
     QObject(parent) {
+    d = new DatabasePrivate();
+    DatabasePrivate::instance = this;
+}
+
+Database::~Database() {
+    if (DatabasePrivate::instance == this) DatabasePrivate::instance = nullptr;
+    delete d;
+}
+
+Database* Database::instance() {
+    return DatabasePrivate::instance;
+}
+
+QSqlDatabase Database::database() {
+    return instance()->checkout();
 }
 
 bool Database::init() {
-    QSettings settings(Utils::settingsFile(), QSettings::IniFormat);
-    if (!QSqlDatabase::isDriverAvailable(settings.value("database/driver").toString())) {
+    // Connection settings are only read at startup; changing them requires a restart
+    auto configuration = Configuration::current();
+    d->driver = configuration->databaseDriver;
+    d->hostname = configuration->databaseHostname;
+    d->database = configuration->databaseName;
+    d->username = configuration->databaseUsername;
+    d->password = configuration->databasePassword;
+    d->poolSize = configuration->databasePoolSize;
+    d->healthCheckInterval = configuration->databaseHealthCheckInterval;
+    d->checkoutTimeout = configuration->databaseCheckoutTimeout;
+    if (d->poolSize < 1) d->poolSize = 1;
+    d->freeSlots->release(d->poolSize);
+
+    if (!QSqlDatabase::isDriverAvailable(d->driver)) {
         Logger::error() << "The database driver is not available.";
         return false;
     }
 
-    QSqlDatabase db = QSqlDatabase::addDatabase(qEnvironmentVariable("ACCOUNTS_DB_DRIVER", settings.value("database/driver").toString()));
-    db.setHostName(qEnvironmentVariable("ACCOUNTS_DB_HOSTNAME", settings.value("database/hostname").toString()));
-    db.setDatabaseName(qEnvironmentVariable("ACCOUNTS_DB_DATABASE", settings.value("database/database").toString()));
-    db.setUserName(qEnvironmentVariable("ACCOUNTS_DB_USERNAME", settings.value("database/username").toString()));
-    db.setPassword(qEnvironmentVariable("ACCOUNTS_DB_PASSWORD", settings.value("database/password").toString()));
-
-    while (!db.open()) {
-        Logger::error() << "Could not connect to the database\n";
+    // The main thread holds on to its connection for the lifetime of the daemon
+    QSqlDatabase db = this->checkout();
+    while (!db.isOpen()) {
         Logger::error() << "Trying again after 5 seconds.\n";
         QThread::sleep(5);
+        this->openConnection(db);
     }
 
     // Initialise the database
@@ -58,23 +156,198 @@ bool Database::init() {
         auto versionQuery = db.exec("SELECT number FROM version");
         versionQuery.next();
         auto number = versionQuery.value("number").toInt();
-        if (number == 1) {
+        if (number < 2) {
             // Update to V2 required
             this->runSqlScript("v2");
-        } else {
-            //We are up to date!
+        }
+        if (number < 3) {
+            // Update to V3 required
+            this->runSqlScript("v3");
+        }
+        if (number < 4) {
+            // Update to V4 required
+            this->runSqlScript("v4");
+        }
+        if (number < 5) {
+            // Update to V5 required
+            this->runSqlScript("v5");
+        }
+        if (number < 6) {
+            // Update to V6 required
+            this->runSqlScript("v6");
+        }
+        if (number < 7) {
+            // Update to V7 required
+            this->runSqlScript("v7");
         }
     }
 
     return true;
 }
 
+QSqlDatabase Database::checkout() {
+    // Qt SQL connections may only be used from the thread that created them, so each
+    // thread checks out its own named connection and keeps it until it is checked in.
+    // Returns an invalid database if none is free in time; executing on it just fails.
+    auto* connection = d->connections.localData();
+    if (!connection) {
+        if (!d->freeSlots->tryAcquire(1, d->checkoutTimeout)) {
+            Logger::error() << "Timed out waiting for a free database connection\n";
+            return {};
+        }
+
+        connection = new DatabaseConnection(QStringLiteral("vicr123-accounts-%1").arg(d->nextConnection.fetchAndAddRelaxed(1)), d->freeSlots);
+        d->connections.setLocalData(connection);
+
+        QSqlDatabase db = QSqlDatabase::addDatabase(d->driver, connection->name);
+        db.setHostName(d->hostname);
+        db.setDatabaseName(d->database);
+        db.setUserName(d->username);
+        db.setPassword(d->password);
+        this->openConnection(db);
+
+        connection->lastUsed = QDateTime::currentMSecsSinceEpoch();
+        return db;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(connection->name, false);
+    auto now = QDateTime::currentMSecsSinceEpoch();
+    if (!db.isOpen() || now - connection->lastUsed > d->healthCheckInterval) {
+        // This connection has been idle for a while so the server may have dropped it
+        QSqlQuery healthCheck(db);
+        if (!db.isOpen() || !healthCheck.exec("SELECT 1")) {
+            Logger::error() << "Database connection " << connection->name << " is unhealthy; reconnecting\n";
+            healthCheck.finish();
+            connection->clearStatements();
+            db.close();
+            this->openConnection(db);
+        }
+    }
+    connection->lastUsed = now;
+    return db;
+}
+
+void Database::checkin() {
+    // Deleting the thread's connection closes it and frees its slot in the pool
+    d->connections.setLocalData(nullptr);
+}
+
+bool Database::openConnection(QSqlDatabase db) {
+    if (!db.open()) {
+        Logger::error() << "Could not connect to the database\n";
+        return false;
+    }
+    return true;
+}
+
 void Database::runSqlScript(QString script) {
     QFile scriptFile(QStringLiteral(":/sql/%1.sql").arg(script));
     scriptFile.open(QFile::ReadOnly);
     QString scriptContents = scriptFile.readAll();
     scriptFile.close();
 
-    QSqlQuery query;
+    QSqlQuery query(database());
     query.exec(scriptContents);
 }
+
+QSqlQuery& Database::statement(const QString& sql) {
+    // Each connection prepares a statement the first time it is asked for and keeps it, so the
+    // server only parses it once and can reuse its plan. Bind every placeholder before executing.
+    static thread_local QSqlQuery unavailable{QSqlDatabase()};
+
+    auto* instance = DatabasePrivate::instance;
+    QSqlDatabase db = instance->checkout();
+    auto* connection = instance->d->connections.localData();
+    if (!connection || !db.isOpen()) return unavailable;
+
+    if (auto* query = connection->statements.value(sql)) {
+        // Release the previous result before the statement is bound again
+        query->finish();
+        return *query;
+    }
+
+    auto* query = new QSqlQuery(db);
+    if (!query->prepare(sql)) {
+        Logger::error() << "Could not prepare statement: " << sql << "\n";
+        delete query;
+        return unavailable;
+    }
+    connection->statements.insert(sql, query);
+
+    QMutexLocker locker(&instance->d->statisticsLock);
+    instance->d->statistics[sql].prepares++;
+    return *query;
+}
+
+bool Database::execute(QSqlQuery& query) {
+    if (!query.driver() || !query.driver()->isOpen()) {
+        // No connection could be checked out for this thread
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    auto success = query.exec();
+    DatabasePrivate::instance->d->recordExecution(query.lastQuery(), timer.nsecsElapsed(), success);
+    Metrics::recordOperation("sql", timer.nsecsElapsed());
+    return success;
+}
+
+bool Database::executeBatch(QSqlQuery& query) {
+    if (!query.driver() || !query.driver()->isOpen()) {
+        // No connection could be checked out for this thread
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    auto success = query.execBatch();
+    DatabasePrivate::instance->d->recordExecution(query.lastQuery(), timer.nsecsElapsed(), success);
+    Metrics::recordOperation("sql", timer.nsecsElapsed());
+    return success;
+}
+
+QVariantMap Database::statementStatistics() {
+    QVariantMap statistics;
+    auto* d = DatabasePrivate::instance->d;
+    QMutexLocker locker(&d->statisticsLock);
+    for (auto i = d->statistics.constBegin(); i != d->statistics.constEnd(); i++) {
+        const auto& stats = i.value();
+        statistics.insert(i.key(), QVariantMap{
+            {"prepares", stats.prepares},
+            {"executions", stats.executions},
+            {"failures", stats.failures},
+            {"totalMsecs", stats.totalNsecs / 1000000.0},
+            {"averageUsecs", stats.executions ? stats.totalNsecs / 1000.0 / stats.executions : 0.0},
+            {"maxUsecs", stats.maxNsecs / 1000.0}
+        });
+    }
+    return statistics;
+}
+
+QString Database::arrayLiteral(const QList<quint64>& values) {
+    // Bind the result as text and CAST(:param AS BIGINT[]) in the query; the SQL driver can't bind lists itself
+    QStringList elements;
+    elements.reserve(values.size());
+    for (auto value : values) elements.append(QString::number(value));
+    return QStringLiteral("{%1}").arg(elements.join(","));
+}
+
+QString Database::arrayLiteral(const QList<QByteArray>& values) {
+    // Each element is in bytea hex format; the backslash is escaped for the array parser
+    QStringList elements;
+    elements.reserve(values.size());
+    for (const auto& value : values) elements.append(QStringLiteral("\"\\\\x%1\"").arg(QString::fromLatin1(value.toHex())));
+    return QStringLiteral("{%1}").arg(elements.join(","));
+}
+
+QString Database::arrayLiteral(const QStringList& values) {
+    // Quote every element so commas, braces and NULL inside the strings are taken literally
+    QStringList elements;
+    elements.reserve(values.size());
+    for (auto value : values) {
+        value.replace("\\", "\\\\").replace("\"", "\\\"");
+        elements.append(QStringLiteral("\"%1\"").arg(value));
+    }
+    return QStringLiteral("{%1}").arg(elements.join(","));
+}
@@ -21,18 +21,41 @@
 #define DATABASE_H
 
 #include <QObject>
+#include <QSqlDatabase>
+#include <QSqlQuery>
 
+struct DatabasePrivate;
 class Database : public QObject {
         Q_OBJECT
     public:
         explicit Database(QObject* parent = nullptr);
+        ~Database();
+
+        static Database* instance();
+        static QSqlDatabase database();
+
+        static QString arrayLiteral(const QList<quint64>& values);
+        static QString arrayLiteral(const QStringList& values);
+        static QString arrayLiteral(const QList<QByteArray>& values);
+
+        static QSqlQuery& statement(const QString& sql);
+        static bool execute(QSqlQuery& query);
+        static bool executeBatch(QSqlQuery& query);
+        static QVariantMap statementStatistics();
 
         bool init();
 
+        QSqlDatabase checkout();
+        void checkin();
+
         void runSqlScript(QString script);
 
     signals:
 
+    private:
+        DatabasePrivate* d;
+
+        bool openConnection(QSqlDatabase db);
 };
 
 #endif // DATABASE_H
@@ -19,34 +19,121 @@
  * *************************************/
 #include "accountmanager.h"
 
+#include "configuration.h"
+#include "fidohelper.h"
 #include "fidoutils.h"
 #include "logger.h"
 #include "mailmessage.h"
+#include "mailqueue.h"
+#include "metrics.h"
+#include "metricsinterface.h"
+#include "reaper.h"
+#include "storage/storage.h"
 #include "twofactor.h"
 #include "user.h"
 #include "useraccount.h"
 #include "utils.h"
 #include "validation.h"
+#include <QDBusMetaType>
 #include <QDateTime>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QProcess>
-#include <QSqlDatabase>
-#include <QSqlQuery>
+#include <QtConcurrent>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
 
+#include "token-provisioning/admissioncontrol.h"
+#include "token-provisioning/tokencache.h"
 #include "token-provisioning/tokenprovisioningmanager.h"
 
 struct AccountManagerPrivate {
         TokenProvisioningManager* tokenProvisioningManager;
+
+        // Upper bound on the number of items a single batch call may ask for
+        static constexpr auto maxBatchSize = 1000;
+
+        // Upper bound on the number of ids returned by one page of UsersAfter
+        static constexpr uint maxPageSize = 10000;
+
+        // The error for a token that doesn't identify a user for the expected purpose, shared by the single and batch
+        // token lookups so they report the same thing
+        static Utils::DBusError tokenError(bool valid, TokenProvisioningManager::TokenProvisioningPurpose purpose, TokenProvisioningManager::TokenProvisioningPurpose expectedPurpose) {
+            return valid && purpose == expectedPurpose ? Utils::NoError : Utils::NoAccount;
+        }
 };
 
+QDBusArgument& operator<<(QDBusArgument& argument, const BatchUserResult& result) {
+    argument.beginStructure();
+    argument << result.id << result.path << result.username << result.email << result.verified << result.error;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument& operator>>(const QDBusArgument& argument, BatchUserResult& result) {
+    argument.beginStructure();
+    argument >> result.id >> result.path >> result.username >> result.email >> result.verified >> result.error;
+    argument.endStructure();
+    return argument;
+}
+
+QDBusArgument& operator<<(QDBusArgument& argument, const BatchUserIdResult& result) {
+    argument.beginStructure();
+    argument << result.username << result.id << result.error;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument& operator>>(const QDBusArgument& argument, BatchUserIdResult& result) {
+    argument.beginStructure();
+    argument >> result.username >> result.id >> result.error;
+    argument.endStructure();
+    return argument;
+}
+
 AccountManager::AccountManager() :
     QObject(nullptr) {
     d = new AccountManagerPrivate();
     d->tokenProvisioningManager = new TokenProvisioningManager(this);
 
-    if (!Utils::accountsBus().registerObject("/com/vicr123/accounts", this, QDBusConnection::ExportScriptableContents)) {
+    qDBusRegisterMetaType<BatchUserResult>();
+    qDBusRegisterMetaType<QList<BatchUserResult>>();
+    qDBusRegisterMetaType<BatchUserIdResult>();
+    qDBusRegisterMetaType<QList<BatchUserIdResult>>();
+
+    new MetricsInterface(this);
+    Metrics::instance()->addCollector("tokenCache", [] {
+        return TokenCache::instance()->statistics();
+    });
+    Metrics::instance()->addCollector("accountCache", [] {
+        return UserAccount::cacheStatistics();
+    });
+    Metrics::instance()->addCollector("mailQueue", [] {
+        return MailQueue::instance()->statistics();
+    });
+    Metrics::instance()->addCollector("fidoHelper", [] {
+        return FidoHelper::instance()->statistics();
+    });
+    Metrics::instance()->addCollector("reaper", [] {
+        return Reaper::instance()->statistics();
+    });
+    Metrics::instance()->addCollector("admission", [] {
+        return AdmissionControl::instance()->statistics();
+    });
+    Metrics::instance()->addCollector("logger", [] {
+        return Logger::statistics();
+    });
+    Metrics::instance()->addCollector("hashing", [] {
+        return QVariantMap{
+            {"activeThreads", Utils::hashingThreadPool()->activeThreadCount()},
+            {"maxThreads",    Utils::hashingThreadPool()->maxThreadCount()   },
+            {"iterations",    Utils::passwordHashIterations()                }
+        };
+    });
+
+    if (!Utils::accountsBus().registerObject("/com/vicr123/accounts", this, QDBusConnection::ExportScriptableContents | QDBusConnection::ExportAdaptors)) {
         Logger::error() << "Could not register object on bus";
     }
 }
@@ -56,18 +143,11 @@ AccountManager::~AccountManager() {
 }
 
 quint64 AccountManager::userIdByUsername(QString username) {
-    QSqlQuery query;
-    query.prepare("SELECT id FROM users WHERE username=:username");
-    query.bindValue(":username", username);
-    query.exec();
-    if (!query.next()) {
-        return 0;
-    }
-
-    return query.value("id").toULongLong();
+    return Storage::instance()->userIdByUsername(username);
 }
 
 QDBusObjectPath AccountManager::CreateUser(QString username, QString password, QString email, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (username.isEmpty() || password.isEmpty() || email.isEmpty()) {
         Utils::sendDbusError(Utils::InvalidInput, message);
         return QDBusObjectPath("/");
@@ -88,32 +168,30 @@ QDBusObjectPath AccountManager::CreateUser(QString username, QString password, Q
         return QDBusObjectPath("/");
     }
 
-    QSqlQuery query;
-    query.prepare("INSERT INTO users(username, password, email) VALUES(:username, :password, :email) RETURNING id");
-    query.bindValue(":username", username);
-    query.bindValue(":password", Utils::generateHashedPassword(password));
-    query.bindValue(":email", email);
-    if (!query.exec()) {
-        Utils::sendDbusError(Utils::QueryError, message);
-        return QDBusObjectPath("/");
-    }
-
-    query.next();
-    quint64 id = query.value(0).toULongLong();
-
-    // Ignore the return value here: if the email doesn't get through they can request a new one later
-    Utils::sendVerificationEmail(id);
-
-    UserAccount* account = UserAccount::accountForId(id);
-    if (!account) {
-        Utils::sendDbusError(Utils::InternalError, message);
-        return QDBusObjectPath("/");
-    }
-
-    return account->path();
+    message.setDelayedReply(true);
+    Utils::generateHashedPasswordAsync(password).then(this, [username, email, message, timer](QString hashedPassword) {
+        quint64 id;
+        if (!Storage::instance()->createUser(username, hashedPassword, email, &id)) {
+            Utils::sendDbusError(Utils::QueryError, message);
+            return;
+        }
+
+        // Ignore the return value here: if the email doesn't get through they can request a new one later
+        Utils::sendVerificationEmail(id);
+
+        UserAccount* account = UserAccount::accountForId(id);
+        if (!account) {
+            Utils::sendDbusError(Utils::InternalError, message);
+            return;
+        }
+
+        Utils::accountsBus().send(message.createReply(QVariant::fromValue(account->path())));
+    });
+    return QDBusObjectPath("/");
 }
 
 QDBusObjectPath AccountManager::UserById(quint64 id, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     UserAccount* account = UserAccount::accountForId(id);
     if (!account) {
         Utils::sendDbusError(Utils::NoAccount, message);
@@ -124,6 +202,7 @@ QDBusObjectPath AccountManager::UserById(quint64 id, const QDBusMessage& message
 }
 
 quint64 AccountManager::UserIdByUsername(QString username, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     quint64 id = userIdByUsername(username);
     if (id == 0) {
         Utils::sendDbusError(Utils::NoAccount, message);
@@ -134,21 +213,34 @@ quint64 AccountManager::UserIdByUsername(QString username, const QDBusMessage& m
 }
 
 QString AccountManager::ProvisionToken(QString username, QString password, QString application, QVariantMap extraOptions, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     QVariantMap options;
     options.insert("username", username);
     options.insert("password", password);
     options.insert(extraOptions);
 
-    auto [result, error] = d->tokenProvisioningManager->provision("password", TokenProvisioningManager::TokenProvisioningPurpose::LoginToken, application, options);
-    if (error != Utils::DBusError::NoError) {
-        Utils::sendDbusError(error, message);
+    // Rate limit on the username that will actually be provisioned, which extraOptions can override
+    AdmissionControl::Ticket ticket(message, options.value("username").toString());
+    if (ticket.error() != Utils::NoError) {
+        Utils::sendDbusError(ticket.error(), message);
         return "";
     }
 
-    return result.value("token").toString();
+    message.setDelayedReply(true);
+    d->tokenProvisioningManager->provision("password", TokenProvisioningManager::TokenProvisioningPurpose::LoginToken, application, options).then(this, [message, timer, ticket](TokenProvisioningManager::ProvisionResult provisionResult) {
+        auto [result, error] = provisionResult;
+        if (error != Utils::DBusError::NoError) {
+            Utils::sendDbusError(error, message);
+            return;
+        }
+
+        Utils::accountsBus().send(message.createReply(result.value("token").toString()));
+    });
+    return "";
 }
 
 QString AccountManager::ForceProvisionToken(quint64 userId, QString application, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (application.isEmpty()) {
         Utils::sendDbusError(Utils::InvalidInput, message);
         return 0;
@@ -162,30 +254,25 @@ QString AccountManager::ForceProvisionToken(quint64 userId, QString application,
 
     QString newToken = Utils::generateSalt().toBase64();
 
-    QSqlQuery tokenInsertQuery;
-    tokenInsertQuery.prepare("INSERT INTO tokens(userid, token, application) VALUES(:id, :token, :application)");
-    tokenInsertQuery.bindValue(":id", userId);
-    tokenInsertQuery.bindValue(":token", newToken);
-    tokenInsertQuery.bindValue(":application", application);
-    if (!tokenInsertQuery.exec()) {
+    auto configuration = Configuration::current();
+    auto now = QDateTime::currentMSecsSinceEpoch();
+    if (!Storage::instance()->insertToken(userId, Storage::tokenDigest(newToken), application, now, now + configuration->tokenLifetime)) {
         Utils::sendDbusError(Utils::QueryError, message);
         return 0;
     }
+    if (configuration->tokenMaxPerUser > 0) TokenProvisioningManager::trimTokens(userId, configuration->tokenMaxPerUser);
 
     return newToken;
 }
 
 QDBusObjectPath AccountManager::UserForToken(QString token, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     quint64 tokenUser;
     TokenProvisioningManager::TokenProvisioningPurpose tokenPurpose;
     auto ok = d->tokenProvisioningManager->verifyToken(token, &tokenUser, &tokenPurpose);
-    if (!ok) {
-        Utils::sendDbusError(Utils::NoAccount, message);
-        return QDBusObjectPath("/");
-    }
-
-    if (tokenPurpose != TokenProvisioningManager::TokenProvisioningPurpose::LoginToken) {
-        Utils::sendDbusError(Utils::NoAccount, message);
+    auto error = AccountManagerPrivate::tokenError(ok, tokenPurpose, TokenProvisioningManager::TokenProvisioningPurpose::LoginToken);
+    if (error != Utils::NoError) {
+        Utils::sendDbusError(error, message);
         return QDBusObjectPath("/");
     }
 
@@ -193,53 +280,211 @@ QDBusObjectPath AccountManager::UserForToken(QString token, const QDBusMessage&
 }
 
 QDBusObjectPath AccountManager::UserForTokenWithPurpose(QString token, QString expectedTokenPurpose, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     quint64 tokenUser;
     TokenProvisioningManager::TokenProvisioningPurpose tokenPurpose;
     auto ok = d->tokenProvisioningManager->verifyToken(token, &tokenUser, &tokenPurpose);
-    if (!ok) {
-        Utils::sendDbusError(Utils::NoAccount, message);
+    auto error = AccountManagerPrivate::tokenError(ok, tokenPurpose, d->tokenProvisioningManager->purposeForString(expectedTokenPurpose));
+    if (error != Utils::NoError) {
+        Utils::sendDbusError(error, message);
         return QDBusObjectPath("/");
     }
 
-    if (tokenPurpose != d->tokenProvisioningManager->purposeForString(expectedTokenPurpose)) {
-        Utils::sendDbusError(Utils::NoAccount, message);
-        return QDBusObjectPath("/");
+    return UserById(tokenUser, message);
+}
+
+QList<BatchUserResult> AccountManager::UsersByIds(QList<quint64> ids, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    if (ids.size() > AccountManagerPrivate::maxBatchSize) {
+        Utils::sendDbusError(Utils::InvalidInput, message);
+        return {};
     }
 
-    return UserById(tokenUser, message);
+    return batchUserResults(ids);
+}
+
+QList<BatchUserIdResult> AccountManager::UserIdsByUsernames(QStringList usernames, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    if (usernames.size() > AccountManagerPrivate::maxBatchSize) {
+        Utils::sendDbusError(Utils::InvalidInput, message);
+        return {};
+    }
+
+    QList<BatchUserIdResult> results;
+    results.reserve(usernames.size());
+    if (usernames.isEmpty()) return results;
+
+    QHash<QString, quint64> ids;
+    if (!Storage::instance()->userIdsByUsernames(usernames, &ids)) {
+        Utils::sendDbusError(Utils::QueryError, message);
+        return {};
+    }
+
+    for (const auto& username : usernames) {
+        auto id = ids.value(username);
+        results.append({username, id, id == 0 ? Utils::dbusErrorName(Utils::NoAccount) : QString()});
+    }
+    return results;
+}
+
+QList<BatchUserResult> AccountManager::VerifyTokens(QStringList tokens, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    if (tokens.size() > AccountManagerPrivate::maxBatchSize) {
+        Utils::sendDbusError(Utils::InvalidInput, message);
+        return {};
+    }
+
+    // Like UserForToken, only login tokens identify a user here
+    QList<quint64> ids;
+    QList<Utils::DBusError> errors;
+    ids.reserve(tokens.size());
+    errors.reserve(tokens.size());
+    for (const auto& verification : d->tokenProvisioningManager->verifyTokens(tokens)) {
+        auto error = AccountManagerPrivate::tokenError(verification.valid, verification.purpose, TokenProvisioningManager::TokenProvisioningPurpose::LoginToken);
+        ids.append(error == Utils::NoError ? verification.userId : 0);
+        errors.append(error);
+    }
+
+    return batchUserResults(ids, errors);
+}
+
+QList<BatchUserResult> AccountManager::batchUserResults(const QList<quint64>& ids, const QList<Utils::DBusError>& errors) {
+    QList<BatchUserResult> results;
+    results.reserve(ids.size());
+
+    auto accounts = UserAccount::accountsForIds(ids);
+    for (auto i = 0; i < ids.size(); i++) {
+        auto error = errors.value(i, Utils::NoError);
+        if (error != Utils::NoError) {
+            results.append({ids.at(i), QDBusObjectPath("/"), {}, {}, false, Utils::dbusErrorName(error)});
+            continue;
+        }
+
+        auto* account = accounts.at(i);
+        if (!account) {
+            results.append({ids.at(i), QDBusObjectPath("/"), {}, {}, false, Utils::dbusErrorName(Utils::NoAccount)});
+            continue;
+        }
+
+        results.append({account->id(), account->path(), account->user()->username(), account->user()->email(), account->user()->verified(), {}});
+    }
+    return results;
+}
+
+void AccountManager::RevokeToken(QString token, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    if (!d->tokenProvisioningManager->revokeToken(token)) {
+        Utils::sendDbusError(Utils::QueryError, message);
+        return;
+    }
 }
 
 QList<quint64> AccountManager::AllUsers(const QDBusMessage& message) {
-    QSqlQuery query;
-    query.prepare("SELECT * FROM users");
+    Metrics::CallTimer timer(message);
+    QList<quint64> users;
+    auto ok = Storage::instance()->forEachUserId([&users](quint64 id) {
+        users.append(id);
+        return true;
+    });
 
-    if (!query.exec()) {
+    if (!ok) {
         Utils::sendDbusError(Utils::QueryError, message);
         return {};
     }
+    return users;
+}
+
+QList<quint64> AccountManager::UsersAfter(quint64 afterId, uint limit, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    if (limit == 0 || limit > AccountManagerPrivate::maxPageSize) {
+        Utils::sendDbusError(Utils::InvalidInput, message);
+        return {};
+    }
 
+    // Pass the last id of this page as afterId to get the next one
     QList<quint64> users;
-    while (query.next()) {
-        users.append(query.value("id").toULongLong());
+    if (!Storage::instance()->userIdsAfter(afterId, limit, &users)) {
+        Utils::sendDbusError(Utils::QueryError, message);
+        return {};
     }
     return users;
 }
 
+QDBusUnixFileDescriptor AccountManager::StreamAllUsers(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    if (!(Utils::accountsBus().connectionCapabilities() & QDBusConnection::UnixFileDescriptorPassing)) {
+        Utils::sendDbusError(Utils::InternalError, message);
+        return {};
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        Utils::sendDbusError(Utils::InternalError, message);
+        return {};
+    }
+
+    // QDBusUnixFileDescriptor keeps its own duplicate of the descriptor
+    QDBusUnixFileDescriptor readEnd(fds[0]);
+    close(fds[0]);
+    int writeEnd = fds[1];
+    shutdown(writeEnd, SHUT_RD);
+
+    // Don't let a client that stops reading hold a worker thread and database connection forever
+    timeval sendTimeout{30, 0};
+    setsockopt(writeEnd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    // Ids are written one per line in ascending order, and the stream ends when the socket is closed
+    QtConcurrent::run([writeEnd] {
+        QByteArray buffer;
+        buffer.reserve(65536);
+        auto flush = [&buffer, writeEnd] {
+            qsizetype written = 0;
+            while (written < buffer.size()) {
+                // MSG_NOSIGNAL turns a closed reader into an error instead of SIGPIPE
+                auto result = send(writeEnd, buffer.constData() + written, buffer.size() - written, MSG_NOSIGNAL);
+                if (result < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                written += result;
+            }
+            buffer.clear();
+            return true;
+        };
+
+        auto ok = Storage::instance()->forEachUserId([&buffer, &flush](quint64 id) {
+            buffer.append(QByteArray::number(id)).append('\n');
+            return buffer.size() < 65000 || flush();
+        });
+
+        if (ok) {
+            flush();
+        } else {
+            Logger::error() << "Could not query users to stream\n";
+        }
+        close(writeEnd);
+        Storage::instance()->releaseConnection();
+    });
+
+    return readEnd;
+}
+
 QStringList AccountManager::TokenProvisioningMethods(QString username, QString application, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     const quint64 id = userIdByUsername(username);
     if (id == 0) {
         Utils::sendDbusError(Utils::NoAccount, message);
         return {};
     }
 
-    QSqlQuery userQuery;
-    userQuery.prepare("SELECT * FROM users WHERE id=:id");
-    userQuery.bindValue(":id", id);
-    userQuery.exec();
-    userQuery.next();
+    auto user = Storage::instance()->user(id);
+    if (!user) {
+        Utils::sendDbusError(Utils::NoAccount, message);
+        return {};
+    }
 
     // Ensure the account is not disabled
-    QString passwordHash = userQuery.value("password").toString();
+    QString passwordHash = user->password;
     if (passwordHash.startsWith("!")) {
         Utils::sendDbusError(Utils::DisabledAccount, message);
         return {};
@@ -249,20 +494,21 @@ QStringList AccountManager::TokenProvisioningMethods(QString username, QString a
 }
 
 QStringList AccountManager::TokenProvisioningMethodsWithPurpose(QString username, QString purpose, QString application, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     const quint64 id = userIdByUsername(username);
     if (id == 0) {
         Utils::sendDbusError(Utils::NoAccount, message);
         return {};
     }
 
-    QSqlQuery userQuery;
-    userQuery.prepare("SELECT * FROM users WHERE id=:id");
-    userQuery.bindValue(":id", id);
-    userQuery.exec();
-    userQuery.next();
+    auto user = Storage::instance()->user(id);
+    if (!user) {
+        Utils::sendDbusError(Utils::NoAccount, message);
+        return {};
+    }
 
     // Ensure the account is not disabled
-    QString passwordHash = userQuery.value("password").toString();
+    QString passwordHash = user->password;
     if (passwordHash.startsWith("!")) {
         Utils::sendDbusError(Utils::DisabledAccount, message);
         return {};
@@ -272,21 +518,73 @@ QStringList AccountManager::TokenProvisioningMethodsWithPurpose(QString username
 }
 
 QVariantMap AccountManager::ProvisionTokenByMethod(QString method, QString username, QString application, QVariantMap extraOptions, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     QVariantMap options;
     options.insert("username", username);
     options.insert("application", application);
     options.insert(extraOptions);
 
-    auto [result, error] = d->tokenProvisioningManager->provision(method, d->tokenProvisioningManager->purposeForString(extraOptions.value("purpose", "login").toString()), application, options);
-    if (error != Utils::DBusError::NoError) {
-        Utils::sendDbusError(error, message);
+    // Rate limit on the username that will actually be provisioned, which extraOptions can override
+    AdmissionControl::Ticket ticket(message, options.value("username").toString());
+    if (ticket.error() != Utils::NoError) {
+        Utils::sendDbusError(ticket.error(), message);
         return {};
     }
 
-    return result;
+    message.setDelayedReply(true);
+    d->tokenProvisioningManager->provision(method, d->tokenProvisioningManager->purposeForString(extraOptions.value("purpose", "login").toString()), application, options).then(this, [message, timer, ticket](TokenProvisioningManager::ProvisionResult provisionResult) {
+        auto [result, error] = provisionResult;
+        if (error != Utils::DBusError::NoError) {
+            Utils::sendDbusError(error, message);
+            return;
+        }
+
+        Utils::accountsBus().send(message.createReply(result));
+    });
+    return {};
 }
 
 QDBusObjectPath AccountManager::CreateMailMessage(const QString& to, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     auto* mailMessage = new MailMessage(to);
     return mailMessage->path();
 }
+
+void AccountManager::ReloadConfiguration(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    if (!Configuration::instance()->reload()) {
+        Utils::sendDbusError(Utils::InternalError, message);
+        return;
+    }
+}
+
+QVariantMap AccountManager::CacheStatistics(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    return {
+        {"tokens",   TokenCache::instance()->statistics()},
+        {"accounts", UserAccount::cacheStatistics()      }
+    };
+}
+
+QVariantMap AccountManager::MailQueueStatistics(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    return MailQueue::instance()->statistics();
+}
+
+QVariantMap AccountManager::StorageStatistics(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+    return Storage::instance()->statistics();
+}
+
+int AccountManager::CalibratePasswordHashing(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
+
+    // Measure on the hashing pool so the result reflects the threads that do the real work
+    message.setDelayedReply(true);
+    QtConcurrent::run(Utils::hashingThreadPool(), [] {
+        return Utils::calibratePasswordHashing();
+    }).then(this, [message, timer](int iterations) {
+        Utils::accountsBus().send(message.createReply(iterations));
+    });
+    return 0;
+}
@@ -20,9 +20,30 @@
 #ifndef ACCOUNTMANAGER_H
 #define ACCOUNTMANAGER_H
 
+#include "utils.h"
 #include <QDBusAbstractAdaptor>
 #include <QDBusMessage>
 #include <QDBusObjectPath>
+#include <QDBusUnixFileDescriptor>
+
+struct BatchUserResult {
+        quint64 id;
+        QDBusObjectPath path;
+        QString username;
+        QString email;
+        bool verified;
+        QString error;
+};
+Q_DECLARE_METATYPE(BatchUserResult)
+Q_DECLARE_METATYPE(QList<BatchUserResult>)
+
+struct BatchUserIdResult {
+        QString username;
+        quint64 id;
+        QString error;
+};
+Q_DECLARE_METATYPE(BatchUserIdResult)
+Q_DECLARE_METATYPE(QList<BatchUserIdResult>)
 
 struct AccountManagerPrivate;
 class AccountManager : public QObject {
@@ -46,13 +67,26 @@ class AccountManager : public QObject {
         Q_SCRIPTABLE QVariantMap ProvisionTokenByMethod(QString method, QString username, QString application, QVariantMap extraOptions, const QDBusMessage& message);
         Q_SCRIPTABLE QDBusObjectPath UserForToken(QString token, const QDBusMessage& message);
         Q_SCRIPTABLE QDBusObjectPath UserForTokenWithPurpose(QString token, QString expectedTokenPurpose, const QDBusMessage& message);
+        Q_SCRIPTABLE QList<BatchUserResult> UsersByIds(QList<quint64> ids, const QDBusMessage& message);
+        Q_SCRIPTABLE QList<BatchUserIdResult> UserIdsByUsernames(QStringList usernames, const QDBusMessage& message);
+        Q_SCRIPTABLE QList<BatchUserResult> VerifyTokens(QStringList tokens, const QDBusMessage& message);
+        Q_SCRIPTABLE void RevokeToken(QString token, const QDBusMessage& message);
         Q_SCRIPTABLE QList<quint64> AllUsers(const QDBusMessage& message);
+        Q_SCRIPTABLE QList<quint64> UsersAfter(quint64 afterId, uint limit, const QDBusMessage& message);
+        Q_SCRIPTABLE QDBusUnixFileDescriptor StreamAllUsers(const QDBusMessage& message);
         Q_SCRIPTABLE QDBusObjectPath CreateMailMessage(const QString& to, const QDBusMessage& message);
+        Q_SCRIPTABLE void ReloadConfiguration(const QDBusMessage& message);
+        Q_SCRIPTABLE QVariantMap CacheStatistics(const QDBusMessage& message);
+        Q_SCRIPTABLE QVariantMap MailQueueStatistics(const QDBusMessage& message);
+        Q_SCRIPTABLE QVariantMap StorageStatistics(const QDBusMessage& message);
+        Q_SCRIPTABLE int CalibratePasswordHashing(const QDBusMessage& message);
 
     signals:
 
     private:
         AccountManagerPrivate* d;
+
+        QList<BatchUserResult> batchUserResults(const QList<quint64>& ids, const QList<Utils::DBusError>& errors = {});
 };
 
 #endif // ACCOUNTMANAGER_H
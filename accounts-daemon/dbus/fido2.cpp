@@ -21,14 +21,16 @@
 #include "useraccount.h"
 #include "user.h"
 
+#include "fidohelper.h"
 #include "fidoutils.h"
+#include "metrics.h"
+#include "storage/storage.h"
 #include "utils.h"
+#include <QCoreApplication>
 #include <QDBusMetaType>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
-#include <QProcess>
-#include <QSqlQuery>
 
 struct Fido2Private {
         UserAccount* parent;
@@ -54,8 +56,12 @@ const QDBusArgument& operator>>(const QDBusArgument& argument, Fido2::Fido2Key&
 
 Fido2::Fido2(UserAccount* parent) :
     QDBusAbstractAdaptor{parent} {
-    qDBusRegisterMetaType<Fido2Key>();
-    qDBusRegisterMetaType<QList<Fido2Key>>();
+    static const bool metaTypesRegistered = [] {
+        qDBusRegisterMetaType<Fido2Key>();
+        qDBusRegisterMetaType<QList<Fido2Key>>();
+        return true;
+    }();
+    Q_UNUSED(metaTypesRegistered)
 
     d = new Fido2Private();
     d->parent = parent;
@@ -66,6 +72,7 @@ Fido2::~Fido2() {
 }
 
 QString Fido2::PrepareRegister(QString application, QString rp, int authenticatorAttachment, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (authenticatorAttachment > 2 || authenticatorAttachment < 0) {
         Utils::sendDbusError(Utils::InvalidInput, message);
         return "";
@@ -96,30 +103,32 @@ QString Fido2::PrepareRegister(QString application, QString rp, int authenticato
     QJsonObject payload;
     payload.insert("existingCreds", QJsonArray::fromStringList(FidoUtils::FidoCredsForUser(d->parent->id(), application)));
 
-    QProcess fidoHelper;
-    fidoHelper.start(Utils::fidoHelperPath(), args);
-    fidoHelper.write(QJsonDocument(payload).toJson());
-    fidoHelper.closeWriteChannel();
-    fidoHelper.waitForFinished(-1);
-
-    if (fidoHelper.error() != QProcess::UnknownError) {
-        Utils::sendDbusError(Utils::FidoSupportUnavailable, message);
-        return "";
-    }
-
-    if (fidoHelper.exitCode() != 0) {
-        Utils::sendDbusError(Utils::InternalError, message);
-        return "";
-    }
-
-    auto output = fidoHelper.readAllStandardOutput();
-
-    d->prepareCache = QJsonDocument::fromJson(output).object();
-    return QJsonDocument(d->prepareCache).toJson();
+    message.setDelayedReply(true);
+    // This account may be evicted from the cache while the helper runs, so the options are kept on whichever object is current
+    FidoHelper::instance()->run(args, payload).then(QCoreApplication::instance(), [id = d->parent->id(), application, rp, message, timer](FidoHelper::Result result) {
+        if (result.error != Utils::NoError) {
+            Utils::sendDbusError(result.error, message);
+            return;
+        }
+
+        auto* account = UserAccount::accountForId(id);
+        if (!account) {
+            Utils::sendDbusError(Utils::NoAccount, message);
+            return;
+        }
+
+        auto* fido2 = account->fido2();
+        fido2->d->lastRpName = application;
+        fido2->d->lastRpId = rp;
+        fido2->d->prepareCache = QJsonDocument::fromJson(result.output).object();
+        Utils::accountsBus().send(message.createReply(QString(QJsonDocument(fido2->d->prepareCache).toJson())));
+    });
+    return "";
 }
 
 void Fido2::CompleteRegister(QString response, QStringList expectOrigins, QString keyName,
     const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
 
     QJsonParseError parseError;
     auto responseDoc = QJsonDocument::fromJson(response.toUtf8(), &parseError);
@@ -140,59 +149,41 @@ void Fido2::CompleteRegister(QString response, QStringList expectOrigins, QStrin
     payload.insert("response", responseDoc.object());
     payload.insert("expectOrigins", QJsonArray::fromStringList(expectOrigins));
 
-    QProcess fidoHelper;
-    fidoHelper.start(Utils::fidoHelperPath(), args);
-    fidoHelper.write(QJsonDocument(payload).toJson());
-    fidoHelper.closeWriteChannel();
-    fidoHelper.waitForFinished(-1);
-
-    if (fidoHelper.error() != QProcess::UnknownError) {
-        Utils::sendDbusError(Utils::FidoSupportUnavailable, message);
-        return;
-    }
-
-    if (fidoHelper.exitCode() != 0) {
-        Utils::sendDbusError(Utils::InternalError, message);
-        return;
-    }
-
-    auto output = fidoHelper.readAllStandardOutput();
-
-    QSqlQuery query;
-    query.prepare("INSERT INTO fido(userid, data, name, application) VALUES(:userid, :data, :name, :application)");
-    query.bindValue(":userid", d->parent->id());
-    query.bindValue(":data", output);
-    query.bindValue(":name", keyName);
-    query.bindValue(":application", d->lastRpName);
-
-    if (!query.exec()) {
-        Utils::sendDbusError(Utils::QueryError, message);
-        return;
-    }
-
-    if (d->parent->user()->verified()) {
-        Utils::sendTemplateEmail("fido-new-key", {d->parent->user()->email()}, d->parent->user()->locale(), {
-                                             {"user", d->parent->user()->username()},
-                                             {"key", keyName},
-                                             {"application", d->lastRpName}
-                                         });
-    }
+    message.setDelayedReply(true);
+    FidoHelper::instance()->run(args, payload).then(QCoreApplication::instance(), [id = d->parent->id(), rpName = d->lastRpName, message, keyName, timer](FidoHelper::Result result) {
+        if (result.error != Utils::NoError) {
+            Utils::sendDbusError(result.error, message);
+            return;
+        }
+
+        if (!Storage::instance()->insertFidoKey(id, result.output, keyName, rpName)) {
+            Utils::sendDbusError(Utils::QueryError, message);
+            return;
+        }
+
+        auto* account = UserAccount::accountForId(id);
+        if (account && account->user()->verified()) {
+            Utils::sendTemplateEmail("fido-new-key", {account->user()->email()}, account->user()->locale(), {
+                                                 {"user", account->user()->username()},
+                                                 {"key", keyName},
+                                                 {"application", rpName}
+                                             });
+        }
+
+        Utils::accountsBus().send(message.createReply());
+    });
 }
 
 void Fido2::DeleteKey(int id, const QDBusMessage& message) {
-    QSqlQuery query;
-    query.prepare("DELETE FROM fido WHERE userid=:userid AND id=:id RETURNING name, application");
-    query.bindValue(":userid", d->parent->id());
-    query.bindValue(":id", id);
-
-    if (!query.exec()) {
+    Metrics::CallTimer timer(message);
+    StoredFidoKey deletedKey;
+    if (Storage::instance()->deleteFidoKey(d->parent->id(), id, &deletedKey) == Storage::Status::Failed) {
         Utils::sendDbusError(Utils::QueryError, message);
         return;
     }
 
-    query.next();
-    auto keyName = query.value("name").toString();
-    auto application = query.value("application").toString();
+    auto keyName = deletedKey.name;
+    auto application = deletedKey.application;
 
     if (d->parent->user()->verified()) {
         Utils::sendTemplateEmail("fido-remove-key", {d->parent->user()->email()}, d->parent->user()->locale(), {
@@ -204,20 +195,19 @@ void Fido2::DeleteKey(int id, const QDBusMessage& message) {
 }
 
 QList<Fido2::Fido2Key> Fido2::GetKeys(const QDBusMessage& message) {
-    QSqlQuery query;
-    query.prepare("SELECT id, name, application FROM fido WHERE userid=:userid");
-    query.bindValue(":userid", d->parent->id());
-    if (!query.exec()) {
+    Metrics::CallTimer timer(message);
+    QList<StoredFidoKey> storedKeys;
+    if (!Storage::instance()->fidoKeys(d->parent->id(), &storedKeys)) {
         Utils::sendDbusError(Utils::QueryError, message);
         return {};
     }
 
     QList<Fido2Key> keys;
-    while (query.next()) {
+    for (const auto& storedKey : storedKeys) {
         Fido2Key key;
-        key.id = query.value("id").toInt();
-        key.name = query.value("name").toString();
-        key.application = query.value("application").toString();
+        key.id = storedKey.id;
+        key.name = storedKey.name;
+        key.application = storedKey.application;
         keys.append(key);
     }
     return keys;
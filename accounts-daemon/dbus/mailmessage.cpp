@@ -3,6 +3,8 @@
 //
 
 #include "mailmessage.h"
+#include "configuration.h"
+#include "metrics.h"
 #include "src/mimehtml.h"
 #include "src/mimemessage.h"
 #include "utils.h"
@@ -31,8 +33,9 @@ MailMessage::MailMessage(const QString& to, QObject* parent) :
 
     d = new MailMessagePrivate();
     d->path = QStringLiteral("/com/vicr123/accounts/mail/Message%1").arg(d->nextId++);
-    d->from = qEnvironmentVariable("SMTP_SENDER_NAME");
-    d->fromAddress = qEnvironmentVariable("SMTP_SENDER_EMAIL");
+    auto configuration = Configuration::current();
+    d->from = configuration->smtpSenderName;
+    d->fromAddress = configuration->smtpSenderEmail;
     d->to = to;
 
     Utils::accountsBus().registerObject(d->path, this, QDBusConnection::ExportScriptableContents);
@@ -55,6 +58,7 @@ QString MailMessage::subject() {
 }
 
 [[maybe_unused]] void MailMessage::Send(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     message.setDelayedReply(true);
 
     auto mailMessage = new MimeMessage;
@@ -73,7 +77,7 @@ QString MailMessage::subject() {
 
     auto watcher = new QFutureWatcher<void>(this);
     watcher->setFuture(Utils::sendMailMessage(mailMessage));
-    connect(watcher, &QFutureWatcher<void>::finished, this, [message, this, watcher] {
+    connect(watcher, &QFutureWatcher<void>::finished, this, [message, this, watcher, timer] {
         if (watcher->isCanceled()) return;
 
         auto reply = message.createReply();
@@ -87,6 +91,7 @@ QString MailMessage::subject() {
 }
 
 [[maybe_unused]] void MailMessage::Discard(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     this->deleteLater();
 }
 
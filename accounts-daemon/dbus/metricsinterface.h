@@ -0,0 +1,41 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef METRICSINTERFACE_H
+#define METRICSINTERFACE_H
+
+#include <QDBusAbstractAdaptor>
+#include <QDBusMessage>
+
+class AccountManager;
+class MetricsInterface : public QDBusAbstractAdaptor {
+        Q_OBJECT
+        Q_CLASSINFO("D-Bus Interface", "com.vicr123.accounts.Metrics");
+    public:
+        explicit MetricsInterface(AccountManager* parent);
+        ~MetricsInterface();
+
+    public slots:
+        Q_SCRIPTABLE QVariantMap Snapshot(const QDBusMessage& message);
+        Q_SCRIPTABLE QString Prometheus(const QDBusMessage& message);
+
+    signals:
+};
+
+#endif // METRICSINTERFACE_H
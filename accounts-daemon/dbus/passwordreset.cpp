@@ -19,9 +19,11 @@
  * *************************************/
 #include "passwordreset.h"
 
-#include <QSqlQuery>
+#include <QCoreApplication>
 #include <QDBusMetaType>
 #include <QDateTime>
+#include "metrics.h"
+#include "storage/storage.h"
 #include "useraccount.h"
 #include "utils.h"
 
@@ -47,10 +49,14 @@ PasswordReset::PasswordReset(UserAccount* parent) : QDBusAbstractAdaptor(parent)
     d = new PasswordResetPrivate();
     d->parent = parent;
 
-    qRegisterMetaType<ResetMethod>();
-    qRegisterMetaType<QList<ResetMethod>>();
-    qDBusRegisterMetaType<ResetMethod>();
-    qDBusRegisterMetaType<QList<ResetMethod>>();
+    static const bool metaTypesRegistered = [] {
+        qRegisterMetaType<ResetMethod>();
+        qRegisterMetaType<QList<ResetMethod>>();
+        qDBusRegisterMetaType<ResetMethod>();
+        qDBusRegisterMetaType<QList<ResetMethod>>();
+        return true;
+    }();
+    Q_UNUSED(metaTypesRegistered)
 }
 
 PasswordReset::~PasswordReset() {
@@ -58,19 +64,17 @@ PasswordReset::~PasswordReset() {
 }
 
 QList<ResetMethod> PasswordReset::ResetMethods(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     QList<ResetMethod> methods;
 
-    QSqlQuery userQuery;
-    userQuery.prepare("SELECT * FROM users WHERE id=:id");
-    userQuery.bindValue(":id", d->parent->id());
-    userQuery.exec();
-    if (!userQuery.next()) {
+    auto user = Storage::instance()->user(d->parent->id());
+    if (!user) {
         Utils::sendDbusError(Utils::QueryError, message);
         return {};
     }
 
     [&] {
-        QString email = userQuery.value("email").toString();
+        QString email = user->email;
         if (!email.contains("@")) return;
 
         QString user = email.split("@").first();
@@ -91,17 +95,15 @@ QList<ResetMethod> PasswordReset::ResetMethods(const QDBusMessage& message) {
 }
 
 void PasswordReset::ResetPassword(QString type, QVariantMap challenge, const QDBusMessage& message) {
-    QSqlQuery userQuery;
-    userQuery.prepare("SELECT * FROM users WHERE id=:id");
-    userQuery.bindValue(":id", d->parent->id());
-    userQuery.exec();
-    if (!userQuery.next()) {
+    Metrics::CallTimer timer(message);
+    auto user = Storage::instance()->user(d->parent->id());
+    if (!user) {
         Utils::sendDbusError(Utils::QueryError, message);
         return;
     }
 
     if (type == "email") {
-        QString email = userQuery.value("email").toString();
+        QString email = user->email;
         if (email == challenge.value("email").toString()) {
             //Issue the password reset
             issuePasswordReset();
@@ -113,28 +115,23 @@ void PasswordReset::ResetPassword(QString type, QVariantMap challenge, const QDB
 }
 
 void PasswordReset::issuePasswordReset() {
-    QSqlQuery userQuery;
-    userQuery.prepare("SELECT * FROM users WHERE id=:id");
-    userQuery.bindValue(":id", d->parent->id());
-    userQuery.exec();
-    if (!userQuery.next()) {
+    auto user = Storage::instance()->user(d->parent->id());
+    if (!user) {
         return;
     }
 
     QString password = Utils::generateRandomBytes(24).toBase64();
+    QString email = user->email;
+    QString username = user->username;
 
-    QSqlQuery resetQuery;
-    resetQuery.prepare("INSERT INTO passwordResets(userId, temporaryPassword, expiry) VALUES(:id, :password, :expiry) ON CONFLICT ON CONSTRAINT pk_passwordresets DO UPDATE SET temporaryPassword=:password, expiry=:expiry");
-    resetQuery.bindValue(":id", d->parent->id());
-    resetQuery.bindValue(":password", Utils::generateHashedPassword(password));
-    resetQuery.bindValue(":expiry", QDateTime::currentMSecsSinceEpoch() + 30 * 60 * 1000);
-
-    if (!resetQuery.exec()) {
-        return;
-    }
+    Utils::generateHashedPasswordAsync(password).then(QCoreApplication::instance(), [id = d->parent->id(), password, email, username](QString hashedPassword) {
+        if (!Storage::instance()->setPasswordReset(id, hashedPassword, QDateTime::currentMSecsSinceEpoch() + 30 * 60 * 1000)) {
+            return;
+        }
 
-    Utils::sendTemplateEmail("recover", {userQuery.value("email").toString()}, "en", {
-        {"user", userQuery.value("username").toString()},
-        {"password", password}
+        Utils::sendTemplateEmail("recover", {email}, "en", {
+            {"user", username},
+            {"password", password}
+        });
     });
 }
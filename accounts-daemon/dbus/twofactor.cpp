@@ -20,8 +20,9 @@
 #include "twofactor.h"
 
 #include <QDBusMetaType>
-#include <QSqlQuery>
-#include <QtConcurrent>
+#include <QRandomGenerator>
+#include "metrics.h"
+#include "storage/storage.h"
 #include "useraccount.h"
 #include "utils.h"
 #include "user.h"
@@ -30,7 +31,10 @@ struct TwoFactorPrivate {
     UserAccount* parent;
     bool enabled = false;
     QString secretKey;
+    Totp totp;
     QList<OtpBackupKeys> backups;
+    QList<QByteArray> backupDigests;
+    bool backupsLoaded = false;
 };
 
 QDBusArgument& operator<<(QDBusArgument& arg, const OtpBackupKeys& keys) {
@@ -47,26 +51,23 @@ const QDBusArgument& operator>>(const QDBusArgument& arg, OtpBackupKeys& keys) {
     return arg;
 }
 
-TwoFactor::TwoFactor(UserAccount* parent) : QDBusAbstractAdaptor(parent) {
+TwoFactor::TwoFactor(UserAccount* parent, QString secretKey, bool enabled) : QDBusAbstractAdaptor(parent) {
     d = new TwoFactorPrivate();
     d->parent = parent;
-
-    qRegisterMetaType<OtpBackupKeys>();
-    qRegisterMetaType<QList<OtpBackupKeys>>();
-    qDBusRegisterMetaType<OtpBackupKeys>();
-    qDBusRegisterMetaType<QList<OtpBackupKeys>>();
-
-    QSqlQuery query;
-    query.prepare("SELECT * FROM otp WHERE userid=:id");
-    query.bindValue(":id", d->parent->id());
-    query.exec();
-
-    if (query.next()) {
-        d->secretKey = query.value("otpkey").toString();
-        d->enabled = query.value("enabled").toBool();
-    }
-
-    reloadBackupKeys();
+    d->secretKey = secretKey;
+    d->totp = Totp(secretKey);
+    d->enabled = enabled;
+
+    static const bool metaTypesRegistered = [] {
+        qRegisterMetaType<OtpBackupKeys>();
+        qRegisterMetaType<QList<OtpBackupKeys>>();
+        qDBusRegisterMetaType<OtpBackupKeys>();
+        qDBusRegisterMetaType<QList<OtpBackupKeys>>();
+        return true;
+    }();
+    Q_UNUSED(metaTypesRegistered)
+
+    // Backup keys are only loaded once somebody asks for them
 }
 
 TwoFactor::~TwoFactor() {
@@ -75,21 +76,29 @@ TwoFactor::~TwoFactor() {
 
 void TwoFactor::reloadBackupKeys() {
     d->backups.clear();
-    QSqlQuery backupsQuery;
-    backupsQuery.prepare("SELECT * FROM otpbackup WHERE userid=:id");
-    backupsQuery.bindValue(":id", d->parent->id());
-    backupsQuery.exec();
-
-    while (backupsQuery.next()) {
-        d->backups.append({
-            backupsQuery.value("backupkey").toString(),
-            backupsQuery.value("used").toBool()
-        });
+    d->backupDigests.clear();
+    d->backupsLoaded = true;
+
+    // Only digests are stored, so keys read back from storage can't be shown again
+    QList<StoredBackupKey> backupKeys;
+    Storage::instance()->backupKeys(d->parent->id(), &backupKeys);
+    for (const auto& backupKey : backupKeys) {
+        d->backups.append({QString(), backupKey.used});
+        d->backupDigests.append(backupKey.digest);
     }
 
     emit BackupKeysChanged(d->backups);
 }
 
+void TwoFactor::backupKeyUsed(QByteArray digest) {
+    // Keys that haven't been loaded yet will be read fresh when they are asked for
+    if (!d->backupsLoaded) return;
+
+    auto index = d->backupDigests.indexOf(digest);
+    if (index >= 0) d->backups[index].used = true;
+    emit BackupKeysChanged(d->backups);
+}
+
 bool TwoFactor::twoFactorEnabled() {
     return d->enabled;
 }
@@ -98,11 +107,17 @@ QString TwoFactor::secretKey() {
     return d->secretKey;
 }
 
+Totp TwoFactor::totp() {
+    return d->totp;
+}
+
 QList<OtpBackupKeys> TwoFactor::backupKeys() {
+    if (!d->backupsLoaded) reloadBackupKeys();
     return d->backups;
 }
 
 QString TwoFactor::GenerateTwoFactorKey(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (d->enabled) {
         //2FA should be disabled first
         Utils::sendDbusError(Utils::TwoFactorEnabled, message);
@@ -111,42 +126,33 @@ QString TwoFactor::GenerateTwoFactorKey(const QDBusMessage& message) {
 
     QString newKey = Utils::generateSharedOtpKey();
 
-    QSqlQuery query;
-    query.prepare("INSERT INTO otp(userid, otpkey, enabled) VALUES(:id, :otpkey, :enabled) ON CONFLICT ON CONSTRAINT otp_pkey DO UPDATE SET otpkey=:otpkey, enabled=:enabled WHERE otp.userid=:id");
-    query.bindValue(":id", d->parent->id());
-    query.bindValue(":otpkey", newKey);
-    query.bindValue(":enabled", false);
-
-    if (!query.exec()) {
+    if (!Storage::instance()->setOtpKey(d->parent->id(), newKey)) {
         Utils::sendDbusError(Utils::QueryError, message);
         return "";
     }
 
     d->secretKey = newKey;
+    d->totp = Totp(newKey);
     emit SecretKeyChanged(d->secretKey);
 
     return newKey;
 }
 
 void TwoFactor::EnableTwoFactorAuthentication(QString otpKey, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (d->enabled) {
         //2FA should be disabled first
         Utils::sendDbusError(Utils::TwoFactorEnabled, message);
         return;
     }
 
-    if (!Utils::isValidOtpKey(otpKey, d->secretKey)) {
+    if (!d->totp.verify(d->parent->id(), otpKey)) {
         Utils::sendDbusError(Utils::TwoFactorRequired, message);
         return;
     }
 
 
-    QSqlQuery query;
-    query.prepare("UPDATE otp SET enabled=:enabled WHERE otp.userid=:id");
-    query.bindValue(":id", d->parent->id());
-    query.bindValue(":enabled", true);
-
-    if (!query.exec()) {
+    if (!Storage::instance()->setOtpEnabled(d->parent->id(), true)) {
         Utils::sendDbusError(Utils::QueryError, message);
         return;
     }
@@ -168,18 +174,14 @@ void TwoFactor::EnableTwoFactorAuthentication(QString otpKey, const QDBusMessage
 }
 
 void TwoFactor::DisableTwoFactorAuthentication(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (!d->enabled) {
         //2FA should be enabled first
         Utils::sendDbusError(Utils::TwoFactorDisabled, message);
         return;
     }
 
-    QSqlQuery query;
-    query.prepare("UPDATE otp SET enabled=:enabled WHERE otp.userid=:id");
-    query.bindValue(":id", d->parent->id());
-    query.bindValue(":enabled", false);
-
-    if (!query.exec()) {
+    if (!Storage::instance()->setOtpEnabled(d->parent->id(), false)) {
         Utils::sendDbusError(Utils::QueryError, message);
         return;
     }
@@ -195,6 +197,7 @@ void TwoFactor::DisableTwoFactorAuthentication(const QDBusMessage& message) {
 }
 
 void TwoFactor::RegenerateBackupKeys(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     auto error = regenerateBackupKeys();
     if (error != Utils::NoError) {
         Utils::sendDbusError(error, message);
@@ -214,45 +217,28 @@ Utils::DBusError TwoFactor::regenerateBackupKeys() {
         return Utils::TwoFactorDisabled;
     }
 
-    QSqlDatabase db;
-    db.transaction();
-
-    QSqlQuery deleteQuery;
-    deleteQuery.prepare("DELETE FROM otpbackup WHERE userid=:id");
-    deleteQuery.bindValue(":id", d->parent->id());
-    if (!deleteQuery.exec()) {
-        db.rollback();
-        return Utils::QueryError;
-    }
-
     QList<OtpBackupKeys> backups;
+    QList<QByteArray> digests;
+    QList<StoredBackupKey> storedKeys;
     for (int i = 0; i < 10; i++) {
         quint32 backup = QRandomGenerator::system()->generate();
         QString key;
         for (int j = 0; j < 4; j++) {
             key.append(QString::number((backup >> (j * 8)) & 0xFF).rightJustified(3, '0'));
         }
+        auto digest = Storage::backupKeyDigest(d->parent->id(), key);
         backups.append({key, false});
+        digests.append(digest);
+        storedKeys.append({digest, false});
     }
 
-    QSqlQuery query;
-    query.prepare("INSERT INTO otpbackup(userid, backupkey, used) VALUES(:id, :backupkey, :used)");
-    query.bindValue(":id", QVariant::fromValue(QList<quint64>().fill(d->parent->id(), 10)));
-    query.bindValue(":backupkey", QtConcurrent::blockingMapped(backups, [ = ](OtpBackupKeys key) {
-        return key.key;
-    }));
-    query.bindValue(":used", QVariant::fromValue(QList<bool>().fill(false, 10)));
-
-    if (!query.execBatch()) {
-        db.rollback();
-        return Utils::QueryError;
-    }
-
-    if (db.commit()) {
+    if (!Storage::instance()->replaceBackupKeys(d->parent->id(), storedKeys)) {
         return Utils::QueryError;
     }
 
     d->backups = backups;
+    d->backupDigests = digests;
+    d->backupsLoaded = true;
     emit BackupKeysChanged(backups);
 
     return Utils::NoError;
@@ -22,6 +22,7 @@
 
 #include <QDBusAbstractAdaptor>
 #include <QDBusMessage>
+#include "totp.h"
 #include "utils.h"
 
 struct OtpBackupKeys {
@@ -40,13 +41,15 @@ class TwoFactor : public QDBusAbstractAdaptor {
         Q_SCRIPTABLE Q_PROPERTY(QList<OtpBackupKeys> BackupKeys READ backupKeys NOTIFY BackupKeysChanged);
 
     public:
-        explicit TwoFactor(UserAccount* parent);
+        explicit TwoFactor(UserAccount* parent, QString secretKey, bool enabled);
         ~TwoFactor();
 
         void reloadBackupKeys();
+        void backupKeyUsed(QByteArray digest);
 
         bool twoFactorEnabled();
         QString secretKey();
+        Totp totp();
         QList<OtpBackupKeys> backupKeys();
 
         Utils::DBusError regenerateBackupKeys();
@@ -20,11 +20,14 @@
 #include "user.h"
 
 #include "mailmessage.h"
+#include "metrics.h"
+#include "storage/storage.h"
+#include "token-provisioning/tokencache.h"
 #include "useraccount.h"
 #include "utils.h"
 #include "validation.h"
+#include <QCoreApplication>
 #include <QDateTime>
-#include <QSqlQuery>
 
 struct UserPrivate {
         UserAccount* parent;
@@ -33,20 +36,13 @@ struct UserPrivate {
         bool verified;
 };
 
-User::User(UserAccount* parent) :
+User::User(UserAccount* parent, QString username, QString email, bool verified) :
     QDBusAbstractAdaptor(parent) {
     d = new UserPrivate();
     d->parent = parent;
-
-    QSqlQuery query;
-    query.prepare("SELECT * FROM users WHERE id=:id");
-    query.bindValue(":id", d->parent->id());
-    query.exec();
-    query.next();
-
-    d->username = query.value("username").toString();
-    d->email = query.value("email").toString();
-    d->verified = query.value("verified").toBool();
+    d->username = username;
+    d->email = email;
+    d->verified = verified;
 }
 
 User::~User() {
@@ -70,6 +66,7 @@ bool User::verified() {
 }
 
 void User::SetUsername(QString username, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (username.isEmpty()) {
         Utils::sendDbusError(Utils::InvalidInput, message);
         return;
@@ -82,11 +79,7 @@ void User::SetUsername(QString username, const QDBusMessage& message) {
 
     QString oldUsername = d->username;
 
-    QSqlQuery query;
-    query.prepare("UPDATE users SET username=:username WHERE id=:id");
-    query.bindValue(":username", username);
-    query.bindValue(":id", d->parent->id());
-    if (!query.exec()) {
+    if (!Storage::instance()->setUsername(d->parent->id(), username)) {
         Utils::sendDbusError(Utils::QueryError, message);
         return;
     }
@@ -96,23 +89,26 @@ void User::SetUsername(QString username, const QDBusMessage& message) {
 }
 
 void User::SetPassword(QString password, const QDBusMessage& message) {
-    auto error = setPassword(password);
-    if (error != Utils::NoError) {
-        Utils::sendDbusError(error, message);
-    }
+    Metrics::CallTimer timer(message);
+    message.setDelayedReply(true);
+    setPassword(password).then(QCoreApplication::instance(), [message, timer](Utils::DBusError error) {
+        if (error != Utils::NoError) {
+            Utils::sendDbusError(error, message);
+            return;
+        }
+
+        Utils::accountsBus().send(message.createReply());
+    });
 }
 
 void User::SetEmail(QString email, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (!Validation::validateEmailAddress(email)) {
         Utils::sendDbusError(Utils::InvalidInput, message);
         return;
     }
 
-    QSqlQuery query;
-    query.prepare("UPDATE users SET email=:email, verified=false WHERE id=:id");
-    query.bindValue(":email", email);
-    query.bindValue(":id", d->parent->id());
-    if (!query.exec()) {
+    if (!Storage::instance()->setEmail(d->parent->id(), email)) {
         Utils::sendDbusError(Utils::QueryError, message);
         return;
     }
@@ -125,6 +121,7 @@ void User::SetEmail(QString email, const QDBusMessage& message) {
 }
 
 void User::ResendVerificationEmail(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (!Utils::sendVerificationEmail(d->parent->id())) {
         Utils::sendDbusError(Utils::InternalError, message);
         return;
@@ -132,45 +129,21 @@ void User::ResendVerificationEmail(const QDBusMessage& message) {
 }
 
 void User::VerifyEmail(QString verificationCode, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (verificationCode.isEmpty()) {
         Utils::sendDbusError(Utils::InvalidInput, message);
         return;
     }
 
-    QSqlDatabase db;
-    db.transaction();
-
-    QSqlQuery query;
-    query.prepare("DELETE FROM verifications WHERE userid=:id AND verificationstring=:code AND expiry > :now");
-    query.bindValue(":id", d->parent->id());
-    query.bindValue(":code", verificationCode);
-    query.bindValue(":now", QDateTime::currentMSecsSinceEpoch());
-
-    if (!query.exec()) {
-        db.rollback();
-        Utils::sendDbusError(Utils::QueryError, message);
-        return;
-    }
-
-    if (query.numRowsAffected() == 0) {
-        db.rollback();
-        Utils::sendDbusError(Utils::VerificationCodeIncorrect, message);
-        return;
-    }
-
-    QSqlQuery updateUserQuery;
-    updateUserQuery.prepare("UPDATE users SET verified=:verified WHERE id=:id");
-    updateUserQuery.bindValue(":verified", true);
-    updateUserQuery.bindValue(":id", d->parent->id());
-    if (!updateUserQuery.exec()) {
-        db.rollback();
-        Utils::sendDbusError(Utils::QueryError, message);
-        return;
-    }
-
-    if (db.commit()) {
-        Utils::sendDbusError(Utils::QueryError, message);
-        return;
+    switch (Storage::instance()->consumeVerification(d->parent->id(), verificationCode, QDateTime::currentMSecsSinceEpoch())) {
+        case Storage::Status::Ok:
+            break;
+        case Storage::Status::NotFound:
+            Utils::sendDbusError(Utils::VerificationCodeIncorrect, message);
+            return;
+        case Storage::Status::Failed:
+            Utils::sendDbusError(Utils::QueryError, message);
+            return;
     }
 
     d->verified = true;
@@ -178,44 +151,47 @@ void User::VerifyEmail(QString verificationCode, const QDBusMessage& message) {
 }
 
 bool User::VerifyPassword(QString password, const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (password.isEmpty()) {
         Utils::sendDbusError(Utils::InvalidInput, message);
         return false;
     }
 
-    QSqlQuery userQuery;
-    userQuery.prepare("SELECT * FROM users WHERE id=:id");
-    userQuery.bindValue(":id", d->parent->id());
-    userQuery.exec();
-    userQuery.next();
+    auto user = Storage::instance()->user(d->parent->id());
+    if (!user) {
+        Utils::sendDbusError(Utils::QueryError, message);
+        return false;
+    }
 
     // Ensure the password is correct
-    QString passwordHash = userQuery.value("password").toString();
+    QString passwordHash = user->password;
     if (passwordHash.startsWith("!")) {
         Utils::sendDbusError(Utils::DisabledAccount, message);
         return false;
     }
 
-    return Utils::verifyHashedPassword(password, passwordHash);
+    message.setDelayedReply(true);
+    Utils::verifyHashedPasswordAsync(password, passwordHash).then(QCoreApplication::instance(), [id = d->parent->id(), message, timer, password, passwordHash](bool passwordCorrect) {
+        if (passwordCorrect) Utils::upgradePasswordHash(id, password, passwordHash);
+        Utils::accountsBus().send(message.createReply(passwordCorrect));
+    });
+    return false;
 }
 
 void User::ErasePassword(const QDBusMessage& message) {
-    QSqlQuery query;
-    query.prepare("UPDATE users SET password=:password WHERE id=:id");
-    query.bindValue(":password", "x");
-    query.bindValue(":id", d->parent->id());
-    if (!query.exec()) {
+    Metrics::CallTimer timer(message);
+    if (!Storage::instance()->setPassword(d->parent->id(), "x")) {
         Utils::sendDbusError(Utils::QueryError, message);
         return;
     }
+
+    // Tokens for this account should be checked against the database again
+    TokenCache::instance()->invalidateUser(d->parent->id());
 }
 
 void User::SetEmailVerified(bool verified, const QDBusMessage& message) {
-    QSqlQuery updateUserQuery;
-    updateUserQuery.prepare("UPDATE users SET verified=:verified WHERE id=:id");
-    updateUserQuery.bindValue(":verified", verified);
-    updateUserQuery.bindValue(":id", d->parent->id());
-    if (!updateUserQuery.exec()) {
+    Metrics::CallTimer timer(message);
+    if (!Storage::instance()->setVerified(d->parent->id(), verified)) {
         Utils::sendDbusError(Utils::QueryError, message);
         return;
     }
@@ -224,6 +200,7 @@ void User::SetEmailVerified(bool verified, const QDBusMessage& message) {
     emit VerifiedChanged(verified);
 }
 QDBusObjectPath User::CreateMailMessage(const QDBusMessage& message) {
+    Metrics::CallTimer timer(message);
     if (!verified()) {
         Utils::sendDbusError(Utils::AccountEmailNotVerified, message);
         return {};
@@ -233,22 +210,25 @@ QDBusObjectPath User::CreateMailMessage(const QDBusMessage& message) {
     return mailMessage->path();
 }
 
-Utils::DBusError User::setPassword(QString password) {
+QFuture<Utils::DBusError> User::setPassword(QString password) {
     if (password.isEmpty()) {
-        return Utils::InvalidInput;
+        return QtFuture::makeReadyFuture(Utils::InvalidInput);
     }
 
     if (!Validation::validatePassword(password)) {
-        return Utils::InvalidInput;
+        return QtFuture::makeReadyFuture(Utils::InvalidInput);
     }
 
-    QString hashedPassword = Utils::generateHashedPassword(password);
+    // This account may be evicted from the cache while the hash is worked out, so find it again afterwards
+    return Utils::generateHashedPasswordAsync(password).then(QCoreApplication::instance(), [id = d->parent->id()](QString hashedPassword) {
+        auto* account = UserAccount::accountForId(id);
+        if (!account) return Utils::NoAccount;
+        return account->user()->setHashedPassword(hashedPassword);
+    });
+}
 
-    QSqlQuery query;
-    query.prepare("UPDATE users SET password=:password WHERE id=:id");
-    query.bindValue(":password", hashedPassword);
-    query.bindValue(":id", d->parent->id());
-    if (!query.exec()) {
+Utils::DBusError User::setHashedPassword(QString hashedPassword) {
+    if (!Storage::instance()->setPassword(d->parent->id(), hashedPassword)) {
         return Utils::QueryError;
     }
 
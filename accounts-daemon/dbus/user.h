@@ -37,7 +37,7 @@ class User : public QDBusAbstractAdaptor {
         Q_SCRIPTABLE Q_PROPERTY(bool Verified READ verified NOTIFY VerifiedChanged);
 
     public:
-        explicit User(UserAccount* parent);
+        explicit User(UserAccount* parent, QString username, QString email, bool verified);
         ~User();
 
         quint64 id();
@@ -46,7 +46,8 @@ class User : public QDBusAbstractAdaptor {
         bool verified();
         QString locale();
 
-        Utils::DBusError setPassword(QString password);
+        QFuture<Utils::DBusError> setPassword(QString password);
+        Utils::DBusError setHashedPassword(QString hashedPassword);
 
     public slots:
         Q_SCRIPTABLE void SetUsername(QString username, const QDBusMessage& message);
@@ -19,13 +19,71 @@
  * *************************************/
 #include "useraccount.h"
 
+#include "configuration.h"
 #include "fido2.h"
 #include "passwordreset.h"
+#include "storage/storage.h"
 #include "twofactor.h"
 #include "user.h"
 #include "utils.h"
 #include <QCache>
-#include <QSqlQuery>
+#include <QDBusError>
+#include <QDBusPendingCallWatcher>
+#include <QDBusVirtualObject>
+
+namespace {
+    const QString accountPathPrefix = QStringLiteral("/com/vicr123/accounts/User");
+
+    // Longest a relayed call may take, which has to cover the FIDO helper
+    constexpr int relayTimeout = 120000;
+
+    // Stands in at the path of every evicted account. The first call to one of those paths loads the account again,
+    // which takes this off the path, and the call is then passed on to the new object over a second connection.
+    class EvictedAccounts : public QDBusVirtualObject {
+        public:
+            static EvictedAccounts* instance() {
+                static auto* instance = new EvictedAccounts();
+                return instance;
+            }
+
+            QString introspect(const QString& path) const override {
+                Q_UNUSED(path)
+                return {};
+            }
+
+            bool handleMessage(const QDBusMessage& message, const QDBusConnection& connection) override {
+                bool ok;
+                auto id = message.path().mid(accountPathPrefix.length()).toULongLong(&ok);
+                auto* account = ok ? UserAccount::accountForId(id) : nullptr;
+                if (!account) {
+                    // The account is gone, so nothing should answer at this path any more
+                    Utils::accountsBus().unregisterObject(message.path());
+                    connection.send(message.createErrorReply(QDBusError::UnknownObject, QStringLiteral("No such object path '%1'").arg(message.path())));
+                    return true;
+                }
+
+                auto call = QDBusMessage::createMethodCall(connection.baseService(), message.path(), message.interface(), message.member());
+                call.setArguments(message.arguments());
+                if (!message.isReplyRequired()) {
+                    call.setAutoStartService(false);
+                    Utils::accountsRelayBus().send(call);
+                    return true;
+                }
+
+                auto* watcher = new QDBusPendingCallWatcher(Utils::accountsRelayBus().asyncCall(call, relayTimeout), this);
+                connect(watcher, &QDBusPendingCallWatcher::finished, this, [message, connection](QDBusPendingCallWatcher* watcher) {
+                    watcher->deleteLater();
+                    auto reply = watcher->reply();
+                    if (reply.type() == QDBusMessage::ErrorMessage) {
+                        connection.send(message.createErrorReply(reply.errorName(), reply.errorMessage()));
+                    } else {
+                        connection.send(message.createReply(reply.arguments()));
+                    }
+                });
+                return true;
+            }
+    };
+} // namespace
 
 struct UserAccountPrivate {
         quint64 id;
@@ -34,21 +92,51 @@ struct UserAccountPrivate {
         TwoFactor* twoFactor;
         Fido2* fido2;
 
-        static QCache<quint64, UserAccount> cachedAccounts;
+        // An evicted account is taken off the bus and a stand-in takes its place, so a client holding on to its path
+        // gets the account loaded again transparently the next time it uses it
+        struct CachedAccount {
+                UserAccount* account;
+                qsizetype cost;
+
+                ~CachedAccount() {
+                    // Take the object off the bus straight away, but let any call that is still using it finish first
+                    auto path = account->path().path();
+                    Utils::accountsBus().unregisterObject(path);
+                    account->deleteLater();
+                    if (clearing) return;
+
+                    Utils::accountsBus().registerVirtualObject(path, EvictedAccounts::instance());
+                    evictions++;
+                }
+        };
+
+        static QCache<quint64, CachedAccount> cachedAccounts;
+        static quint64 hits;
+        static quint64 misses;
+        static quint64 evictions;
+        static bool clearing;
 };
 
-QCache<quint64, UserAccount> UserAccountPrivate::cachedAccounts = QCache<quint64, UserAccount>(100);
+QCache<quint64, UserAccountPrivate::CachedAccount> UserAccountPrivate::cachedAccounts;
+quint64 UserAccountPrivate::hits = 0;
+quint64 UserAccountPrivate::misses = 0;
+quint64 UserAccountPrivate::evictions = 0;
+bool UserAccountPrivate::clearing = false;
 
-UserAccount::UserAccount(quint64 id) :
+UserAccount::UserAccount(quint64 id, const StoredAccount& account) :
     QObject(nullptr) {
     d = new UserAccountPrivate();
     d->id = id;
 
-    d->user = new User(this);
-    d->twoFactor = new TwoFactor(this);
+    d->user = new User(this, account.user.username, account.user.email, account.user.verified);
+    d->twoFactor = new TwoFactor(this, account.otp.key, account.otp.enabled);
+
+    // These adaptors don't touch the database until one of their methods is called
     d->fido2 = new Fido2(this);
     new PasswordReset(this);
 
+    // Take over from the stand-in if this account has been evicted before
+    Utils::accountsBus().unregisterObject(this->path().path());
     Utils::accountsBus().registerObject(this->path().path(), this);
 }
 
@@ -57,19 +145,85 @@ UserAccount::~UserAccount() {
 }
 
 UserAccount* UserAccount::accountForId(quint64 id) {
-    if (UserAccountPrivate::cachedAccounts.contains(id)) return UserAccountPrivate::cachedAccounts.object(id);
-
-    // Ensure the account exists
-    QSqlQuery query;
-    query.prepare("SELECT COUNT(*) FROM users WHERE id=:id");
-    query.bindValue(":id", id);
-    query.exec();
-    query.next();
-    if (query.value(0) == 0) return nullptr;
-
-    auto* account = new UserAccount(id);
-    UserAccountPrivate::cachedAccounts.insert(id, account);
-    return account;
+    return accountsForIds({id}).first();
+}
+
+QList<UserAccount*> UserAccount::accountsForIds(const QList<quint64>& ids) {
+    auto configuration = Configuration::current();
+    if (UserAccountPrivate::cachedAccounts.maxCost() != configuration->userCacheMemory) {
+        // Also shrinks the cache back down after a batch that needed more room than this
+        UserAccountPrivate::cachedAccounts.setMaxCost(configuration->userCacheMemory);
+    }
+
+    QHash<quint64, UserAccount*> accounts;
+    QList<quint64> missingIds;
+    qsizetype batchCost = 0;
+    for (auto id : ids) {
+        if (accounts.contains(id)) continue;
+        if (auto* cached = UserAccountPrivate::cachedAccounts.object(id)) {
+            UserAccountPrivate::hits++;
+            accounts.insert(id, cached->account);
+            batchCost += cached->cost;
+        } else {
+            UserAccountPrivate::misses++;
+            accounts.insert(id, nullptr);
+            missingIds.append(id);
+        }
+    }
+
+    if (!missingIds.isEmpty()) {
+        // Load everything the accounts need up front in a single round trip
+        QList<StoredAccount> storedAccounts;
+        Storage::instance()->accounts(missingIds, &storedAccounts);
+
+        QList<UserAccountPrivate::CachedAccount*> loaded;
+        for (const auto& storedAccount : storedAccounts) {
+            auto* account = new UserAccount(storedAccount.user.id, storedAccount);
+            qsizetype cost = configuration->userCacheAccountCost + (account->user()->username().length() + account->user()->email().length()) * sizeof(QChar);
+            loaded.append(new UserAccountPrivate::CachedAccount{account, cost});
+            batchCost += cost;
+        }
+
+        // Evicting one of this call's own accounts would take its path off the bus before the reply goes out, so let
+        // the cache grow to hold the whole batch. The next lookup trims it back to the configured size.
+        if (batchCost > UserAccountPrivate::cachedAccounts.maxCost()) UserAccountPrivate::cachedAccounts.setMaxCost(batchCost);
+
+        // An account evicted here leaves its stand-in behind, which the next lookup for the same id replaces again
+        for (auto* cached : loaded) {
+            auto id = cached->account->id();
+            accounts.insert(id, cached->account);
+            UserAccountPrivate::cachedAccounts.insert(id, cached, cached->cost);
+        }
+    }
+
+    QList<UserAccount*> results;
+    results.reserve(ids.size());
+    for (auto id : ids) results.append(accounts.value(id));
+    return results;
+}
+
+UserAccount* UserAccount::cachedAccountForId(quint64 id) {
+    // Only returns accounts that are already loaded, so this never touches storage
+    auto* cached = UserAccountPrivate::cachedAccounts.object(id);
+    return cached ? cached->account : nullptr;
+}
+
+void UserAccount::clearCache() {
+    // The bus is gone by the time static objects are destroyed, so this must run while the application is still up
+    UserAccountPrivate::clearing = true;
+    UserAccountPrivate::cachedAccounts.clear();
+    UserAccountPrivate::clearing = false;
+}
+
+QVariantMap UserAccount::cacheStatistics() {
+    return {
+        {"size",      static_cast<qint64>(UserAccountPrivate::cachedAccounts.size())},
+        {"cost",      static_cast<qint64>(UserAccountPrivate::cachedAccounts.totalCost())},
+        {"maxCost",   static_cast<qint64>(UserAccountPrivate::cachedAccounts.maxCost())},
+        {"hits",      UserAccountPrivate::hits                                         },
+        {"misses",    UserAccountPrivate::misses                                       },
+        {"evictions", UserAccountPrivate::evictions                                    }
+    };
 }
 
 quint64 UserAccount::id() {
@@ -77,7 +231,7 @@ quint64 UserAccount::id() {
 }
 
 QDBusObjectPath UserAccount::path() {
-    return QDBusObjectPath(QStringLiteral("/com/vicr123/accounts/User%1").arg(d->id));
+    return QDBusObjectPath(accountPathPrefix + QString::number(d->id));
 }
 
 TwoFactor* UserAccount::twoFactor() {
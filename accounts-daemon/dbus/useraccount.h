@@ -23,6 +23,8 @@
 #include <QDBusObjectPath>
 #include <QObject>
 
+struct StoredAccount;
+
 class TwoFactor;
 class Fido2;
 class User;
@@ -33,6 +35,10 @@ class UserAccount : public QObject {
         ~UserAccount();
 
         static UserAccount* accountForId(quint64 id);
+        static QList<UserAccount*> accountsForIds(const QList<quint64>& ids);
+        static UserAccount* cachedAccountForId(quint64 id);
+        static void clearCache();
+        static QVariantMap cacheStatistics();
 
         quint64 id();
         QDBusObjectPath path();
@@ -46,7 +52,7 @@ class UserAccount : public QObject {
     private:
         UserAccountPrivate* d;
 
-        explicit UserAccount(quint64 id);
+        explicit UserAccount(quint64 id, const StoredAccount& account);
 };
 
 #endif // USERACCOUNT_H
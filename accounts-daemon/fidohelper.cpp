@@ -0,0 +1,140 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "fidohelper.h"
+
+#include "configuration.h"
+#include "logger.h"
+#include "metrics.h"
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonDocument>
+#include <QProcess>
+#include <QPromise>
+#include <QTimer>
+
+struct FidoHelperRequest {
+        quint64 id;
+        QStringList args;
+        QJsonObject payload;
+        QPromise<FidoHelper::Result> promise;
+        QElapsedTimer elapsed;
+        QTimer* timeout = nullptr;
+        QProcess* process = nullptr;
+};
+
+struct FidoHelperPrivate {
+        quint64 nextId = 1;
+        QHash<quint64, QSharedPointer<FidoHelperRequest>> pending;
+};
+
+FidoHelper::FidoHelper(QObject* parent) :
+    QObject(parent) {
+    d = new FidoHelperPrivate();
+}
+
+FidoHelper::~FidoHelper() {
+    delete d;
+}
+
+FidoHelper* FidoHelper::instance() {
+    static auto* instance = new FidoHelper();
+    return instance;
+}
+
+QVariantMap FidoHelper::statistics() const {
+    return {
+        {"pending", static_cast<qint64>(d->pending.size())}
+    };
+}
+
+QFuture<FidoHelper::Result> FidoHelper::run(QStringList args, QJsonObject payload) {
+    auto request = QSharedPointer<FidoHelperRequest>::create();
+    request->id = d->nextId++;
+    request->args = args;
+    request->payload = payload;
+    request->promise.start();
+    request->elapsed.start();
+    auto future = request->promise.future();
+
+    auto configuration = Configuration::current();
+    if (configuration->fidoExecutable.isEmpty()) {
+        finish(request, {Utils::FidoSupportUnavailable});
+        return future;
+    }
+
+    auto id = request->id;
+    request->timeout = new QTimer(this);
+    request->timeout->setSingleShot(true);
+    request->timeout->setInterval(configuration->fidoTimeout);
+    connect(request->timeout, &QTimer::timeout, this, [this, id] {
+        auto request = d->pending.take(id);
+        if (!request) return;
+
+        Logger::error() << "FIDO helper did not respond to request " << id << " in time\n";
+        finish(request, {Utils::InternalError});
+
+        if (request->process) request->process->kill();
+    });
+
+    d->pending.insert(id, request);
+    request->timeout->start();
+
+    runProcess(request);
+    return future;
+}
+
+void FidoHelper::runProcess(QSharedPointer<FidoHelperRequest> request) {
+    auto id = request->id;
+    auto* process = new QProcess(this);
+    request->process = process;
+
+    connect(process, &QProcess::finished, this, [this, id, process](int exitCode, QProcess::ExitStatus exitStatus) {
+        process->deleteLater();
+        auto request = d->pending.take(id);
+        if (!request) return;
+
+        if (exitStatus != QProcess::NormalExit) {
+            finish(request, {Utils::FidoSupportUnavailable});
+        } else if (exitCode != 0) {
+            finish(request, {Utils::InternalError});
+        } else {
+            finish(request, {Utils::NoError, process->readAllStandardOutput()});
+        }
+    });
+    connect(process, &QProcess::errorOccurred, this, [this, id, process](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart) return;
+
+        process->deleteLater();
+        auto request = d->pending.take(id);
+        if (!request) return;
+        finish(request, {Utils::FidoSupportUnavailable});
+    });
+
+    process->start(Utils::fidoHelperPath(), request->args);
+    process->write(QJsonDocument(request->payload).toJson());
+    process->closeWriteChannel();
+}
+
+void FidoHelper::finish(QSharedPointer<FidoHelperRequest> request, Result result) {
+    if (request->timeout) request->timeout->deleteLater();
+    Metrics::recordOperation("fido", request->elapsed.nsecsElapsed());
+    request->promise.addResult(result);
+    request->promise.finish();
+}
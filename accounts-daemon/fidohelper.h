@@ -0,0 +1,54 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef FIDOHELPER_H
+#define FIDOHELPER_H
+
+#include "utils.h"
+#include <QFuture>
+#include <QJsonObject>
+#include <QObject>
+
+struct FidoHelperRequest;
+struct FidoHelperPrivate;
+class FidoHelper : public QObject {
+        Q_OBJECT
+    public:
+        ~FidoHelper();
+
+        struct Result {
+                Utils::DBusError error = Utils::NoError;
+                QByteArray output;
+        };
+
+        static FidoHelper* instance();
+
+        QFuture<Result> run(QStringList args, QJsonObject payload);
+        QVariantMap statistics() const;
+
+    private:
+        FidoHelperPrivate* d;
+
+        explicit FidoHelper(QObject* parent = nullptr);
+
+        void runProcess(QSharedPointer<FidoHelperRequest> request);
+        void finish(QSharedPointer<FidoHelperRequest> request, Result result);
+};
+
+#endif // FIDOHELPER_H
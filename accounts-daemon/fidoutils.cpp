@@ -1,33 +1,26 @@
 #include "fidoutils.h"
 
+#include "storage/storage.h"
 #include <QList>
-#include <QSqlQuery>
 
 QStringList FidoUtils::FidoCredsForUser(quint64 userId) {
-    QSqlQuery query;
-    query.prepare("SELECT data FROM fido WHERE userid=:userid");
-    query.bindValue(":userid", userId);
-
-    query.exec();
+    QList<QByteArray> credentials;
+    Storage::instance()->fidoCredentials(userId, std::nullopt, &credentials);
 
     QStringList creds;
-    while (query.next()) {
-        creds.append(query.value("data").toByteArray().toBase64());
+    for (const auto& credential : credentials) {
+        creds.append(credential.toBase64());
     }
     return creds;
 }
 
 QStringList FidoUtils::FidoCredsForUser(quint64 userId, QString application) {
-    QSqlQuery query;
-    query.prepare("SELECT data FROM fido WHERE userid=:userid AND application=:application");
-    query.bindValue(":userid", userId);
-    query.bindValue(":application", application);
-
-    query.exec();
+    QList<QByteArray> credentials;
+    Storage::instance()->fidoCredentials(userId, application, &credentials);
 
     QStringList creds;
-    while (query.next()) {
-        creds.append(query.value("data").toByteArray().toBase64());
+    for (const auto& credential : credentials) {
+        creds.append(credential.toBase64());
     }
     return creds;
-}
\ No newline at end of file
+}
@@ -0,0 +1,261 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "jwt.h"
+
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    constexpr int blockSize = 128;
+    constexpr int digestSize = 64;
+
+    constexpr std::array<quint64, 8> sha512InitialState = {
+        0x6A09E667F3BCC908, 0xBB67AE8584CAA73B, 0x3C6EF372FE94F82B, 0xA54FF53A5F1D36F1,
+        0x510E527FADE682D1, 0x9B05688C2B3E6C1F, 0x1F83D9ABFB41BD6B, 0x5BE0CD19137E2179};
+
+    constexpr quint64 sha512RoundConstants[80] = {
+        0x428A2F98D728AE22, 0x7137449123EF65CD, 0xB5C0FBCFEC4D3B2F, 0xE9B5DBA58189DBBC, 0x3956C25BF348B538,
+        0x59F111F1B605D019, 0x923F82A4AF194F9B, 0xAB1C5ED5DA6D8118, 0xD807AA98A3030242, 0x12835B0145706FBE,
+        0x243185BE4EE4B28C, 0x550C7DC3D5FFB4E2, 0x72BE5D74F27B896F, 0x80DEB1FE3B1696B1, 0x9BDC06A725C71235,
+        0xC19BF174CF692694, 0xE49B69C19EF14AD2, 0xEFBE4786384F25E3, 0x0FC19DC68B8CD5B5, 0x240CA1CC77AC9C65,
+        0x2DE92C6F592B0275, 0x4A7484AA6EA6E483, 0x5CB0A9DCBD41FBD4, 0x76F988DA831153B5, 0x983E5152EE66DFAB,
+        0xA831C66D2DB43210, 0xB00327C898FB213F, 0xBF597FC7BEEF0EE4, 0xC6E00BF33DA88FC2, 0xD5A79147930AA725,
+        0x06CA6351E003826F, 0x142929670A0E6E70, 0x27B70A8546D22FFC, 0x2E1B21385C26C926, 0x4D2C6DFC5AC42AED,
+        0x53380D139D95B3DF, 0x650A73548BAF63DE, 0x766A0ABB3C77B2A8, 0x81C2C92E47EDAEE6, 0x92722C851482353B,
+        0xA2BFE8A14CF10364, 0xA81A664BBC423001, 0xC24B8B70D0F89791, 0xC76C51A30654BE30, 0xD192E819D6EF5218,
+        0xD69906245565A910, 0xF40E35855771202A, 0x106AA07032BBD1B8, 0x19A4C116B8D2D0C8, 0x1E376C085141AB53,
+        0x2748774CDF8EEB99, 0x34B0BCB5E19B48A8, 0x391C0CB3C5C95A63, 0x4ED8AA4AE3418ACB, 0x5B9CCA4F7763E373,
+        0x682E6FF3D6B2B8A3, 0x748F82EE5DEFB2FC, 0x78A5636F43172F60, 0x84C87814A1F0AB72, 0x8CC702081A6439EC,
+        0x90BEFFFA23631E28, 0xA4506CEBDE82BDE9, 0xBEF9A3F7B2C67915, 0xC67178F2E372532B, 0xCA273ECEEA26619C,
+        0xD186B8C721C0C207, 0xEADA7DD6CDE0EB1E, 0xF57D4F7FEE6ED178, 0x06F067AA72176FBA, 0x0A637DC5A2C898A6,
+        0x113F9804BEF90DAE, 0x1B710B35131C471B, 0x28DB77F523047D84, 0x32CAAB7B40C72493, 0x3C9EBE0A15C9BEBC,
+        0x431D67C49C100D4C, 0x4CC5D4BECB3E42B6, 0x597F299CFC657E2A, 0x5FCB6FAB3AD6FAEC, 0x6C44198C4A475817};
+
+    // {"alg":"HS512","typ":"JWT"}, the only header we issue or accept
+    constexpr char encodedHeader[] = "eyJhbGciOiJIUzUxMiIsInR5cCI6IkpXVCJ9";
+    constexpr qsizetype encodedHeaderLength = sizeof(encodedHeader) - 1;
+
+    inline quint64 rotateRight(quint64 value, int bits) {
+        return (value >> bits) | (value << (64 - bits));
+    }
+
+    // One round of the SHA-512 compression function
+    void sha512Block(std::array<quint64, 8>& state, const uchar* block) {
+        quint64 w[80];
+        for (int i = 0; i < 16; i++) w[i] = qFromBigEndian<quint64>(block + i * 8);
+        for (int i = 16; i < 80; i++) {
+            auto s0 = rotateRight(w[i - 15], 1) ^ rotateRight(w[i - 15], 8) ^ (w[i - 15] >> 7);
+            auto s1 = rotateRight(w[i - 2], 19) ^ rotateRight(w[i - 2], 61) ^ (w[i - 2] >> 6);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        auto [a, b, c, d, e, f, g, h] = state;
+        for (int i = 0; i < 80; i++) {
+            auto s1 = rotateRight(e, 14) ^ rotateRight(e, 18) ^ rotateRight(e, 41);
+            auto choose = (e & f) ^ (~e & g);
+            auto temp1 = h + s1 + choose + sha512RoundConstants[i] + w[i];
+            auto s0 = rotateRight(a, 28) ^ rotateRight(a, 34) ^ rotateRight(a, 39);
+            auto majority = (a & b) ^ (a & c) ^ (b & c);
+            auto temp2 = s0 + majority;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + temp1;
+            d = c;
+            c = b;
+            b = a;
+            a = temp1 + temp2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+    // Hashes a message following one block that has already been absorbed, such as an HMAC pad.
+    // Bytes are written straight into the block buffer so nothing is allocated.
+    class Sha512Stream {
+        public:
+            explicit Sha512Stream(const std::array<quint64, 8>& state) :
+                state(state) {}
+
+            void add(uchar byte) {
+                block[used++] = byte;
+                length++;
+                if (used == blockSize) {
+                    sha512Block(state, block);
+                    used = 0;
+                }
+            }
+
+            void add(const uchar* data, int size) {
+                for (int i = 0; i < size; i++) add(data[i]);
+            }
+
+            // Only takes the low byte of each character, so callers must check the text is ASCII first
+            void add(QStringView text) {
+                for (auto c : text) add(static_cast<uchar>(c.unicode()));
+            }
+
+            void finish(uchar* digest) {
+                auto bits = static_cast<quint64>(blockSize + length) * 8;
+                add(0x80);
+                while (used != blockSize - 16) add(0);
+                memset(block + used, 0, 8);
+                qToBigEndian<quint64>(bits, block + blockSize - 8);
+                sha512Block(state, block);
+
+                for (int i = 0; i < 8; i++) qToBigEndian<quint64>(state[i], digest + i * 8);
+            }
+
+        private:
+            std::array<quint64, 8> state;
+            uchar block[blockSize];
+            int used = 0;
+            quint64 length = 0;
+    };
+
+    bool isBase64UrlCharacter(char16_t character) {
+        return (character >= 'A' && character <= 'Z') || (character >= 'a' && character <= 'z') || (character >= '0' && character <= '9') || character == '-' || character == '_';
+    }
+
+    // Decodes unpadded base64url into a fixed size buffer; returns false unless it is exactly that size
+    bool decodeBase64Url(QStringView text, uchar* output, int size) {
+        if (text.length() != (size * 4 + 2) / 3) return false;
+
+        quint32 buffer = 0;
+        int bits = 0;
+        int written = 0;
+        for (auto c : text) {
+            auto character = c.unicode();
+            int value;
+            if (character >= 'A' && character <= 'Z') {
+                value = character - 'A';
+            } else if (character >= 'a' && character <= 'z') {
+                value = character - 'a' + 26;
+            } else if (character >= '0' && character <= '9') {
+                value = character - '0' + 52;
+            } else if (character == '-') {
+                value = 62;
+            } else if (character == '_') {
+                value = 63;
+            } else {
+                return false;
+            }
+
+            buffer = (buffer << 6) | value;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                output[written++] = (buffer >> bits) & 0xFF;
+            }
+        }
+        return written == size;
+    }
+} // namespace
+
+Jwt::Jwt(const QByteArray& secret) {
+    auto key = secret.size() > blockSize ? QCryptographicHash::hash(secret, QCryptographicHash::Sha512) : secret;
+
+    uchar innerPad[blockSize];
+    uchar outerPad[blockSize];
+    for (int i = 0; i < blockSize; i++) {
+        uchar keyByte = i < key.size() ? static_cast<uchar>(key.at(i)) : 0;
+        innerPad[i] = keyByte ^ 0x36;
+        outerPad[i] = keyByte ^ 0x5C;
+    }
+
+    innerState = sha512InitialState;
+    sha512Block(innerState, innerPad);
+    outerState = sha512InitialState;
+    sha512Block(outerState, outerPad);
+    valid = true;
+}
+
+bool Jwt::isJwt(const QString& token) {
+    return token.contains('.');
+}
+
+QString Jwt::sign(const QJsonObject& claims) const {
+    auto signingInput = QStringLiteral("%1.%2").arg(QLatin1String(encodedHeader), QString::fromLatin1(QJsonDocument(claims).toJson(QJsonDocument::Compact).toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals)));
+
+    uchar hmac[digestSize];
+    signature(signingInput, hmac);
+    return QStringLiteral("%1.%2").arg(signingInput, QString::fromLatin1(QByteArray::fromRawData(reinterpret_cast<const char*>(hmac), digestSize).toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals)));
+}
+
+bool Jwt::verify(const QString& token, QJsonObject* claims) const {
+    if (!valid) return false;
+
+    // header.payload.signature, where the header can only be the one we issue
+    auto payloadStart = token.indexOf('.');
+    auto signatureStart = token.lastIndexOf('.');
+    if (payloadStart != encodedHeaderLength || signatureStart == payloadStart) return false;
+    if (QStringView(token).first(encodedHeaderLength) != QLatin1String(encodedHeader)) return false;
+
+    // Anything outside the base64url alphabet would be hashed by its low byte alone and then
+    // skipped by the decoder, so a token carrying it could be made to match a different payload
+    auto encodedPayload = QStringView(token).sliced(payloadStart + 1, signatureStart - payloadStart - 1);
+    if (!std::all_of(encodedPayload.begin(), encodedPayload.end(), [](QChar c) {
+            return isBase64UrlCharacter(c.unicode());
+        })) return false;
+
+    uchar expected[digestSize];
+    if (!decodeBase64Url(QStringView(token).sliced(signatureStart + 1), expected, digestSize)) return false;
+
+    uchar hmac[digestSize];
+    signature(QStringView(token).first(signatureStart), hmac);
+
+    // Compare in constant time so the signature can't be worked out one byte at a time
+    uchar difference = 0;
+    for (int i = 0; i < digestSize; i++) difference |= hmac[i] ^ expected[i];
+    if (difference != 0) return false;
+
+    // Only a token we signed ever gets decoded and parsed
+    auto payload = QByteArray::fromBase64Encoding(encodedPayload.toLatin1(), QByteArray::Base64UrlEncoding | QByteArray::AbortOnBase64DecodingErrors);
+    if (!payload) return false;
+
+    auto document = QJsonDocument::fromJson(*payload);
+    if (!document.isObject()) return false;
+
+    *claims = document.object();
+    return true;
+}
+
+void Jwt::signature(QStringView signingInput, uchar* hmac) const {
+    Sha512Stream inner(innerState);
+    inner.add(signingInput);
+
+    uchar innerDigest[digestSize];
+    inner.finish(innerDigest);
+
+    Sha512Stream outer(outerState);
+    outer.add(innerDigest, digestSize);
+    outer.finish(hmac);
+}
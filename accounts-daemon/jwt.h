@@ -0,0 +1,50 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef JWT_H
+#define JWT_H
+
+#include <QJsonObject>
+#include <QString>
+#include <array>
+
+// HS512 JSON Web Tokens signed with one secret. The HMAC pads are hashed when the object is made,
+// and a token's signature is checked straight from the string before anything is decoded or parsed.
+class Jwt {
+    public:
+        Jwt() = default;
+        explicit Jwt(const QByteArray& secret);
+
+        // Login tokens are standard base64, which never contains a '.', so this is all it takes to tell them apart
+        static bool isJwt(const QString& token);
+
+        QString sign(const QJsonObject& claims) const;
+        bool verify(const QString& token, QJsonObject* claims) const;
+
+    private:
+        using State = std::array<quint64, 8>;
+
+        bool valid = false;
+        State innerState = {};
+        State outerState = {};
+
+        void signature(QStringView signingInput, uchar* hmac) const;
+};
+
+#endif // JWT_H
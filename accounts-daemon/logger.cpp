@@ -19,22 +19,314 @@
  * *************************************/
 #include "logger.h"
 
+#include "configuration.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSemaphore>
+#include <QThread>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <unistd.h>
+
+namespace {
+    struct LogRecord {
+            static constexpr int maxLength = 480;
+
+            qint64 timestamp;
+            Logger::Level level;
+            const char* file;
+            int line;
+            int length;
+            char text[maxLength];
+    };
+
+    // A bounded multi-producer queue (after Dmitry Vyukov's design). Each slot carries a sequence
+    // number that says whether it is free for the producer at a position or ready for the consumer.
+    class LogBuffer {
+        public:
+            static constexpr quint64 capacity = 4096;
+
+            LogBuffer() :
+                entries(new Slot[capacity]) {
+                for (quint64 i = 0; i < capacity; i++) entries[i].sequence.storeRelaxed(i);
+            }
+
+            template<typename Fill> bool push(Fill fill) {
+                auto position = enqueuePosition.loadRelaxed();
+                forever {
+                    auto& slot = entries[position % capacity];
+                    auto difference = static_cast<qint64>(slot.sequence.loadAcquire() - position);
+                    if (difference == 0) {
+                        if (enqueuePosition.testAndSetRelaxed(position, position + 1, position)) {
+                            fill(slot.record);
+                            slot.sequence.storeRelease(position + 1);
+                            return true;
+                        }
+                    } else if (difference < 0) {
+                        return false;
+                    } else {
+                        position = enqueuePosition.loadRelaxed();
+                    }
+                }
+            }
+
+            // Only the writer thread calls this
+            bool pop(LogRecord* record) {
+                auto& slot = entries[dequeuePosition % capacity];
+                if (slot.sequence.loadAcquire() != dequeuePosition + 1) return false;
+
+                *record = slot.record;
+                slot.sequence.storeRelease(dequeuePosition + capacity);
+                dequeuePosition++;
+                return true;
+            }
+
+        private:
+            struct Slot {
+                    QAtomicInteger<quint64> sequence;
+                    LogRecord record;
+            };
+
+            std::unique_ptr<Slot[]> entries;
+            QAtomicInteger<quint64> enqueuePosition = 0;
+            quint64 dequeuePosition = 0;
+    };
+
+    // Allows a burst of messages from one place in the code every second and counts the rest
+    struct RateLimitBucket {
+            QAtomicInteger<qint64> window = 0;
+            QAtomicInt count = 0;
+            QAtomicInt suppressed = 0;
+    };
+
+    const char* levelName(Logger::Level level) {
+        switch (level) {
+            case Logger::Level::Debug:
+                return "debug";
+            case Logger::Level::Info:
+                return "info";
+            case Logger::Level::Warning:
+                return "warning";
+            case Logger::Level::Error:
+                return "error";
+        }
+        return "info";
+    }
+} // namespace
+
+struct LoggerPrivate {
+        static LoggerPrivate* instance();
+
+        static constexpr int rateLimitBuckets = 256;
+
+        LogBuffer buffer;
+        std::array<RateLimitBucket, rateLimitBuckets> rateLimits;
+        QSemaphore pending;
+        QThread* writer = nullptr;
+        QAtomicInt stopping = false;
+
+        QAtomicInt level = static_cast<int>(Logger::Level::Info);
+        QAtomicInt json = false;
+        QAtomicInt rateLimit = 20;
+
+        QAtomicInteger<quint64> written = 0;
+        QAtomicInteger<quint64> dropped = 0;
+        QAtomicInteger<quint64> suppressed = 0;
+        quint64 droppedReported = 0;
+
+        void enqueue(Logger::Level level, Logger::Location location, QString message);
+        void writeRecords();
+        QByteArray format(const LogRecord& record) const;
+};
+
+LoggerPrivate* LoggerPrivate::instance() {
+    static auto* instance = [] {
+        auto* instance = new LoggerPrivate();
+        instance->writer = QThread::create([instance] {
+            while (!instance->stopping.loadRelaxed()) {
+                // One wake up drains everything, so forget the other releases that piled up meanwhile
+                if (instance->pending.tryAcquire(1, 100)) instance->pending.tryAcquire(instance->pending.available());
+                instance->writeRecords();
+            }
+            instance->writeRecords();
+        });
+        instance->writer->setObjectName(QStringLiteral("LogWriter"));
+        instance->writer->start(QThread::LowPriority);
+
+        // Write out whatever is still queued before the process exits
+        qAddPostRoutine([] {
+            auto* instance = LoggerPrivate::instance();
+            instance->stopping.storeRelaxed(true);
+            instance->pending.release();
+            instance->writer->wait();
+        });
+        return instance;
+    }();
+    return instance;
+}
+
+void LoggerPrivate::enqueue(Logger::Level level, Logger::Location location, QString message) {
+    auto siteHash = qHashMulti(0, location.file, location.line);
+    auto& bucket = rateLimits[siteHash % rateLimitBuckets];
+    auto now = QDateTime::currentSecsSinceEpoch();
+    auto window = bucket.window.loadRelaxed();
+    if (window != now && bucket.window.testAndSetRelaxed(window, now)) {
+        bucket.count.storeRelaxed(0);
+        if (auto suppressedHere = bucket.suppressed.fetchAndStoreRelaxed(0)) {
+            message.append(QStringLiteral(" (%1 similar messages were suppressed)").arg(suppressedHere));
+        }
+    }
+    if (bucket.count.fetchAndAddRelaxed(1) >= rateLimit.loadRelaxed()) {
+        bucket.suppressed.fetchAndAddRelaxed(1);
+        suppressed.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    auto utf8 = message.toUtf8();
+    auto length = qMin(utf8.size(), qsizetype(LogRecord::maxLength));
+
+    // Don't cut a multi-byte character in half
+    while (length < utf8.size() && length > 0 && (utf8.at(length) & 0xC0) == 0x80) length--;
+
+    auto timestamp = QDateTime::currentMSecsSinceEpoch();
+    auto pushed = buffer.push([&](LogRecord& record) {
+        record.timestamp = timestamp;
+        record.level = level;
+        record.file = location.file;
+        record.line = location.line;
+        record.length = static_cast<int>(length);
+        memcpy(record.text, utf8.constData(), length);
+    });
+
+    if (pushed) {
+        pending.release();
+    } else {
+        dropped.fetchAndAddRelaxed(1);
+    }
+}
+
+void LoggerPrivate::writeRecords() {
+    QByteArray output;
+    LogRecord record;
+    while (buffer.pop(&record)) {
+        output.append(format(record));
+        written.fetchAndAddRelaxed(1);
+    }
+
+    auto droppedNow = dropped.loadRelaxed();
+    if (droppedNow != droppedReported) {
+        LogRecord dropRecord{QDateTime::currentMSecsSinceEpoch(), Logger::Level::Warning, __FILE__, __LINE__, 0, {}};
+        auto text = QStringLiteral("%1 log messages were dropped because the log buffer was full").arg(droppedNow - droppedReported).toUtf8();
+        dropRecord.length = static_cast<int>(text.size());
+        memcpy(dropRecord.text, text.constData(), text.size());
+        output.append(format(dropRecord));
+        droppedReported = droppedNow;
+    }
+
+    auto* data = output.constData();
+    auto remaining = output.size();
+    while (remaining > 0) {
+        auto count = ::write(STDERR_FILENO, data, remaining);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        data += count;
+        remaining -= count;
+    }
+}
+
+QByteArray LoggerPrivate::format(const LogRecord& record) const {
+    auto message = QString::fromUtf8(record.text, record.length).trimmed();
+    auto timestamp = QDateTime::fromMSecsSinceEpoch(record.timestamp, Qt::UTC).toString(Qt::ISODateWithMs);
+
+    if (json.loadRelaxed()) {
+        QJsonObject object = {
+            {"time",    timestamp                     },
+            {"level",   levelName(record.level)       },
+            {"message", message                       },
+            {"file",    QString::fromUtf8(record.file)},
+            {"line",    record.line                   }
+        };
+        return QJsonDocument(object).toJson(QJsonDocument::Compact) + "\n";
+    }
+
+    return QStringLiteral("%1 %2 %3\n").arg(timestamp, QString::fromLatin1(levelName(record.level)).toUpper(), message).toUtf8();
+}
+
 Logger::Logger(QObject* parent) : QObject(parent) {
 
 }
 
+Logger::Stream::Stream(Level level, Location location) :
+    level(level), location(location) {
+    enabled = static_cast<int>(level) >= LoggerPrivate::instance()->level.loadRelaxed();
+}
+
+Logger::Stream::~Stream() {
+    if (!enabled) return;
+    stream.flush();
+    LoggerPrivate::instance()->enqueue(level, location, message);
+}
+
 void Logger::log(QString message) {
     log() << message;
 }
 
-QTextStream Logger::log() {
-    return QTextStream(stderr);
+Logger::Stream Logger::log(Location location) {
+    return Stream(Level::Info, location);
+}
+
+Logger::Stream Logger::debug(Location location) {
+    return Stream(Level::Debug, location);
+}
+
+Logger::Stream Logger::warning(Location location) {
+    return Stream(Level::Warning, location);
 }
 
 void Logger::error(QString message) {
     error() << message;
 }
 
-QTextStream Logger::error() {
-    return log();
+Logger::Stream Logger::error(Location location) {
+    return Stream(Level::Error, location);
+}
+
+void Logger::applyConfiguration() {
+    // The logger can't read the configuration itself because loading the configuration logs
+    static const bool connected = [] {
+        QObject::connect(Configuration::instance(), &Configuration::reloaded, [] {
+            Logger::applyConfiguration();
+        });
+        return true;
+    }();
+    Q_UNUSED(connected)
+
+    auto configuration = Configuration::current();
+    auto level = QMap<QString, Level>({
+                                          {"debug",   Level::Debug  },
+                                          {"info",    Level::Info   },
+                                          {"warning", Level::Warning},
+                                          {"error",   Level::Error  }
+    })
+                     .value(configuration->logLevel.toLower(), Level::Info);
+
+    auto* d = LoggerPrivate::instance();
+    d->level.storeRelaxed(static_cast<int>(level));
+    d->json.storeRelaxed(configuration->logFormat.toLower() == "json");
+    d->rateLimit.storeRelaxed(qMax(1, configuration->logRateLimit));
+}
+
+QVariantMap Logger::statistics() {
+    auto* d = LoggerPrivate::instance();
+    return {
+        {"written",    d->written.loadRelaxed()   },
+        {"dropped",    d->dropped.loadRelaxed()   },
+        {"suppressed", d->suppressed.loadRelaxed()}
+    };
 }
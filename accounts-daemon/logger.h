@@ -28,11 +28,53 @@ class Logger : public QObject {
     public:
         explicit Logger(QObject* parent = nullptr);
 
+        enum class Level {
+            Debug,
+            Info,
+            Warning,
+            Error
+        };
+
+        // Where a message was logged from; repeated messages are rate limited per location
+        struct Location {
+                static Location current(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+                    return {file, line};
+                }
+
+                const char* file;
+                int line;
+        };
+
+        // Collects one message and queues it when it goes out of scope
+        class Stream {
+            public:
+                Stream(Level level, Location location);
+                ~Stream();
+
+                template<typename T> Stream& operator<<(const T& value) {
+                    if (enabled) stream << value;
+                    return *this;
+                }
+
+            private:
+                Level level;
+                Location location;
+                bool enabled;
+                QString message;
+                QTextStream stream{&message};
+        };
+
         static void log(QString message);
-        static QTextStream log();
+        static Stream log(Location location = Location::current());
+
+        static Stream debug(Location location = Location::current());
+        static Stream warning(Location location = Location::current());
 
         static void error(QString message);
-        static QTextStream error();
+        static Stream error(Location location = Location::current());
+
+        static void applyConfiguration();
+        static QVariantMap statistics();
 
     signals:
 
@@ -0,0 +1,265 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "mailqueue.h"
+
+#include "configuration.h"
+#include "logger.h"
+#include "metrics.h"
+#include <QDateTime>
+#include <QDeadlineTimer>
+#include <QException>
+#include <QMutex>
+#include <QPromise>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+
+#include <src/SmtpMime>
+
+struct MailJob {
+        MimeMessage* message;
+        QPromise<void> promise;
+        int attempts = 0;
+        qint64 notBefore = 0;
+};
+
+struct MailQueuePrivate {
+        mutable QMutex mutex;
+        QWaitCondition condition;
+        std::deque<QSharedPointer<MailJob>> queue;
+        QList<QThread*> workers;
+        bool stopping = false;
+
+        quint64 enqueued = 0;
+        quint64 sent = 0;
+        quint64 failed = 0;
+        quint64 retried = 0;
+        quint64 connectionsOpened = 0;
+        int inFlight = 0;
+        int openConnections = 0;
+};
+
+MailQueue::MailQueue(QObject* parent) :
+    QObject(parent) {
+    d = new MailQueuePrivate();
+
+    auto connections = qMax(1, Configuration::current()->mailConnections);
+    for (auto i = 0; i < connections; i++) {
+        auto* worker = QThread::create([this] {
+            runWorker();
+        });
+        worker->setObjectName(QStringLiteral("MailWorker%1").arg(i));
+        worker->start();
+        d->workers.append(worker);
+    }
+}
+
+MailQueue::~MailQueue() {
+    {
+        QMutexLocker locker(&d->mutex);
+        d->stopping = true;
+        d->condition.wakeAll();
+    }
+
+    for (auto* worker : d->workers) {
+        worker->wait();
+        delete worker;
+    }
+    delete d;
+}
+
+MailQueue* MailQueue::instance() {
+    static auto* instance = new MailQueue();
+    return instance;
+}
+
+QFuture<void> MailQueue::enqueue(MimeMessage* message) {
+    auto job = QSharedPointer<MailJob>::create();
+    job->message = message;
+    job->promise.start();
+    auto future = job->promise.future();
+
+    QMutexLocker locker(&d->mutex);
+    d->queue.push_back(job);
+    d->enqueued++;
+    d->condition.wakeOne();
+    return future;
+}
+
+QVariantMap MailQueue::statistics() const {
+    QMutexLocker locker(&d->mutex);
+    return {
+        {"queueDepth",        static_cast<qint64>(d->queue.size())},
+        {"inFlight",          d->inFlight                         },
+        {"openConnections",   d->openConnections                  },
+        {"connectionsOpened", d->connectionsOpened                },
+        {"enqueued",          d->enqueued                         },
+        {"sent",              d->sent                             },
+        {"retried",           d->retried                          },
+        {"failed",            d->failed                           }
+    };
+}
+
+QSharedPointer<MailJob> MailQueue::takeJob(int idleTimeout, bool* idle) {
+    QMutexLocker locker(&d->mutex);
+    QDeadlineTimer idleDeadline = idleTimeout < 0 ? QDeadlineTimer(QDeadlineTimer::Forever) : QDeadlineTimer(idleTimeout);
+    forever {
+        if (d->stopping) return {};
+
+        // Take the oldest message that isn't waiting out a retry delay
+        auto now = QDateTime::currentMSecsSinceEpoch();
+        qint64 nextRetry = -1;
+        for (auto job = d->queue.begin(); job != d->queue.end(); job++) {
+            if ((*job)->notBefore <= now) {
+                auto nextJob = *job;
+                d->queue.erase(job);
+                d->inFlight++;
+                return nextJob;
+            }
+            if (nextRetry == -1 || (*job)->notBefore < nextRetry) nextRetry = (*job)->notBefore;
+        }
+
+        if (idleDeadline.hasExpired()) {
+            *idle = true;
+            return {};
+        }
+
+        auto wakeAt = idleDeadline;
+        if (nextRetry != -1) wakeAt = qMin(wakeAt, QDeadlineTimer(nextRetry - now));
+        d->condition.wait(&d->mutex, wakeAt);
+    }
+}
+
+void MailQueue::runWorker() {
+    SmtpClient* client = nullptr;
+    QSharedPointer<const ConfigurationSnapshot> clientConfiguration;
+    int sessionMessages = 0;
+
+    auto disconnect = [&](bool graceful) {
+        if (!client) return;
+        if (graceful) client->quit();
+        delete client;
+        client = nullptr;
+
+        QMutexLocker locker(&d->mutex);
+        d->openConnections--;
+    };
+
+    forever {
+        bool idle = false;
+        auto job = takeJob(client ? clientConfiguration->mailIdleTimeout : -1, &idle);
+        if (!job) {
+            if (idle) {
+                // Don't hold on to a connection the server is going to drop anyway
+                disconnect(true);
+                continue;
+            }
+            break;
+        }
+
+        // Start a fresh session when the SMTP settings change or this one has sent enough mail
+        auto configuration = Configuration::current();
+        if (client && (clientConfiguration != configuration || sessionMessages >= configuration->mailMessagesPerSession)) {
+            disconnect(true);
+        }
+
+        if (!client) {
+            SmtpClient::ConnectionType securityType;
+            if (configuration->smtpSecurity == "STARTTLS") {
+                securityType = SmtpClient::TlsConnection;
+            } else if (configuration->smtpSecurity == "true") {
+                securityType = SmtpClient::SslConnection;
+            } else {
+                securityType = SmtpClient::TcpConnection;
+            }
+
+            client = new SmtpClient(configuration->smtpHost, configuration->smtpPort, securityType);
+            clientConfiguration = configuration;
+            sessionMessages = 0;
+            {
+                QMutexLocker locker(&d->mutex);
+                d->openConnections++;
+                d->connectionsOpened++;
+            }
+
+            client->connectToHost();
+            if (!client->waitForReadyConnected()) {
+                Logger::error() << "Could not connect to SMTP server\n";
+                disconnect(false);
+            } else {
+                client->login(configuration->smtpUsername, configuration->smtpPassword, SmtpClient::AuthLogin);
+                if (!client->waitForAuthenticated()) {
+                    Logger::error() << "Could not log in to SMTP server\n";
+                    disconnect(false);
+                }
+            }
+        }
+
+        bool sent = false;
+        if (client) {
+            Metrics::Timer timer("smtp");
+            client->sendMail(*job->message);
+            sent = client->waitForMailSent();
+            if (sent) {
+                sessionMessages++;
+            } else {
+                // The session is in an unknown state now, so start again with a new one
+                Logger::error() << "Could not send email\n";
+                disconnect(false);
+            }
+        }
+
+        QMutexLocker locker(&d->mutex);
+        d->inFlight--;
+        if (sent) {
+            d->sent++;
+            locker.unlock();
+
+            job->message->deleteLater();
+            job->promise.finish();
+        } else {
+            locker.unlock();
+            retryOrFail(job);
+        }
+    }
+
+    disconnect(true);
+}
+
+void MailQueue::retryOrFail(QSharedPointer<MailJob> job) {
+    job->attempts++;
+
+    QMutexLocker locker(&d->mutex);
+    if (job->attempts > Configuration::current()->mailRetries) {
+        d->failed++;
+        locker.unlock();
+
+        job->message->deleteLater();
+        job->promise.setException(QException());
+        job->promise.finish();
+        return;
+    }
+
+    // Back off exponentially so a struggling SMTP server isn't hammered
+    job->notBefore = QDateTime::currentMSecsSinceEpoch() + qMin(1000 << (job->attempts - 1), 60000);
+    d->retried++;
+    d->queue.push_back(job);
+    d->condition.wakeOne();
+}
@@ -19,20 +19,188 @@
  * *************************************/
 #include "mailtemplate.h"
 
-#include "utils.h"
+#include "configuration.h"
 
 #include <QDir>
+#include <QFile>
+#include <QFileSystemWatcher>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QMap>
-#include <QSettings>
+#include <QMutex>
 
 #include <src/SmtpMime>
 
+namespace {
+    struct TemplateSegment {
+            bool placeholder;
+            QString text; // Literal text, or the replacement key for placeholders
+    };
+
+    struct CompiledPart {
+            QList<TemplateSegment> segments;
+            qsizetype literalLength = 0;
+
+            static CompiledPart compile(const QString& source) {
+                CompiledPart part;
+                qsizetype literalStart = 0;
+                qsizetype i = 0;
+                while (i < source.length()) {
+                    if (source.at(i) != '{') {
+                        i++;
+                        continue;
+                    }
+
+                    // Only {key} with no whitespace or nested braces is a placeholder so CSS in HTML parts survives
+                    auto end = i + 1;
+                    while (end < source.length() && source.at(end) != '}' && source.at(end) != '{' && !source.at(end).isSpace()) end++;
+                    if (end >= source.length() || source.at(end) != '}' || end == i + 1) {
+                        i++;
+                        continue;
+                    }
+
+                    if (i > literalStart) part.appendLiteral(source.mid(literalStart, i - literalStart));
+                    part.segments.append({true, source.mid(i + 1, end - i - 1)});
+                    i = end + 1;
+                    literalStart = i;
+                }
+                if (literalStart < source.length()) part.appendLiteral(source.mid(literalStart));
+                return part;
+            }
+
+            QString render(const QMap<QString, QString>& replacements) const {
+                // Work out the final length first so the output is only allocated once
+                auto length = literalLength;
+                for (const auto& segment : segments) {
+                    if (!segment.placeholder) continue;
+                    auto replacement = replacements.constFind(segment.text);
+                    length += replacement == replacements.constEnd() ? segment.text.length() + 2 : replacement->length();
+                }
+
+                QString output;
+                output.reserve(length);
+                for (const auto& segment : segments) {
+                    if (!segment.placeholder) {
+                        output.append(segment.text);
+                        continue;
+                    }
+
+                    auto replacement = replacements.constFind(segment.text);
+                    if (replacement == replacements.constEnd()) {
+                        output.append('{').append(segment.text).append('}');
+                    } else {
+                        output.append(*replacement);
+                    }
+                }
+                return output;
+            }
+
+        private:
+            void appendLiteral(const QString& literal) {
+                segments.append({false, literal});
+                literalLength += literal.length();
+            }
+    };
+
+    struct CompiledTemplate {
+            QString subject;
+            CompiledPart text;
+            CompiledPart html;
+    };
+
+    class MailTemplateCache {
+        public:
+            static MailTemplateCache* instance() {
+                static auto* instance = new MailTemplateCache();
+                return instance;
+            }
+
+            QSharedPointer<const CompiledTemplate> get(const QString& templateName, const QString& locale) {
+                auto key = QStringLiteral("%1/%2").arg(locale, templateName);
+
+                QMutexLocker locker(&mutex);
+                if (auto compiled = templates.value(key)) return compiled;
+                locker.unlock();
+
+                QStringList watchPaths;
+                auto compiled = compile(key, &watchPaths);
+
+                // Watch the template directory too, since editors often replace files rather than writing to them
+                QMetaObject::invokeMethod(&watcher, [this, watchPaths] {
+                    watcher.addPaths(watchPaths);
+                });
+
+                if (!compiled) return QSharedPointer<const CompiledTemplate>::create();
+
+                locker.relock();
+                templates.insert(key, compiled);
+                return compiled;
+            }
+
+        private:
+            QMutex mutex;
+            QHash<QString, QSharedPointer<const CompiledTemplate>> templates;
+            QFileSystemWatcher watcher;
+
+            MailTemplateCache() {
+                QObject::connect(&watcher, &QFileSystemWatcher::fileChanged, &watcher, [this] {
+                    clear();
+                });
+                QObject::connect(&watcher, &QFileSystemWatcher::directoryChanged, &watcher, [this] {
+                    clear();
+                });
+                QObject::connect(Configuration::instance(), &Configuration::reloaded, &watcher, [this] {
+                    clear();
+                });
+            }
+
+            void clear() {
+                QMutexLocker locker(&mutex);
+                templates.clear();
+                locker.unlock();
+
+                // Replaced files drop out of the watcher, so start afresh and pick them up on the next load
+                if (!watcher.files().isEmpty()) watcher.removePaths(watcher.files());
+                if (!watcher.directories().isEmpty()) watcher.removePaths(watcher.directories());
+            }
+
+            static QSharedPointer<const CompiledTemplate> compile(const QString& key, QStringList* watchPaths) {
+                QDir maildir(Configuration::current()->mailDir);
+                QDir templatePath(maildir.absoluteFilePath(key));
+                watchPaths->append(templatePath.absolutePath());
+
+                QFile mailMeta = templatePath.absoluteFilePath("meta.json");
+                if (!mailMeta.open(QFile::ReadOnly)) {
+                    //TODO: Figure out what to do if the email can't be opened
+                    return {};
+                }
+                watchPaths->append(mailMeta.fileName());
+
+                auto metadata = QJsonDocument::fromJson(mailMeta.readAll()).object();
+                mailMeta.close();
+
+                auto compiled = QSharedPointer<CompiledTemplate>::create();
+                compiled->subject = metadata.value("subject").toString();
+
+                QFile textPart = templatePath.absoluteFilePath(metadata.value("text").toString());
+                textPart.open(QFile::ReadOnly);
+                compiled->text = CompiledPart::compile(QString(textPart.readAll()).trimmed());
+                textPart.close();
+                watchPaths->append(textPart.fileName());
+
+                QFile htmlPart = templatePath.absoluteFilePath(metadata.value("html").toString());
+                htmlPart.open(QFile::ReadOnly);
+                compiled->html = CompiledPart::compile(QString(htmlPart.readAll()).trimmed());
+                htmlPart.close();
+                watchPaths->append(htmlPart.fileName());
+
+                return compiled;
+            }
+    };
+} // namespace
+
 struct MailTemplatePrivate {
-        QJsonObject metadata;
-        QString textContent;
-        QString htmlContent;
+        QSharedPointer<const CompiledTemplate> compiled;
         QMap<QString, QString> replacements;
 };
 
@@ -40,30 +208,7 @@ MailTemplate::MailTemplate(QString templateName, QString locale, QMap<QString, Q
     QObject(parent) {
     d = new MailTemplatePrivate();
     d->replacements = replacements;
-
-    QSettings settings(Utils::settingsFile(), QSettings::IniFormat);
-    QDir maildir(qEnvironmentVariable("MAIL_MAILDIR", settings.value("mail/maildir").toString()));
-
-    QDir templatePath(maildir.absoluteFilePath(QStringLiteral("%1/%2").arg(locale, templateName)));
-
-    QFile mailMeta = templatePath.absoluteFilePath("meta.json");
-    if (!mailMeta.open(QFile::ReadOnly)) {
-        //TODO: Figure out what to do if the email can't be opened
-        return;
-    }
-
-    d->metadata = QJsonDocument::fromJson(mailMeta.readAll()).object();
-    mailMeta.close();
-
-    QFile textPart = templatePath.absoluteFilePath(d->metadata.value("text").toString());
-    textPart.open(QFile::ReadOnly);
-    d->textContent = performReplacements(QString(textPart.readAll()).trimmed());
-    textPart.close();
-
-    QFile htmlPart = templatePath.absoluteFilePath(d->metadata.value("html").toString());
-    htmlPart.open(QFile::ReadOnly);
-    d->htmlContent = performReplacements(QString(htmlPart.readAll()).trimmed());
-    htmlPart.close();
+    d->compiled = MailTemplateCache::instance()->get(templateName, locale);
 }
 
 MailTemplate::~MailTemplate() {
@@ -71,24 +216,17 @@ MailTemplate::~MailTemplate() {
 }
 
 QString MailTemplate::subject() {
-    return d->metadata.value("subject").toString();
+    return d->compiled->subject;
 }
 
 MimePart* MailTemplate::textPart() {
     MimeText* textPart = new MimeText();
-    textPart->setText(d->textContent.toUtf8());
+    textPart->setText(d->compiled->text.render(d->replacements).toUtf8());
     return textPart;
 }
 
 MimePart* MailTemplate::htmlPart() {
     MimeHtml* htmlPart = new MimeHtml();
-    htmlPart->setHtml(d->htmlContent.toUtf8());
+    htmlPart->setHtml(d->compiled->html.render(d->replacements).toUtf8());
     return htmlPart;
 }
-
-QString MailTemplate::performReplacements(QString sourceString) {
-    for (QString replacement : d->replacements.keys()) {
-        sourceString.replace(QStringLiteral("{%1}").arg(replacement), d->replacements.value(replacement));
-    }
-    return sourceString;
-}
@@ -38,8 +38,6 @@ class MailTemplate : public QObject {
 
     private:
         MailTemplatePrivate* d;
-
-        QString performReplacements(QString sourceString);
 };
 
 #endif // MAILTEMPLATE_H
@@ -18,30 +18,44 @@
  *
  * *************************************/
 #include <QCoreApplication>
-#include <QSettings>
 
-#include "database.h"
+#include "configuration.h"
 #include "dbus/accountmanager.h"
+#include "dbus/useraccount.h"
 #include "dbusdaemon.h"
+#include "metrics.h"
+#include "reaper.h"
+#include "storage/storage.h"
 #include "utils.h"
 #include <QDBusConnection>
 #include <QFile>
 #include <QProcess>
 #include <QSqlDatabase>
+#include <QThreadPool>
 #include <logger.h>
 
 int main(int argc, char* argv[]) {
     QCoreApplication a(argc, argv);
 
-    Database* db = new Database();
-    if (!db->init()) {
+    // Reload the configuration whenever we receive SIGHUP
+    Configuration::instance()->watchForReloadSignal();
+
+    auto configuration = Configuration::current();
+    Logger::applyConfiguration();
+
+    if (configuration->backupKeySecret.isEmpty()) {
+        Logger::error() << "No backup key secret is configured; set otp/backupkeysecret or ACCOUNTS_BACKUP_KEY_SECRET\n";
+        return 1;
+    }
+
+    Storage* storage = Storage::create(configuration->databaseDriver);
+    if (!storage->init()) {
         return 1;
     }
 
-    QSettings settings(Utils::settingsFile(), QSettings::IniFormat);
-    if (settings.value("dbus/bus").toString() == "dedicated") {
-        new DBusDaemon(qEnvironmentVariable("DBUS_CONFIGURATION_FILE", settings.value("dbus/configuration").toString()));
-        QDBusConnection::connectToBus("unix:path=/var/vicr123-accounts/vicr123-accounts-bus", "accounts");
+    if (configuration->dedicatedBus) {
+        new DBusDaemon(configuration->dbusConfiguration);
+        QDBusConnection::connectToBus(Utils::dedicatedBusAddress, "accounts");
     }
 
     if (!Utils::accountsBus().registerService("com.vicr123.accounts")) {
@@ -50,5 +64,17 @@ int main(int argc, char* argv[]) {
 
     AccountManager* accountManager = new AccountManager();
 
-    return a.exec();
+    // Pick the password hashing cost in the background; the minimum is used until it is known
+    Utils::hashingThreadPool()->start([] {
+        Utils::calibratePasswordHashing();
+    });
+    Reaper::instance()->start();
+
+    if (!configuration->metricsSocket.isEmpty()) {
+        Metrics::instance()->listen(configuration->metricsSocket);
+    }
+
+    auto result = a.exec();
+    UserAccount::clearCache();
+    return result;
 }
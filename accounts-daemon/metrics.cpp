@@ -0,0 +1,312 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "metrics.h"
+
+#include "logger.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QReadWriteLock>
+#include <array>
+#include <cmath>
+
+namespace {
+    // Log-linear buckets in the style of HdrHistogram: eight sub-buckets for every power of two
+    // microseconds, so a recorded value is never off by more than an eighth of its size
+    class Histogram {
+        public:
+            void record(qint64 nsecs) {
+                auto usecs = static_cast<quint64>(qMax(nsecs, qint64(0)) / 1000);
+                counts[indexFor(usecs)].fetchAndAddRelaxed(1);
+                total.fetchAndAddRelaxed(1);
+                sumNsecs.fetchAndAddRelaxed(nsecs);
+
+                auto max = maxNsecs.loadRelaxed();
+                while (nsecs > max && !maxNsecs.testAndSetRelaxed(max, nsecs, max));
+            }
+
+            quint64 count() const {
+                return total.loadRelaxed();
+            }
+
+            double sumSeconds() const {
+                return sumNsecs.loadRelaxed() / 1e9;
+            }
+
+            double maxSeconds() const {
+                return maxNsecs.loadRelaxed() / 1e9;
+            }
+
+            double quantileSeconds(double quantile) const {
+                auto target = static_cast<quint64>(std::ceil(quantile * count()));
+                quint64 seen = 0;
+                for (auto i = 0; i < bucketCount; i++) {
+                    seen += counts[i].loadRelaxed();
+                    if (seen >= target && seen > 0) return upperBoundFor(i) / 1e6;
+                }
+                return 0;
+            }
+
+        private:
+            static constexpr int subBuckets = 8;
+            static constexpr int bucketCount = 40 * subBuckets;
+
+            std::array<QAtomicInteger<quint64>, bucketCount> counts;
+            QAtomicInteger<quint64> total;
+            QAtomicInteger<qint64> sumNsecs;
+            QAtomicInteger<qint64> maxNsecs;
+
+            static int indexFor(quint64 usecs) {
+                if (usecs < subBuckets) return static_cast<int>(usecs);
+                int exponent = 63 - qCountLeadingZeroBits(usecs);
+                int subBucket = static_cast<int>(usecs >> (exponent - 3)) & (subBuckets - 1);
+                return qMin((exponent - 2) * subBuckets + subBucket, bucketCount - 1);
+            }
+
+            static quint64 upperBoundFor(int index) {
+                if (index < subBuckets) return index;
+                int exponent = index / subBuckets + 2;
+                quint64 subBucket = index % subBuckets;
+                return ((subBuckets + subBucket + 1) << (exponent - 3)) - 1;
+            }
+    };
+
+    const QList<double> quantiles = {0.5, 0.9, 0.99, 0.999};
+
+    QString escapeLabel(QString value) {
+        return value.replace("\\", "\\\\").replace("\"", "\\\"").replace("\n", "\\n");
+    }
+} // namespace
+
+struct Metrics::CallTimer::Measurement {
+        QString method;
+        QElapsedTimer timer;
+
+        ~Measurement() {
+            Metrics::recordCall(method, timer.nsecsElapsed());
+        }
+};
+
+struct MetricsPrivate {
+        mutable QReadWriteLock lock;
+        QHash<QString, Histogram*> calls;
+        QHash<QString, Histogram*> operations;
+        QHash<QString, QAtomicInteger<quint64>*> errors;
+        QList<QPair<QString, std::function<QVariantMap()>>> collectors;
+
+        QLocalServer* server = nullptr;
+
+        // Entries are never removed, so a pointer stays valid once it has been handed out
+        template<typename T> T* entry(QHash<QString, T*>& entries, const QString& name) {
+            {
+                QReadLocker locker(&lock);
+                if (auto* value = entries.value(name)) return value;
+            }
+
+            QWriteLocker locker(&lock);
+            auto*& value = entries[name];
+            if (!value) value = new T();
+            return value;
+        }
+};
+
+Metrics::Metrics(QObject* parent) :
+    QObject(parent) {
+    d = new MetricsPrivate();
+
+    // Anything can record metrics, but the socket has to be served from the main thread
+    if (QCoreApplication::instance()) this->moveToThread(QCoreApplication::instance()->thread());
+}
+
+Metrics::~Metrics() {
+    qDeleteAll(d->calls);
+    qDeleteAll(d->operations);
+    qDeleteAll(d->errors);
+    delete d;
+}
+
+Metrics* Metrics::instance() {
+    static auto* instance = new Metrics();
+    return instance;
+}
+
+Metrics::Timer::Timer(QString operation) :
+    operation(operation) {
+    timer.start();
+}
+
+Metrics::Timer::~Timer() {
+    Metrics::recordOperation(operation, timer.nsecsElapsed());
+}
+
+Metrics::CallTimer::CallTimer(const QDBusMessage& message) :
+    measurement(QSharedPointer<Measurement>::create()) {
+    measurement->method = Metrics::methodName(message);
+    measurement->timer.start();
+}
+
+QString Metrics::methodName(const QDBusMessage& message) {
+    if (message.interface().isEmpty()) return message.member();
+    return QStringLiteral("%1.%2").arg(message.interface(), message.member());
+}
+
+void Metrics::recordCall(QString method, qint64 nsecs) {
+    auto* d = instance()->d;
+    d->entry(d->calls, method)->record(nsecs);
+}
+
+void Metrics::recordOperation(QString operation, qint64 nsecs) {
+    auto* d = instance()->d;
+    d->entry(d->operations, operation)->record(nsecs);
+}
+
+void Metrics::countError(const QDBusMessage& message) {
+    auto* d = instance()->d;
+    d->entry(d->errors, methodName(message))->fetchAndAddRelaxed(1);
+}
+
+void Metrics::addCollector(QString name, std::function<QVariantMap()> collector) {
+    QWriteLocker locker(&d->lock);
+    d->collectors.append({name, collector});
+}
+
+QVariantMap Metrics::snapshot() const {
+    auto histogramMap = [](const Histogram* histogram) {
+        QVariantMap map = {
+            {"count",      histogram->count()     },
+            {"sumSeconds", histogram->sumSeconds()},
+            {"maxSeconds", histogram->maxSeconds()}
+        };
+        for (auto quantile : quantiles) {
+            map.insert(QStringLiteral("p%1").arg(quantile * 100), histogram->quantileSeconds(quantile));
+        }
+        return map;
+    };
+
+    QVariantMap calls;
+    QVariantMap operations;
+    QList<QPair<QString, std::function<QVariantMap()>>> collectors;
+    {
+        QReadLocker locker(&d->lock);
+        for (auto i = d->calls.constBegin(); i != d->calls.constEnd(); i++) {
+            auto call = histogramMap(i.value());
+            call.insert("errors", d->errors.contains(i.key()) ? d->errors.value(i.key())->loadRelaxed() : 0);
+            calls.insert(i.key(), call);
+        }
+        for (auto i = d->operations.constBegin(); i != d->operations.constEnd(); i++) {
+            operations.insert(i.key(), histogramMap(i.value()));
+        }
+        collectors = d->collectors;
+    }
+
+    QVariantMap snapshot = {
+        {"calls",      calls     },
+        {"operations", operations}
+    };
+
+    // Collectors take their own locks, so call them without holding ours
+    for (const auto& [name, collector] : collectors) {
+        snapshot.insert(name, collector());
+    }
+    return snapshot;
+}
+
+QByteArray Metrics::prometheus() const {
+    QByteArray output;
+    auto writeSummary = [&output](const QString& metric, const QString& label, const QString& value, const Histogram* histogram) {
+        auto labels = QStringLiteral("%1=\"%2\"").arg(label, escapeLabel(value));
+        for (auto quantile : quantiles) {
+            output.append(QStringLiteral("%1{%2,quantile=\"%3\"} %4\n").arg(metric, labels).arg(quantile).arg(histogram->quantileSeconds(quantile)).toUtf8());
+        }
+        output.append(QStringLiteral("%1_sum{%2} %3\n").arg(metric, labels).arg(histogram->sumSeconds()).toUtf8());
+        output.append(QStringLiteral("%1_count{%2} %3\n").arg(metric, labels).arg(histogram->count()).toUtf8());
+    };
+
+    QList<QPair<QString, std::function<QVariantMap()>>> collectors;
+    {
+        QReadLocker locker(&d->lock);
+        output.append("# TYPE vicr123_accounts_dbus_call_seconds summary\n");
+        for (auto i = d->calls.constBegin(); i != d->calls.constEnd(); i++) {
+            writeSummary("vicr123_accounts_dbus_call_seconds", "method", i.key(), i.value());
+        }
+
+        output.append("# TYPE vicr123_accounts_dbus_errors_total counter\n");
+        for (auto i = d->errors.constBegin(); i != d->errors.constEnd(); i++) {
+            output.append(QStringLiteral("vicr123_accounts_dbus_errors_total{method=\"%1\"} %2\n").arg(escapeLabel(i.key())).arg(i.value()->loadRelaxed()).toUtf8());
+        }
+
+        output.append("# TYPE vicr123_accounts_operation_seconds summary\n");
+        for (auto i = d->operations.constBegin(); i != d->operations.constEnd(); i++) {
+            writeSummary("vicr123_accounts_operation_seconds", "operation", i.key(), i.value());
+        }
+        collectors = d->collectors;
+    }
+
+    // Numbers reported by collectors become gauges named after the collector and the key
+    for (const auto& [name, collector] : collectors) {
+        auto values = collector();
+        for (auto i = values.constBegin(); i != values.constEnd(); i++) {
+            bool isNumber;
+            auto value = i.value().toDouble(&isNumber);
+            if (!isNumber) continue;
+
+            auto metric = QStringLiteral("vicr123_accounts_%1_%2").arg(name, i.key()).toLower();
+            output.append(QStringLiteral("# TYPE %1 gauge\n%1 %2\n").arg(metric).arg(value).toUtf8());
+        }
+    }
+    return output;
+}
+
+bool Metrics::listen(QString socketPath) {
+    if (!d->server) d->server = new QLocalServer(this);
+
+    QFile::remove(socketPath);
+    if (!d->server->listen(socketPath)) {
+        Logger::error() << "Could not listen for metrics requests on " << socketPath << "\n";
+        return false;
+    }
+
+    // Answer every request with the metrics, whatever was asked for, so both HTTP scrapers and plain clients work
+    connect(d->server, &QLocalServer::newConnection, this, [this] {
+        while (auto* socket = d->server->nextPendingConnection()) {
+            connect(socket, &QLocalSocket::disconnected, socket, &QLocalSocket::deleteLater);
+            connect(socket, &QLocalSocket::readyRead, this, [this, socket] {
+                if (socket->property("answered").toBool()) {
+                    socket->readAll();
+                    return;
+                }
+
+                auto request = socket->property("request").toByteArray() + socket->readAll();
+                socket->setProperty("request", request);
+                if (!request.contains("\r\n\r\n") && !request.contains("\n\n")) return;
+
+                auto body = prometheus();
+                socket->write("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ");
+                socket->write(QByteArray::number(body.size()));
+                socket->write("\r\n\r\n");
+                socket->write(body);
+                socket->setProperty("answered", true);
+                socket->disconnectFromServer();
+            });
+        }
+    });
+    return true;
+}
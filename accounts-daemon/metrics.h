@@ -0,0 +1,77 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QDBusMessage>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSharedPointer>
+#include <functional>
+
+struct MetricsPrivate;
+class Metrics : public QObject {
+        Q_OBJECT
+    public:
+        ~Metrics();
+
+        static Metrics* instance();
+
+        // Records how long an operation took (sql, pbkdf2, fido, smtp) when it goes out of scope
+        class Timer {
+            public:
+                explicit Timer(QString operation);
+                ~Timer();
+
+            private:
+                QString operation;
+                QElapsedTimer timer;
+        };
+
+        // Records how long a D-Bus call took. Copies share one measurement that is recorded when the
+        // last copy goes away, so a call that replies later should capture it in its continuation.
+        class CallTimer {
+            public:
+                explicit CallTimer(const QDBusMessage& message);
+
+            private:
+                struct Measurement;
+                QSharedPointer<Measurement> measurement;
+        };
+
+        static QString methodName(const QDBusMessage& message);
+        static void recordCall(QString method, qint64 nsecs);
+        static void recordOperation(QString operation, qint64 nsecs);
+        static void countError(const QDBusMessage& message);
+
+        void addCollector(QString name, std::function<QVariantMap()> collector);
+
+        QVariantMap snapshot() const;
+        QByteArray prometheus() const;
+
+        bool listen(QString socketPath);
+
+    private:
+        MetricsPrivate* d;
+
+        explicit Metrics(QObject* parent = nullptr);
+};
+
+#endif // METRICS_H
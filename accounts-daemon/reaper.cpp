@@ -0,0 +1,149 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "reaper.h"
+
+#include "configuration.h"
+#include "logger.h"
+#include "metrics.h"
+#include "storage/storage.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+#include <QtConcurrent>
+
+struct ReaperPrivate {
+        QTimer* timer;
+        std::atomic<bool> running = false;
+
+        mutable QMutex mutex;
+        quint64 runs = 0;
+        quint64 batches = 0;
+        quint64 failures = 0;
+        QMap<Storage::ExpiringTable, quint64> purged;
+
+        static QString tableName(Storage::ExpiringTable table) {
+            switch (table) {
+                case Storage::ExpiringTable::Tokens:
+                    return QStringLiteral("tokens");
+                case Storage::ExpiringTable::Verifications:
+                    return QStringLiteral("verifications");
+                case Storage::ExpiringTable::PasswordResets:
+                    return QStringLiteral("passwordResets");
+            }
+            return {};
+        }
+};
+
+Reaper::Reaper(QObject* parent) :
+    QObject(parent) {
+    d = new ReaperPrivate();
+    d->timer = new QTimer(this);
+    connect(d->timer, &QTimer::timeout, this, &Reaper::run);
+    connect(Configuration::instance(), &Configuration::reloaded, this, &Reaper::applyConfiguration);
+}
+
+Reaper::~Reaper() {
+    delete d;
+}
+
+Reaper* Reaper::instance() {
+    static auto* instance = new Reaper();
+    return instance;
+}
+
+void Reaper::start() {
+    applyConfiguration();
+}
+
+QVariantMap Reaper::statistics() const {
+    QMutexLocker locker(&d->mutex);
+    QVariantMap purged;
+    for (auto table = d->purged.constBegin(); table != d->purged.constEnd(); table++) {
+        purged.insert(ReaperPrivate::tableName(table.key()), table.value());
+    }
+
+    return {
+        {"runs",     d->runs    },
+        {"batches",  d->batches },
+        {"failures", d->failures},
+        {"purged",   purged     }
+    };
+}
+
+void Reaper::applyConfiguration() {
+    auto interval = Configuration::current()->reaperInterval;
+    if (interval <= 0) {
+        d->timer->stop();
+        return;
+    }
+    d->timer->start(interval);
+}
+
+void Reaper::run() {
+    // Skip this round if the last one is still going
+    if (d->running.exchange(true)) return;
+
+    QtConcurrent::run([this] {
+        auto configuration = Configuration::current();
+        auto batchSize = qMax(1, configuration->reaperBatchSize);
+        auto dutyCycle = qBound(1, configuration->reaperDutyCycle, 100);
+
+        for (auto table : {Storage::ExpiringTable::Tokens, Storage::ExpiringTable::Verifications, Storage::ExpiringTable::PasswordResets}) {
+            forever {
+                QElapsedTimer elapsed;
+                elapsed.start();
+
+                int purged;
+                {
+                    Metrics::Timer timer("purge");
+                    purged = Storage::instance()->purgeExpired(table, QDateTime::currentMSecsSinceEpoch(), batchSize);
+                }
+
+                {
+                    QMutexLocker locker(&d->mutex);
+                    d->batches++;
+                    if (purged < 0) {
+                        d->failures++;
+                    } else {
+                        d->purged[table] += purged;
+                    }
+                }
+
+                if (purged < 0) {
+                    Logger::warning() << "Could not purge expired " << ReaperPrivate::tableName(table) << "\n";
+                    break;
+                }
+                if (purged < batchSize) break;
+
+                // Rest between batches so that purging only takes up the configured share of the time
+                QThread::msleep(elapsed.elapsed() * (100 - dutyCycle) / dutyCycle);
+            }
+        }
+
+        Storage::instance()->releaseConnection();
+
+        QMutexLocker locker(&d->mutex);
+        d->runs++;
+    }).then(this, [this] {
+        d->running = false;
+    });
+}
@@ -4,27 +4,50 @@ CREATE TABLE version (
             PRIMARY KEY
 );
 
-INSERT INTO version VALUES(2);
+INSERT INTO version VALUES(7);
 
-CREATE FUNCTION generate_user_id() RETURNS INTEGER
+-- Ids come from a sequence run through a keyed Feistel permutation, so they are unique without
+-- being sequential. The keys are generated when the database is created.
+CREATE TABLE idkeys (
+    name TEXT   NOT NULL
+        CONSTRAINT pk_idkeys
+            PRIMARY KEY,
+    keys BIGINT[] NOT NULL
+);
+
+INSERT INTO idkeys VALUES('users', ARRAY(SELECT FLOOR(RANDOM() * 2147483648)::BIGINT FROM generate_series(1, 4)));
+INSERT INTO idkeys VALUES('fido', ARRAY(SELECT FLOOR(RANDOM() * 2147483648)::BIGINT FROM generate_series(1, 4)));
+
+CREATE SEQUENCE user_id_seq MINVALUE 0 MAXVALUE 1073741823 START 0;
+CREATE SEQUENCE fido_id_seq MINVALUE 0 MAXVALUE 1073741823 START 0;
+
+CREATE FUNCTION permute_id(sequence BIGINT, keys BIGINT[]) RETURNS INTEGER
     LANGUAGE plpgsql
+    IMMUTABLE
 AS
 $$
 DECLARE
-    num INT := 0;
-    cnt INT := 0;
+    l BIGINT := (sequence >> 15) & 32767;
+    r BIGINT := sequence & 32767;
+    t BIGINT;
 BEGIN
-    <<gen>>
-    LOOP
-        num = FLOOR(RANDOM() * 10000000 + 1000000)::INT;
-        cnt := (SELECT COUNT(*)::INT FROM users WHERE id = num);
-        EXIT gen WHEN cnt = 0;
+    FOR i IN 1..array_length(keys, 1) LOOP
+        t := r;
+        r := l # ((((r # keys[i]) * 2654435761) >> 13) & 32767);
+        l := t;
     END LOOP;
 
-    RETURN num;
+    RETURN (1073741824 + (l << 15) + r)::INTEGER;
 END
 $$;
 
+CREATE FUNCTION generate_user_id() RETURNS INTEGER
+    LANGUAGE sql
+AS
+$$
+    SELECT permute_id(nextval('user_id_seq'), keys) FROM idkeys WHERE name = 'users';
+$$;
+
 CREATE TABLE users (
     id        INTEGER DEFAULT generate_user_id() NOT NULL
         CONSTRAINT users_pkey
@@ -45,14 +68,17 @@ CREATE TABLE tokens (
         CONSTRAINT fk_tokens_userid
             REFERENCES users
             ON UPDATE CASCADE ON DELETE CASCADE,
-    token       TEXT    NOT NULL
-        CONSTRAINT tokens_token_key
+    digest      BYTEA   NOT NULL
+        CONSTRAINT tokens_digest_key
             UNIQUE,
     application TEXT    NOT NULL,
-    CONSTRAINT pk_tokens
-        PRIMARY KEY (userid, token)
+    last_used   BIGINT  NOT NULL,
+    expires_at  BIGINT  NOT NULL
 );
 
+CREATE INDEX tokens_expires_at ON tokens(expires_at);
+CREATE INDEX tokens_userid_last_used ON tokens(userid, last_used);
+
 CREATE TABLE verifications (
     userid             INTEGER NOT NULL
         CONSTRAINT pk_verifications
@@ -66,6 +92,8 @@ CREATE TABLE verifications (
     expiry             BIGINT  NOT NULL
 );
 
+CREATE INDEX verifications_expiry ON verifications(expiry);
+
 CREATE TABLE otp (
     userid  INTEGER NOT NULL
         CONSTRAINT otp_pkey
@@ -82,10 +110,11 @@ CREATE TABLE otpbackup (
         CONSTRAINT fk_tokens_userid
             REFERENCES users
             ON UPDATE CASCADE ON DELETE CASCADE,
-    backupkey TEXT    NOT NULL,
+    digest    BYTEA   NOT NULL,
     used      BOOLEAN DEFAULT FALSE,
+    keyed     BOOLEAN NOT NULL DEFAULT TRUE,
     CONSTRAINT pk_otpbackup
-        PRIMARY KEY (userid, backupkey)
+        PRIMARY KEY (userid, digest)
 );
 
 CREATE TABLE passwordresets (
@@ -101,23 +130,13 @@ CREATE TABLE passwordresets (
     expiry            BIGINT  NOT NULL
 );
 
+CREATE INDEX passwordresets_expiry ON passwordresets(expiry);
+
 CREATE FUNCTION generate_fido_id() RETURNS INTEGER
-    LANGUAGE plpgsql
+    LANGUAGE sql
 AS
 $$
-DECLARE
-    num INT := 0;
-    cnt INT := 0;
-BEGIN
-<<gen>>
-    LOOP
-        num = FLOOR(RANDOM() * 10000000 + 1000000)::INT;
-        cnt := (SELECT COUNT(*)::INT FROM fido WHERE id = num);
-        EXIT gen WHEN cnt = 0;
-END LOOP;
-
-RETURN num;
-END
+    SELECT permute_id(nextval('fido_id_seq'), keys) FROM idkeys WHERE name = 'fido';
 $$;
 
 CREATE TABLE fido
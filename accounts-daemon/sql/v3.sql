@@ -0,0 +1,15 @@
+BEGIN;
+
+-- Backup keys are stored as SHA-256 digests of "<userid>:<backupkey>"
+ALTER TABLE otpbackup ADD COLUMN digest BYTEA;
+UPDATE otpbackup SET digest = sha256(convert_to(userid::TEXT || ':' || backupkey, 'UTF8'));
+
+ALTER TABLE otpbackup DROP CONSTRAINT pk_otpbackup;
+ALTER TABLE otpbackup DROP COLUMN backupkey;
+ALTER TABLE otpbackup ALTER COLUMN digest SET NOT NULL;
+ALTER TABLE otpbackup ADD CONSTRAINT pk_otpbackup PRIMARY KEY (userid, digest);
+
+DELETE FROM version;
+INSERT INTO version VALUES(3);
+
+COMMIT;
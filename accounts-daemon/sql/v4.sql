@@ -0,0 +1,16 @@
+BEGIN;
+
+-- Tokens are looked up by the SHA-256 digest of the token. Existing rows get their digest from
+-- the daemon in the background, which drops the token column once every row has one.
+ALTER TABLE tokens DROP CONSTRAINT pk_tokens;
+ALTER TABLE tokens ALTER COLUMN token DROP NOT NULL;
+ALTER TABLE tokens ADD COLUMN digest BYTEA;
+ALTER TABLE tokens ADD CONSTRAINT tokens_digest_key UNIQUE (digest);
+
+-- Lets each migration batch find its rows without scanning the ones already done
+CREATE INDEX tokens_unmigrated ON tokens(token) WHERE digest IS NULL;
+
+DELETE FROM version;
+INSERT INTO version VALUES(4);
+
+COMMIT;
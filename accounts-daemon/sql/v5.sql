@@ -0,0 +1,19 @@
+BEGIN;
+
+-- Login tokens expire once they go unused for long enough. Existing tokens count as used now
+-- and get the default 90 day lifetime.
+ALTER TABLE tokens ADD COLUMN last_used BIGINT NOT NULL DEFAULT (EXTRACT(EPOCH FROM NOW()) * 1000)::BIGINT;
+ALTER TABLE tokens ADD COLUMN expires_at BIGINT NOT NULL DEFAULT ((EXTRACT(EPOCH FROM NOW()) + 90 * 24 * 60 * 60) * 1000)::BIGINT;
+ALTER TABLE tokens ALTER COLUMN last_used DROP DEFAULT;
+ALTER TABLE tokens ALTER COLUMN expires_at DROP DEFAULT;
+
+-- Let the reaper find expired rows and the per-user cap find a user's oldest tokens without scanning
+CREATE INDEX tokens_expires_at ON tokens(expires_at);
+CREATE INDEX tokens_userid_last_used ON tokens(userid, last_used);
+CREATE INDEX verifications_expiry ON verifications(expiry);
+CREATE INDEX passwordresets_expiry ON passwordresets(expiry);
+
+DELETE FROM version;
+INSERT INTO version VALUES(5);
+
+COMMIT;
@@ -0,0 +1,56 @@
+BEGIN;
+
+-- Ids are now handed out by running a sequence through a keyed Feistel permutation, which never
+-- repeats and never has to check for collisions. They land in [2^30, 2^31) so they can't collide
+-- with the random ids below 11000000 that were handed out before.
+CREATE TABLE idkeys (
+    name TEXT   NOT NULL
+        CONSTRAINT pk_idkeys
+            PRIMARY KEY,
+    keys BIGINT[] NOT NULL
+);
+
+INSERT INTO idkeys VALUES('users', ARRAY(SELECT FLOOR(RANDOM() * 2147483648)::BIGINT FROM generate_series(1, 4)));
+INSERT INTO idkeys VALUES('fido', ARRAY(SELECT FLOOR(RANDOM() * 2147483648)::BIGINT FROM generate_series(1, 4)));
+
+CREATE SEQUENCE user_id_seq MINVALUE 0 MAXVALUE 1073741823 START 0;
+CREATE SEQUENCE fido_id_seq MINVALUE 0 MAXVALUE 1073741823 START 0;
+
+CREATE FUNCTION permute_id(sequence BIGINT, keys BIGINT[]) RETURNS INTEGER
+    LANGUAGE plpgsql
+    IMMUTABLE
+AS
+$$
+DECLARE
+    l BIGINT := (sequence >> 15) & 32767;
+    r BIGINT := sequence & 32767;
+    t BIGINT;
+BEGIN
+    FOR i IN 1..array_length(keys, 1) LOOP
+        t := r;
+        r := l # ((((r # keys[i]) * 2654435761) >> 13) & 32767);
+        l := t;
+    END LOOP;
+
+    RETURN (1073741824 + (l << 15) + r)::INTEGER;
+END
+$$;
+
+CREATE OR REPLACE FUNCTION generate_user_id() RETURNS INTEGER
+    LANGUAGE sql
+AS
+$$
+    SELECT permute_id(nextval('user_id_seq'), keys) FROM idkeys WHERE name = 'users';
+$$;
+
+CREATE OR REPLACE FUNCTION generate_fido_id() RETURNS INTEGER
+    LANGUAGE sql
+AS
+$$
+    SELECT permute_id(nextval('fido_id_seq'), keys) FROM idkeys WHERE name = 'fido';
+$$;
+
+DELETE FROM version;
+INSERT INTO version VALUES(6);
+
+COMMIT;
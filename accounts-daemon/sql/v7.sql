@@ -0,0 +1,11 @@
+BEGIN;
+
+-- Backup key digests are now HMAC-SHA256 with a server secret over the old SHA-256 digest. The
+-- secret isn't known here, so existing rows are marked and the daemon rekeys them when it starts.
+ALTER TABLE otpbackup ADD COLUMN keyed BOOLEAN NOT NULL DEFAULT FALSE;
+ALTER TABLE otpbackup ALTER COLUMN keyed SET DEFAULT TRUE;
+
+DELETE FROM version;
+INSERT INTO version VALUES(7);
+
+COMMIT;
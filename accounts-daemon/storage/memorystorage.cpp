@@ -0,0 +1,555 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "memorystorage.h"
+
+#include "logger.h"
+#include <QRandomGenerator>
+#include <QReadWriteLock>
+#include <QSet>
+#include <algorithm>
+#include <array>
+#include <set>
+
+namespace {
+    struct MemoryUser {
+            StoredUser user;
+            std::optional<StoredOtp> otp;
+            QList<StoredBackupKey> backupKeys;
+            std::optional<StoredPasswordReset> passwordReset;
+            QString verificationCode;
+            qint64 verificationExpiry = 0;
+            QList<StoredFidoKey> fidoKeys;
+            QSet<QByteArray> tokens;
+    };
+
+    struct MemoryToken {
+            quint64 userId = 0;
+            qint64 lastUsed = 0;
+            qint64 expiry = 0;
+    };
+
+    struct UserStripe {
+            QReadWriteLock lock;
+            QHash<quint64, MemoryUser> users;
+    };
+
+    struct TokenStripe {
+            QReadWriteLock lock;
+            QHash<QByteArray, MemoryToken> tokens;
+    };
+} // namespace
+
+struct MemoryStoragePrivate {
+        static constexpr auto stripeCount = 64;
+
+        // Locks are always taken in this order: index, then user stripe, then token stripe
+        QReadWriteLock indexLock;
+        QHash<QString, quint64> usernames;
+        QHash<QString, quint64> emails;
+        std::set<quint64> ids;
+
+        std::array<UserStripe, stripeCount> userStripes;
+        std::array<TokenStripe, stripeCount> tokenStripes;
+        QAtomicInteger<quint32> nextUserSequence = 0;
+        QAtomicInteger<quint32> nextFidoSequence = 0;
+        std::array<quint32, 4> userIdKeys;
+        std::array<quint32, 4> fidoIdKeys;
+
+        // Same permutation as permute_id() in the PostgreSQL schema: unique, non-sequential ids in [2^30, 2^31)
+        static quint32 permuteId(quint32 sequence, const std::array<quint32, 4>& keys) {
+            quint64 left = (sequence >> 15) & 0x7FFF;
+            quint64 right = sequence & 0x7FFF;
+            for (auto key : keys) {
+                auto next = left ^ ((((right ^ key) * 2654435761ULL) >> 13) & 0x7FFF);
+                left = right;
+                right = next;
+            }
+            return 0x40000000 + (left << 15) + right;
+        }
+
+        UserStripe& stripeFor(quint64 id) {
+            return userStripes[id % stripeCount];
+        }
+
+        TokenStripe& stripeFor(const QByteArray& tokenDigest) {
+            return tokenStripes[qHash(tokenDigest) % stripeCount];
+        }
+
+        // Run a function on a user while holding its stripe lock; returns false if there is no such user
+        template<typename Function> bool readUser(quint64 id, Function function) {
+            auto& stripe = stripeFor(id);
+            QReadLocker locker(&stripe.lock);
+            auto user = stripe.users.constFind(id);
+            if (user == stripe.users.constEnd()) return false;
+            function(*user);
+            return true;
+        }
+
+        template<typename Function> bool writeUser(quint64 id, Function function) {
+            auto& stripe = stripeFor(id);
+            QWriteLocker locker(&stripe.lock);
+            auto user = stripe.users.find(id);
+            if (user == stripe.users.end()) return false;
+            function(*user);
+            return true;
+        }
+};
+
+MemoryStorage::MemoryStorage(QObject* parent) :
+    Storage(parent) {
+    d = new MemoryStoragePrivate();
+    for (auto& key : d->userIdKeys) key = QRandomGenerator::global()->bounded(0x80000000U);
+    for (auto& key : d->fidoIdKeys) key = QRandomGenerator::global()->bounded(0x80000000U);
+}
+
+MemoryStorage::~MemoryStorage() {
+    delete d;
+}
+
+bool MemoryStorage::init() {
+    Logger::log() << "Using in-memory storage; nothing will be kept when the daemon exits\n";
+    return true;
+}
+
+bool MemoryStorage::createUser(QString username, QString passwordHash, QString email, quint64* id) {
+    QWriteLocker indexLocker(&d->indexLock);
+    if (d->usernames.contains(username) || d->emails.contains(email)) return false;
+
+    // Hand out ids the same way as the PostgreSQL schema
+    quint64 newId = MemoryStoragePrivate::permuteId(d->nextUserSequence.fetchAndAddRelaxed(1), d->userIdKeys);
+
+    d->usernames.insert(username, newId);
+    d->emails.insert(email, newId);
+    d->ids.insert(newId);
+
+    auto& stripe = d->stripeFor(newId);
+    QWriteLocker locker(&stripe.lock);
+    MemoryUser user;
+    user.user = {newId, username, passwordHash, email, "en", false};
+    stripe.users.insert(newId, user);
+
+    *id = newId;
+    return true;
+}
+
+std::optional<StoredUser> MemoryStorage::user(quint64 id) {
+    std::optional<StoredUser> result;
+    d->readUser(id, [&result](const MemoryUser& user) {
+        result = user.user;
+    });
+    return result;
+}
+
+quint64 MemoryStorage::userIdByUsername(QString username) {
+    QReadLocker locker(&d->indexLock);
+    return d->usernames.value(username);
+}
+
+bool MemoryStorage::userIdsByUsernames(QStringList usernames, QHash<QString, quint64>* ids) {
+    QReadLocker locker(&d->indexLock);
+    for (const auto& username : usernames) {
+        auto id = d->usernames.value(username);
+        if (id != 0) ids->insert(username, id);
+    }
+    return true;
+}
+
+bool MemoryStorage::accounts(QList<quint64> ids, QList<StoredAccount>* accounts) {
+    for (auto id : ids) {
+        d->readUser(id, [accounts](const MemoryUser& user) {
+            accounts->append({user.user, user.otp.value_or(StoredOtp())});
+        });
+    }
+    return true;
+}
+
+bool MemoryStorage::userIdsAfter(quint64 afterId, uint limit, QList<quint64>* ids) {
+    QReadLocker locker(&d->indexLock);
+    for (auto id = d->ids.upper_bound(afterId); id != d->ids.end() && static_cast<uint>(ids->size()) < limit; id++) {
+        ids->append(*id);
+    }
+    return true;
+}
+
+bool MemoryStorage::forEachUserId(std::function<bool(quint64)> callback) {
+    // Copy ids out in chunks so a slow callback never holds the index lock
+    quint64 lastId = 0;
+    forever {
+        QList<quint64> chunk;
+        userIdsAfter(lastId, 1024, &chunk);
+        if (chunk.isEmpty()) return true;
+
+        for (auto id : chunk) {
+            if (!callback(id)) return true;
+        }
+        lastId = chunk.last();
+    }
+}
+
+bool MemoryStorage::setUsername(quint64 id, QString username) {
+    QWriteLocker indexLocker(&d->indexLock);
+    auto existing = d->usernames.value(username);
+    if (existing != 0 && existing != id) return false;
+
+    d->writeUser(id, [this, id, &username](MemoryUser& user) {
+        d->usernames.remove(user.user.username);
+        d->usernames.insert(username, id);
+        user.user.username = username;
+    });
+    return true;
+}
+
+bool MemoryStorage::setEmail(quint64 id, QString email) {
+    QWriteLocker indexLocker(&d->indexLock);
+    auto existing = d->emails.value(email);
+    if (existing != 0 && existing != id) return false;
+
+    d->writeUser(id, [this, id, &email](MemoryUser& user) {
+        d->emails.remove(user.user.email);
+        d->emails.insert(email, id);
+        user.user.email = email;
+        user.user.verified = false;
+    });
+    return true;
+}
+
+bool MemoryStorage::setVerified(quint64 id, bool verified) {
+    // Like an UPDATE, changing a user that doesn't exist is not an error
+    d->writeUser(id, [verified](MemoryUser& user) {
+        user.user.verified = verified;
+    });
+    return true;
+}
+
+bool MemoryStorage::setPassword(quint64 id, QString passwordHash) {
+    d->writeUser(id, [&passwordHash](MemoryUser& user) {
+        user.user.password = passwordHash;
+    });
+    return true;
+}
+
+Storage::Status MemoryStorage::replacePassword(quint64 id, QString oldPasswordHash, QString passwordHash) {
+    auto status = Status::NotFound;
+    d->writeUser(id, [&](MemoryUser& user) {
+        if (user.user.password != oldPasswordHash) return;
+        user.user.password = passwordHash;
+        status = Status::Ok;
+    });
+    return status;
+}
+
+bool MemoryStorage::setVerification(quint64 id, QString code, qint64 expiry) {
+    return d->writeUser(id, [&code, expiry](MemoryUser& user) {
+        user.verificationCode = code;
+        user.verificationExpiry = expiry;
+    });
+}
+
+Storage::Status MemoryStorage::consumeVerification(quint64 id, QString code, qint64 now) {
+    auto status = Status::NotFound;
+    d->writeUser(id, [&status, &code, now](MemoryUser& user) {
+        if (user.verificationCode.isEmpty() || user.verificationCode != code || user.verificationExpiry <= now) return;
+
+        user.verificationCode.clear();
+        user.user.verified = true;
+        status = Status::Ok;
+    });
+    return status;
+}
+
+std::optional<StoredPasswordReset> MemoryStorage::passwordReset(quint64 id) {
+    std::optional<StoredPasswordReset> result;
+    d->readUser(id, [&result](const MemoryUser& user) {
+        result = user.passwordReset;
+    });
+    return result;
+}
+
+bool MemoryStorage::setPasswordReset(quint64 id, QString temporaryPasswordHash, qint64 expiry) {
+    return d->writeUser(id, [&temporaryPasswordHash, expiry](MemoryUser& user) {
+        user.passwordReset = StoredPasswordReset{temporaryPasswordHash, expiry};
+    });
+}
+
+bool MemoryStorage::deletePasswordReset(quint64 id) {
+    d->writeUser(id, [](MemoryUser& user) {
+        user.passwordReset.reset();
+    });
+    return true;
+}
+
+std::optional<StoredOtp> MemoryStorage::otp(quint64 id, bool* ok) {
+    if (ok) *ok = true;
+    std::optional<StoredOtp> result;
+    d->readUser(id, [&result](const MemoryUser& user) {
+        result = user.otp;
+    });
+    return result;
+}
+
+bool MemoryStorage::setOtpKey(quint64 id, QString key) {
+    return d->writeUser(id, [&key](MemoryUser& user) {
+        user.otp = StoredOtp{key, false};
+    });
+}
+
+bool MemoryStorage::setOtpEnabled(quint64 id, bool enabled) {
+    d->writeUser(id, [enabled](MemoryUser& user) {
+        if (user.otp) user.otp->enabled = enabled;
+    });
+    return true;
+}
+
+bool MemoryStorage::backupKeys(quint64 id, QList<StoredBackupKey>* keys) {
+    d->readUser(id, [keys](const MemoryUser& user) {
+        keys->append(user.backupKeys);
+    });
+    return true;
+}
+
+bool MemoryStorage::replaceBackupKeys(quint64 id, QList<StoredBackupKey> keys) {
+    return d->writeUser(id, [&keys](MemoryUser& user) {
+        user.backupKeys = keys;
+    });
+}
+
+Storage::Status MemoryStorage::loginState(QString username, StoredLoginState* state) {
+    QReadLocker indexLocker(&d->indexLock);
+    auto id = d->usernames.value(username);
+    if (id == 0) return Status::NotFound;
+
+    auto found = d->readUser(id, [state](const MemoryUser& user) {
+        state->user = user.user;
+        state->passwordReset = user.passwordReset;
+        state->otp = user.otp;
+    });
+    return found ? Status::Ok : Status::NotFound;
+}
+
+Storage::Status MemoryStorage::issueToken(quint64 id, QByteArray tokenDigest, QString application, qint64 now, qint64 expiry, QByteArray backupKeyDigest) {
+    // Hold the user's stripe for writing so the backup key and the token change together
+    auto& userStripe = d->stripeFor(id);
+    QWriteLocker userLocker(&userStripe.lock);
+    auto user = userStripe.users.find(id);
+    if (user == userStripe.users.end()) return Status::Failed;
+
+    StoredBackupKey* consumed = nullptr;
+    if (!backupKeyDigest.isEmpty()) {
+        for (auto& storedBackupKey : user->backupKeys) {
+            if (!storedBackupKey.used && storedBackupKey.digest == backupKeyDigest) consumed = &storedBackupKey;
+        }
+        if (!consumed) return Status::NotFound;
+    }
+
+    auto& stripe = d->stripeFor(tokenDigest);
+    QWriteLocker locker(&stripe.lock);
+    if (stripe.tokens.contains(tokenDigest)) return Status::Failed;
+    stripe.tokens.insert(tokenDigest, {id, now, expiry});
+    user->tokens.insert(tokenDigest);
+    if (consumed) consumed->used = true;
+    return Status::Ok;
+}
+
+bool MemoryStorage::insertToken(quint64 id, QByteArray tokenDigest, QString application, qint64 now, qint64 expiry) {
+    auto& userStripe = d->stripeFor(id);
+    QWriteLocker userLocker(&userStripe.lock);
+    auto user = userStripe.users.find(id);
+    if (user == userStripe.users.end()) return false;
+
+    auto& stripe = d->stripeFor(tokenDigest);
+    QWriteLocker locker(&stripe.lock);
+    if (stripe.tokens.contains(tokenDigest)) return false;
+    stripe.tokens.insert(tokenDigest, {id, now, expiry});
+    user->tokens.insert(tokenDigest);
+    return true;
+}
+
+bool MemoryStorage::tokenUsers(QList<QByteArray> tokenDigests, qint64 now, QHash<QByteArray, quint64>* users) {
+    for (const auto& tokenDigest : tokenDigests) {
+        auto& stripe = d->stripeFor(tokenDigest);
+        QReadLocker locker(&stripe.lock);
+        auto token = stripe.tokens.constFind(tokenDigest);
+        if (token != stripe.tokens.constEnd() && token->expiry > now) users->insert(tokenDigest, token->userId);
+    }
+    return true;
+}
+
+bool MemoryStorage::touchTokens(QList<QByteArray> tokenDigests, qint64 now, qint64 expiry) {
+    for (const auto& tokenDigest : tokenDigests) {
+        auto& stripe = d->stripeFor(tokenDigest);
+        QWriteLocker locker(&stripe.lock);
+        auto token = stripe.tokens.find(tokenDigest);
+        if (token == stripe.tokens.end() || token->lastUsed >= now - tokenTouchInterval) continue;
+
+        token->lastUsed = now;
+        token->expiry = qMax(token->expiry, expiry);
+    }
+    return true;
+}
+
+bool MemoryStorage::trimTokens(quint64 id, int maximum, QList<QByteArray>* trimmed) {
+    auto& userStripe = d->stripeFor(id);
+    QWriteLocker userLocker(&userStripe.lock);
+    auto user = userStripe.users.find(id);
+    if (user == userStripe.users.end() || user->tokens.size() <= maximum) return true;
+
+    QList<QPair<qint64, QByteArray>> tokens;
+    for (const auto& tokenDigest : std::as_const(user->tokens)) {
+        auto& stripe = d->stripeFor(tokenDigest);
+        QReadLocker locker(&stripe.lock);
+        tokens.append({stripe.tokens.value(tokenDigest).lastUsed, tokenDigest});
+    }
+
+    // Keep the most recently used tokens
+    std::sort(tokens.begin(), tokens.end(), [](const auto& first, const auto& second) {
+        return first.first > second.first;
+    });
+    for (auto i = maximum; i < tokens.size(); i++) {
+        const auto& tokenDigest = tokens.at(i).second;
+        auto& stripe = d->stripeFor(tokenDigest);
+        QWriteLocker locker(&stripe.lock);
+        stripe.tokens.remove(tokenDigest);
+        user->tokens.remove(tokenDigest);
+        trimmed->append(tokenDigest);
+    }
+    return true;
+}
+
+bool MemoryStorage::deleteToken(QByteArray tokenDigest) {
+    quint64 userId;
+    {
+        auto& stripe = d->stripeFor(tokenDigest);
+        QWriteLocker locker(&stripe.lock);
+        auto token = stripe.tokens.find(tokenDigest);
+        if (token == stripe.tokens.end()) return true;
+
+        userId = token->userId;
+        stripe.tokens.erase(token);
+    }
+
+    // The user stripe can't be locked while holding the token stripe
+    d->writeUser(userId, [&tokenDigest](MemoryUser& user) {
+        user.tokens.remove(tokenDigest);
+    });
+    return true;
+}
+
+int MemoryStorage::purgeExpired(ExpiringTable table, qint64 now, int limit) {
+    auto purged = 0;
+    if (table == ExpiringTable::Tokens) {
+        QList<MemoryToken> expired;
+        QList<QByteArray> expiredDigests;
+        for (auto& stripe : d->tokenStripes) {
+            QWriteLocker locker(&stripe.lock);
+            for (auto token = stripe.tokens.begin(); token != stripe.tokens.end() && purged < limit;) {
+                if (token->expiry > now) {
+                    token++;
+                    continue;
+                }
+
+                expired.append(*token);
+                expiredDigests.append(token.key());
+                token = stripe.tokens.erase(token);
+                purged++;
+            }
+        }
+
+        for (auto i = 0; i < expired.size(); i++) {
+            d->writeUser(expired.at(i).userId, [&tokenDigest = expiredDigests.at(i)](MemoryUser& user) {
+                user.tokens.remove(tokenDigest);
+            });
+        }
+        return purged;
+    }
+
+    // Everything else lives with the user, one row per user
+    for (auto& stripe : d->userStripes) {
+        QWriteLocker locker(&stripe.lock);
+        for (auto& user : stripe.users) {
+            if (purged == limit) return purged;
+
+            if (table == ExpiringTable::Verifications && !user.verificationCode.isEmpty() && user.verificationExpiry <= now) {
+                user.verificationCode.clear();
+                purged++;
+            } else if (table == ExpiringTable::PasswordResets && user.passwordReset && user.passwordReset->expiry <= now) {
+                user.passwordReset.reset();
+                purged++;
+            }
+        }
+    }
+    return purged;
+}
+
+bool MemoryStorage::fidoKeys(quint64 id, QList<StoredFidoKey>* keys) {
+    d->readUser(id, [keys](const MemoryUser& user) {
+        for (const auto& key : user.fidoKeys) keys->append({key.id, key.name, key.application, {}});
+    });
+    return true;
+}
+
+bool MemoryStorage::fidoCredentials(quint64 id, std::optional<QString> application, QList<QByteArray>* credentials) {
+    d->readUser(id, [&application, credentials](const MemoryUser& user) {
+        for (const auto& key : user.fidoKeys) {
+            if (!application || key.application == *application) credentials->append(key.data);
+        }
+    });
+    return true;
+}
+
+int MemoryStorage::fidoKeyCount(quint64 id, QString application) {
+    int count = 0;
+    d->readUser(id, [&application, &count](const MemoryUser& user) {
+        for (const auto& key : user.fidoKeys) {
+            if (key.application == application) count++;
+        }
+    });
+    return count;
+}
+
+bool MemoryStorage::insertFidoKey(quint64 id, QByteArray data, QString name, QString application) {
+    int keyId = MemoryStoragePrivate::permuteId(d->nextFidoSequence.fetchAndAddRelaxed(1), d->fidoIdKeys);
+    return d->writeUser(id, [&](MemoryUser& user) {
+        user.fidoKeys.append({keyId, name, application, data});
+    });
+}
+
+bool MemoryStorage::replaceFidoCredential(quint64 id, QByteArray oldCredential, QByteArray newCredential) {
+    d->writeUser(id, [&oldCredential, &newCredential](MemoryUser& user) {
+        for (auto& key : user.fidoKeys) {
+            if (key.data == oldCredential) key.data = newCredential;
+        }
+    });
+    return true;
+}
+
+Storage::Status MemoryStorage::deleteFidoKey(quint64 id, int keyId, StoredFidoKey* deletedKey) {
+    auto status = Status::NotFound;
+    d->writeUser(id, [&status, keyId, deletedKey](MemoryUser& user) {
+        for (auto key = user.fidoKeys.begin(); key != user.fidoKeys.end(); key++) {
+            if (key->id != keyId) continue;
+
+            *deletedKey = {key->id, key->name, key->application, {}};
+            user.fidoKeys.erase(key);
+            status = Status::Ok;
+            return;
+        }
+    });
+    return status;
+}
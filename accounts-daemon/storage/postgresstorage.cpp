@@ -0,0 +1,599 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "postgresstorage.h"
+
+#include "database.h"
+#include "logger.h"
+#include <QSqlQuery>
+#include <QTimer>
+#include <QtConcurrent>
+
+struct PostgresStoragePrivate {
+        Database* database;
+
+        // Set while the tokens table still has rows from before tokens were stored as digests
+        std::atomic<bool> legacyTokens = false;
+        static constexpr auto tokenMigrationBatchSize = 1000;
+        static constexpr auto tokenMigrationInterval = 100;
+
+        static bool hasLegacyTokens() {
+            QSqlQuery query(Database::database());
+            query.prepare("SELECT 1 FROM information_schema.columns WHERE table_name='tokens' AND column_name='token'");
+            return Database::execute(query) && query.next();
+        }
+
+        // Backup key digests from before they were keyed are keyed in place, since their codes aren't known
+        static bool rekeyBackupKeys() {
+            QSqlDatabase db = Database::database();
+            db.transaction();
+
+            QSqlQuery selectQuery(db);
+            selectQuery.prepare("SELECT userid, digest FROM otpbackup WHERE NOT keyed FOR UPDATE");
+            if (!Database::execute(selectQuery)) {
+                db.rollback();
+                return false;
+            }
+
+            QVariantList ids;
+            QVariantList digests;
+            QVariantList keyedDigests;
+            while (selectQuery.next()) {
+                auto digest = selectQuery.value("digest").toByteArray();
+                ids.append(selectQuery.value("userid"));
+                digests.append(digest);
+                keyedDigests.append(Storage::rekeyBackupKeyDigest(digest));
+            }
+            if (ids.isEmpty()) return db.commit();
+
+            QSqlQuery updateQuery(db);
+            updateQuery.prepare("UPDATE otpbackup SET digest=:keyedDigest, keyed=TRUE WHERE userid=:id AND digest=:digest");
+            updateQuery.bindValue(":keyedDigest", keyedDigests);
+            updateQuery.bindValue(":id", ids);
+            updateQuery.bindValue(":digest", digests);
+            if (!Database::executeBatch(updateQuery)) {
+                db.rollback();
+                return false;
+            }
+
+            Logger::log() << "Keyed " << ids.size() << " backup key digests\n";
+            return db.commit();
+        }
+
+        static StoredUser readUser(const QSqlQuery& query) {
+            return {
+                query.value("id").toULongLong(),
+                query.value("username").toString(),
+                query.value("password").toString(),
+                query.value("email").toString(),
+                query.value("locale").toString(),
+                query.value("verified").toBool()};
+        }
+};
+
+PostgresStorage::PostgresStorage(QObject* parent) :
+    Storage(parent) {
+    d = new PostgresStoragePrivate();
+    d->database = new Database(this);
+}
+
+PostgresStorage::~PostgresStorage() {
+    delete d;
+}
+
+bool PostgresStorage::init() {
+    if (!d->database->init()) return false;
+
+    if (!PostgresStoragePrivate::rekeyBackupKeys()) {
+        Logger::error() << "Could not key the stored backup key digests\n";
+        return false;
+    }
+
+    d->legacyTokens = PostgresStoragePrivate::hasLegacyTokens();
+    if (d->legacyTokens) {
+        Logger::log() << "Migrating login tokens to digests in the background\n";
+        QTimer::singleShot(0, this, &PostgresStorage::migrateTokens);
+    }
+    return true;
+}
+
+void PostgresStorage::migrateTokens() {
+    QtConcurrent::run([] {
+        // Digests are filled in a batch at a time; the raw token stays until every row has one so lookups never miss
+        auto& query = Database::statement("UPDATE tokens SET digest=sha256(convert_to(token, 'UTF8')) "
+                                          "WHERE token IN (SELECT token FROM tokens WHERE digest IS NULL LIMIT :batch)");
+        query.bindValue(":batch", PostgresStoragePrivate::tokenMigrationBatchSize);
+        auto migrated = Database::execute(query) ? query.numRowsAffected() : -1;
+
+        Storage::instance()->releaseConnection();
+        return migrated;
+    }).then(this, [this](int migrated) {
+        if (migrated != 0) {
+            // Try again later if the batch failed, otherwise carry on with the next one
+            QTimer::singleShot(migrated < 0 ? 5000 : PostgresStoragePrivate::tokenMigrationInterval, this, &PostgresStorage::migrateTokens);
+            return;
+        }
+
+        // Stop using the token column before it goes away
+        d->legacyTokens = false;
+
+        QSqlQuery query(Database::database());
+        query.prepare("ALTER TABLE tokens DROP COLUMN IF EXISTS token, ALTER COLUMN digest SET NOT NULL");
+        if (!Database::execute(query)) {
+            Logger::error() << "Could not finish migrating login tokens\n";
+            d->legacyTokens = PostgresStoragePrivate::hasLegacyTokens();
+            if (d->legacyTokens) QTimer::singleShot(5000, this, &PostgresStorage::migrateTokens);
+            return;
+        }
+
+        Logger::log() << "Finished migrating login tokens to digests\n";
+    });
+}
+
+void PostgresStorage::releaseConnection() {
+    d->database->checkin();
+}
+
+QVariantMap PostgresStorage::statistics() {
+    return {
+        {"statements", Database::statementStatistics()}
+    };
+}
+
+bool PostgresStorage::createUser(QString username, QString passwordHash, QString email, quint64* id) {
+    auto& query = Database::statement("INSERT INTO users(username, password, email) VALUES(:username, :password, :email) RETURNING id");
+    query.bindValue(":username", username);
+    query.bindValue(":password", passwordHash);
+    query.bindValue(":email", email);
+    if (!Database::execute(query) || !query.next()) return false;
+
+    *id = query.value(0).toULongLong();
+    return true;
+}
+
+std::optional<StoredUser> PostgresStorage::user(quint64 id) {
+    auto& query = Database::statement("SELECT id, username, password, email, locale, verified FROM users WHERE id=:id");
+    query.bindValue(":id", id);
+    if (!Database::execute(query) || !query.next()) return std::nullopt;
+
+    return PostgresStoragePrivate::readUser(query);
+}
+
+quint64 PostgresStorage::userIdByUsername(QString username) {
+    auto& query = Database::statement("SELECT id FROM users WHERE username=:username");
+    query.bindValue(":username", username);
+    if (!Database::execute(query) || !query.next()) return 0;
+
+    return query.value("id").toULongLong();
+}
+
+bool PostgresStorage::userIdsByUsernames(QStringList usernames, QHash<QString, quint64>* ids) {
+    auto& query = Database::statement("SELECT id, username FROM users WHERE username = ANY(CAST(:usernames AS TEXT[]))");
+    query.bindValue(":usernames", Database::arrayLiteral(usernames));
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        ids->insert(query.value("username").toString(), query.value("id").toULongLong());
+    }
+    return true;
+}
+
+bool PostgresStorage::accounts(QList<quint64> ids, QList<StoredAccount>* accounts) {
+    // Load the user and OTP rows together so hydrating an account costs a single round trip
+    auto& query = Database::statement("SELECT users.id, users.username, users.password, users.email, users.locale, users.verified, otp.otpkey, otp.enabled AS otpenabled FROM users LEFT JOIN otp ON otp.userid=users.id WHERE users.id = ANY(CAST(:ids AS BIGINT[]))");
+    query.bindValue(":ids", Database::arrayLiteral(ids));
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        accounts->append({
+            PostgresStoragePrivate::readUser(query),
+            {query.value("otpkey").toString(), query.value("otpenabled").toBool()}
+        });
+    }
+    return true;
+}
+
+bool PostgresStorage::userIdsAfter(quint64 afterId, uint limit, QList<quint64>* ids) {
+    auto& query = Database::statement("SELECT id FROM users WHERE id > :after ORDER BY id LIMIT :limit");
+    query.bindValue(":after", afterId);
+    query.bindValue(":limit", limit);
+    if (!Database::execute(query)) return false;
+
+    ids->reserve(query.size() > 0 ? query.size() : 0);
+    while (query.next()) {
+        ids->append(query.value(0).toULongLong());
+    }
+    return true;
+}
+
+bool PostgresStorage::forEachUserId(std::function<bool(quint64)> callback) {
+    // Forward only lets the driver hand rows over as they arrive instead of buffering the whole result.
+    // This one isn't kept in the statement registry because its result stays open while the callback runs.
+    QSqlQuery query(Database::database());
+    query.setForwardOnly(true);
+    query.prepare("SELECT id FROM users ORDER BY id");
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        if (!callback(query.value(0).toULongLong())) break;
+    }
+    return true;
+}
+
+bool PostgresStorage::setUsername(quint64 id, QString username) {
+    auto& query = Database::statement("UPDATE users SET username=:username WHERE id=:id");
+    query.bindValue(":username", username);
+    query.bindValue(":id", id);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::setEmail(quint64 id, QString email) {
+    auto& query = Database::statement("UPDATE users SET email=:email, verified=false WHERE id=:id");
+    query.bindValue(":email", email);
+    query.bindValue(":id", id);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::setVerified(quint64 id, bool verified) {
+    auto& query = Database::statement("UPDATE users SET verified=:verified WHERE id=:id");
+    query.bindValue(":verified", verified);
+    query.bindValue(":id", id);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::setPassword(quint64 id, QString passwordHash) {
+    auto& query = Database::statement("UPDATE users SET password=:password WHERE id=:id");
+    query.bindValue(":password", passwordHash);
+    query.bindValue(":id", id);
+    return Database::execute(query);
+}
+
+Storage::Status PostgresStorage::replacePassword(quint64 id, QString oldPasswordHash, QString passwordHash) {
+    // Leave the password alone if it was changed since the old hash was read
+    auto& query = Database::statement("UPDATE users SET password=:password WHERE id=:id AND password=:oldpassword");
+    query.bindValue(":password", passwordHash);
+    query.bindValue(":id", id);
+    query.bindValue(":oldpassword", oldPasswordHash);
+    if (!Database::execute(query)) return Status::Failed;
+    return query.numRowsAffected() == 0 ? Status::NotFound : Status::Ok;
+}
+
+bool PostgresStorage::setVerification(quint64 id, QString code, qint64 expiry) {
+    auto& query = Database::statement("INSERT INTO verifications(userid, verificationstring, expiry) VALUES(:id, :code, :expiry) ON CONFLICT ON CONSTRAINT pk_verifications DO UPDATE SET verificationstring=:code, expiry=:expiry");
+    query.bindValue(":id", id);
+    query.bindValue(":code", code);
+    query.bindValue(":expiry", expiry);
+    return Database::execute(query);
+}
+
+Storage::Status PostgresStorage::consumeVerification(quint64 id, QString code, qint64 now) {
+    QSqlDatabase db = Database::database();
+    db.transaction();
+
+    auto& query = Database::statement("DELETE FROM verifications WHERE userid=:id AND verificationstring=:code AND expiry > :now");
+    query.bindValue(":id", id);
+    query.bindValue(":code", code);
+    query.bindValue(":now", now);
+    if (!Database::execute(query)) {
+        db.rollback();
+        return Status::Failed;
+    }
+
+    if (query.numRowsAffected() == 0) {
+        db.rollback();
+        return Status::NotFound;
+    }
+
+    auto& updateUserQuery = Database::statement("UPDATE users SET verified=:verified WHERE id=:id");
+    updateUserQuery.bindValue(":verified", true);
+    updateUserQuery.bindValue(":id", id);
+    if (!Database::execute(updateUserQuery)) {
+        db.rollback();
+        return Status::Failed;
+    }
+
+    if (!db.commit()) return Status::Failed;
+    return Status::Ok;
+}
+
+std::optional<StoredPasswordReset> PostgresStorage::passwordReset(quint64 id) {
+    auto& query = Database::statement("SELECT temporarypassword, expiry FROM passwordresets WHERE userid=:id");
+    query.bindValue(":id", id);
+    if (!Database::execute(query) || !query.next()) return std::nullopt;
+
+    return StoredPasswordReset{query.value("temporarypassword").toString(), query.value("expiry").toLongLong()};
+}
+
+bool PostgresStorage::setPasswordReset(quint64 id, QString temporaryPasswordHash, qint64 expiry) {
+    auto& query = Database::statement("INSERT INTO passwordResets(userId, temporaryPassword, expiry) VALUES(:id, :password, :expiry) ON CONFLICT ON CONSTRAINT pk_passwordresets DO UPDATE SET temporaryPassword=:password, expiry=:expiry");
+    query.bindValue(":id", id);
+    query.bindValue(":password", temporaryPasswordHash);
+    query.bindValue(":expiry", expiry);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::deletePasswordReset(quint64 id) {
+    auto& query = Database::statement("DELETE FROM passwordresets WHERE userid=:id");
+    query.bindValue(":id", id);
+    return Database::execute(query);
+}
+
+std::optional<StoredOtp> PostgresStorage::otp(quint64 id, bool* ok) {
+    auto& query = Database::statement("SELECT otpkey, enabled FROM otp WHERE userid=:id");
+    query.bindValue(":id", id);
+    auto success = Database::execute(query);
+    if (ok) *ok = success;
+    if (!success || !query.next()) return std::nullopt;
+
+    return StoredOtp{query.value("otpkey").toString(), query.value("enabled").toBool()};
+}
+
+bool PostgresStorage::setOtpKey(quint64 id, QString key) {
+    auto& query = Database::statement("INSERT INTO otp(userid, otpkey, enabled) VALUES(:id, :otpkey, :enabled) ON CONFLICT ON CONSTRAINT otp_pkey DO UPDATE SET otpkey=:otpkey, enabled=:enabled WHERE otp.userid=:id");
+    query.bindValue(":id", id);
+    query.bindValue(":otpkey", key);
+    query.bindValue(":enabled", false);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::setOtpEnabled(quint64 id, bool enabled) {
+    auto& query = Database::statement("UPDATE otp SET enabled=:enabled WHERE otp.userid=:id");
+    query.bindValue(":id", id);
+    query.bindValue(":enabled", enabled);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::backupKeys(quint64 id, QList<StoredBackupKey>* keys) {
+    auto& query = Database::statement("SELECT digest, used FROM otpbackup WHERE userid=:id");
+    query.bindValue(":id", id);
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        keys->append({query.value("digest").toByteArray(), query.value("used").toBool()});
+    }
+    return true;
+}
+
+bool PostgresStorage::replaceBackupKeys(quint64 id, QList<StoredBackupKey> keys) {
+    QSqlDatabase db = Database::database();
+    db.transaction();
+
+    auto& deleteQuery = Database::statement("DELETE FROM otpbackup WHERE userid=:id");
+    deleteQuery.bindValue(":id", id);
+    if (!Database::execute(deleteQuery)) {
+        db.rollback();
+        return false;
+    }
+
+    QVariantList ids;
+    QVariantList digests;
+    QVariantList used;
+    for (const auto& key : keys) {
+        ids.append(id);
+        digests.append(key.digest);
+        used.append(key.used);
+    }
+
+    auto& query = Database::statement("INSERT INTO otpbackup(userid, digest, used) VALUES(:id, :digest, :used)");
+    query.bindValue(":id", ids);
+    query.bindValue(":digest", digests);
+    query.bindValue(":used", used);
+    if (!Database::executeBatch(query)) {
+        db.rollback();
+        return false;
+    }
+
+    return db.commit();
+}
+
+Storage::Status PostgresStorage::loginState(QString username, StoredLoginState* state) {
+    // One round trip for the user, any pending password reset and their OTP settings
+    auto& query = Database::statement("SELECT users.id, users.username, users.password, users.email, users.locale, users.verified, "
+                                      "passwordresets.temporarypassword, passwordresets.expiry AS resetexpiry, otp.otpkey, otp.enabled AS otpenabled "
+                                      "FROM users LEFT JOIN passwordresets ON passwordresets.userid=users.id LEFT JOIN otp ON otp.userid=users.id "
+                                      "WHERE users.username=:username");
+    query.bindValue(":username", username);
+    if (!Database::execute(query)) return Status::Failed;
+    if (!query.next()) return Status::NotFound;
+
+    state->user = PostgresStoragePrivate::readUser(query);
+    if (!query.isNull("temporarypassword")) {
+        state->passwordReset = StoredPasswordReset{query.value("temporarypassword").toString(), query.value("resetexpiry").toLongLong()};
+    }
+    if (!query.isNull("otpkey")) {
+        state->otp = StoredOtp{query.value("otpkey").toString(), query.value("otpenabled").toBool()};
+    }
+    return Status::Ok;
+}
+
+Storage::Status PostgresStorage::issueToken(quint64 id, QByteArray tokenDigest, QString application, qint64 now, qint64 expiry, QByteArray backupKeyDigest) {
+    // The backup key is consumed in the same statement through the (userid, digest) key, so two logins can't both use it
+    auto& query = Database::statement("WITH consumed AS (UPDATE otpbackup SET used=true WHERE userid=:id AND digest=:digest AND NOT used RETURNING userid) "
+                                      "INSERT INTO tokens(userid, digest, application, last_used, expires_at) "
+                                      "SELECT CAST(:id AS INTEGER), CAST(:tokendigest AS BYTEA), CAST(:application AS TEXT), CAST(:now AS BIGINT), CAST(:expiry AS BIGINT) "
+                                      "WHERE NOT CAST(:consume AS BOOLEAN) OR EXISTS(SELECT 1 FROM consumed)");
+    query.bindValue(":id", id);
+    query.bindValue(":digest", backupKeyDigest);
+    query.bindValue(":tokendigest", tokenDigest);
+    query.bindValue(":application", application);
+    query.bindValue(":now", now);
+    query.bindValue(":expiry", expiry);
+    query.bindValue(":consume", !backupKeyDigest.isEmpty());
+    if (!Database::execute(query)) return Status::Failed;
+    if (query.numRowsAffected() == 0) return Status::NotFound;
+    return Status::Ok;
+}
+
+bool PostgresStorage::insertToken(quint64 id, QByteArray tokenDigest, QString application, qint64 now, qint64 expiry) {
+    auto& query = Database::statement("INSERT INTO tokens(userid, digest, application, last_used, expires_at) VALUES(:id, :digest, :application, :now, :expiry)");
+    query.bindValue(":id", id);
+    query.bindValue(":digest", tokenDigest);
+    query.bindValue(":application", application);
+    query.bindValue(":now", now);
+    query.bindValue(":expiry", expiry);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::tokenUsers(QList<QByteArray> tokenDigests, qint64 now, QHash<QByteArray, quint64>* users) {
+    auto& query = Database::statement("SELECT digest, userid FROM tokens WHERE digest = ANY(CAST(:digests AS BYTEA[])) AND expires_at > :now");
+    query.bindValue(":digests", Database::arrayLiteral(tokenDigests));
+    query.bindValue(":now", now);
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        users->insert(query.value("digest").toByteArray(), query.value("userid").toULongLong());
+    }
+    return true;
+}
+
+bool PostgresStorage::touchTokens(QList<QByteArray> tokenDigests, qint64 now, qint64 expiry) {
+    // Rows used recently are left alone so that busy tokens don't cause a write on every lookup
+    auto& query = Database::statement("UPDATE tokens SET last_used=:now, expires_at=GREATEST(expires_at, :expiry) "
+                                      "WHERE digest = ANY(CAST(:digests AS BYTEA[])) AND last_used < :stale");
+    query.bindValue(":now", now);
+    query.bindValue(":expiry", expiry);
+    query.bindValue(":digests", Database::arrayLiteral(tokenDigests));
+    query.bindValue(":stale", now - tokenTouchInterval);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::trimTokens(quint64 id, int maximum, QList<QByteArray>* trimmed) {
+    // Keep the most recently used tokens
+    auto& query = Database::statement("DELETE FROM tokens WHERE ctid = ANY(ARRAY("
+                                      "SELECT ctid FROM tokens WHERE userid=:id ORDER BY last_used DESC OFFSET :maximum)) "
+                                      "RETURNING digest");
+    query.bindValue(":id", id);
+    query.bindValue(":maximum", maximum);
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        trimmed->append(query.value("digest").toByteArray());
+    }
+    return true;
+}
+
+bool PostgresStorage::deleteToken(QByteArray tokenDigest) {
+    auto& query = Database::statement("DELETE FROM tokens WHERE digest=:digest");
+    query.bindValue(":digest", tokenDigest);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::legacyTokenUsers(QStringList tokens, QHash<QString, quint64>* users) {
+    if (!d->legacyTokens) return true;
+
+    // Rows keep their raw token until the migration is done, so this also finds rows migrated since the digest lookup
+    auto& query = Database::statement("SELECT token, userid FROM tokens WHERE token = ANY(CAST(:tokens AS TEXT[]))");
+    query.bindValue(":tokens", Database::arrayLiteral(tokens));
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        users->insert(query.value("token").toString(), query.value("userid").toULongLong());
+    }
+    return true;
+}
+
+bool PostgresStorage::deleteLegacyToken(QString token) {
+    if (!d->legacyTokens) return true;
+
+    auto& query = Database::statement("DELETE FROM tokens WHERE token=:token");
+    query.bindValue(":token", token);
+    return Database::execute(query);
+}
+
+int PostgresStorage::purgeExpired(ExpiringTable table, qint64 now, int limit) {
+    // Delete a limited number of rows at a time so that no statement holds its locks for long
+    QSqlQuery* query = nullptr;
+    switch (table) {
+        case ExpiringTable::Tokens:
+            query = &Database::statement("DELETE FROM tokens WHERE ctid = ANY(ARRAY(SELECT ctid FROM tokens WHERE expires_at <= :now LIMIT :limit))");
+            break;
+        case ExpiringTable::Verifications:
+            query = &Database::statement("DELETE FROM verifications WHERE ctid = ANY(ARRAY(SELECT ctid FROM verifications WHERE expiry <= :now LIMIT :limit))");
+            break;
+        case ExpiringTable::PasswordResets:
+            query = &Database::statement("DELETE FROM passwordresets WHERE ctid = ANY(ARRAY(SELECT ctid FROM passwordresets WHERE expiry <= :now LIMIT :limit))");
+            break;
+    }
+
+    query->bindValue(":now", now);
+    query->bindValue(":limit", limit);
+    if (!Database::execute(*query)) return -1;
+    return query->numRowsAffected();
+}
+
+bool PostgresStorage::fidoKeys(quint64 id, QList<StoredFidoKey>* keys) {
+    auto& query = Database::statement("SELECT id, name, application FROM fido WHERE userid=:userid");
+    query.bindValue(":userid", id);
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        keys->append({query.value("id").toInt(), query.value("name").toString(), query.value("application").toString(), {}});
+    }
+    return true;
+}
+
+bool PostgresStorage::fidoCredentials(quint64 id, std::optional<QString> application, QList<QByteArray>* credentials) {
+    auto& query = application ? Database::statement("SELECT data FROM fido WHERE userid=:userid AND application=:application")
+                              : Database::statement("SELECT data FROM fido WHERE userid=:userid");
+    if (application) query.bindValue(":application", *application);
+    query.bindValue(":userid", id);
+    if (!Database::execute(query)) return false;
+
+    while (query.next()) {
+        credentials->append(query.value("data").toByteArray());
+    }
+    return true;
+}
+
+int PostgresStorage::fidoKeyCount(quint64 id, QString application) {
+    auto& query = Database::statement("SELECT COUNT(*) FROM fido WHERE application=:application AND userid=:userid");
+    query.bindValue(":application", application);
+    query.bindValue(":userid", id);
+    if (!Database::execute(query) || !query.next()) return -1;
+
+    return query.value(0).toInt();
+}
+
+bool PostgresStorage::insertFidoKey(quint64 id, QByteArray data, QString name, QString application) {
+    auto& query = Database::statement("INSERT INTO fido(userid, data, name, application) VALUES(:userid, :data, :name, :application)");
+    query.bindValue(":userid", id);
+    query.bindValue(":data", data);
+    query.bindValue(":name", name);
+    query.bindValue(":application", application);
+    return Database::execute(query);
+}
+
+bool PostgresStorage::replaceFidoCredential(quint64 id, QByteArray oldCredential, QByteArray newCredential) {
+    auto& query = Database::statement("UPDATE fido SET data=:newCred WHERE data=:oldCred AND userid=:id");
+    query.bindValue(":newCred", newCredential);
+    query.bindValue(":oldCred", oldCredential);
+    query.bindValue(":id", id);
+    return Database::execute(query);
+}
+
+Storage::Status PostgresStorage::deleteFidoKey(quint64 id, int keyId, StoredFidoKey* deletedKey) {
+    auto& query = Database::statement("DELETE FROM fido WHERE userid=:userid AND id=:id RETURNING name, application");
+    query.bindValue(":userid", id);
+    query.bindValue(":id", keyId);
+    if (!Database::execute(query)) return Status::Failed;
+    if (!query.next()) return Status::NotFound;
+
+    *deletedKey = {keyId, query.value("name").toString(), query.value("application").toString(), {}};
+    return Status::Ok;
+}
@@ -0,0 +1,88 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef POSTGRESSTORAGE_H
+#define POSTGRESSTORAGE_H
+
+#include "storage.h"
+
+struct PostgresStoragePrivate;
+class PostgresStorage : public Storage {
+        Q_OBJECT
+    public:
+        explicit PostgresStorage(QObject* parent = nullptr);
+        ~PostgresStorage() override;
+
+        bool init() override;
+        QVariantMap statistics() override;
+        void releaseConnection() override;
+
+        bool createUser(QString username, QString passwordHash, QString email, quint64* id) override;
+        std::optional<StoredUser> user(quint64 id) override;
+        quint64 userIdByUsername(QString username) override;
+        bool userIdsByUsernames(QStringList usernames, QHash<QString, quint64>* ids) override;
+        bool accounts(QList<quint64> ids, QList<StoredAccount>* accounts) override;
+        bool userIdsAfter(quint64 afterId, uint limit, QList<quint64>* ids) override;
+        bool forEachUserId(std::function<bool(quint64)> callback) override;
+        bool setUsername(quint64 id, QString username) override;
+        bool setEmail(quint64 id, QString email) override;
+        bool setVerified(quint64 id, bool verified) override;
+        bool setPassword(quint64 id, QString passwordHash) override;
+        Status replacePassword(quint64 id, QString oldPasswordHash, QString passwordHash) override;
+
+        bool setVerification(quint64 id, QString code, qint64 expiry) override;
+        Status consumeVerification(quint64 id, QString code, qint64 now) override;
+
+        std::optional<StoredPasswordReset> passwordReset(quint64 id) override;
+        bool setPasswordReset(quint64 id, QString temporaryPasswordHash, qint64 expiry) override;
+        bool deletePasswordReset(quint64 id) override;
+
+        std::optional<StoredOtp> otp(quint64 id, bool* ok = nullptr) override;
+        bool setOtpKey(quint64 id, QString key) override;
+        bool setOtpEnabled(quint64 id, bool enabled) override;
+        bool backupKeys(quint64 id, QList<StoredBackupKey>* keys) override;
+        bool replaceBackupKeys(quint64 id, QList<StoredBackupKey> keys) override;
+
+        Status loginState(QString username, StoredLoginState* state) override;
+        Status issueToken(quint64 id, QByteArray tokenDigest, QString application, qint64 now, qint64 expiry, QByteArray backupKeyDigest = {}) override;
+
+        bool insertToken(quint64 id, QByteArray tokenDigest, QString application, qint64 now, qint64 expiry) override;
+        bool tokenUsers(QList<QByteArray> tokenDigests, qint64 now, QHash<QByteArray, quint64>* users) override;
+        bool touchTokens(QList<QByteArray> tokenDigests, qint64 now, qint64 expiry) override;
+        bool trimTokens(quint64 id, int maximum, QList<QByteArray>* trimmed) override;
+        bool deleteToken(QByteArray tokenDigest) override;
+        bool legacyTokenUsers(QStringList tokens, QHash<QString, quint64>* users) override;
+        bool deleteLegacyToken(QString token) override;
+
+        int purgeExpired(ExpiringTable table, qint64 now, int limit) override;
+
+        bool fidoKeys(quint64 id, QList<StoredFidoKey>* keys) override;
+        bool fidoCredentials(quint64 id, std::optional<QString> application, QList<QByteArray>* credentials) override;
+        int fidoKeyCount(quint64 id, QString application) override;
+        bool insertFidoKey(quint64 id, QByteArray data, QString name, QString application) override;
+        bool replaceFidoCredential(quint64 id, QByteArray oldCredential, QByteArray newCredential) override;
+        Status deleteFidoKey(quint64 id, int keyId, StoredFidoKey* deletedKey) override;
+
+    private:
+        PostgresStoragePrivate* d;
+
+        void migrateTokens();
+};
+
+#endif // POSTGRESSTORAGE_H
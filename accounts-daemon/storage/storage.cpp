@@ -0,0 +1,79 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "storage.h"
+
+#include "configuration.h"
+#include "memorystorage.h"
+#include "postgresstorage.h"
+#include <QCryptographicHash>
+#include <QMessageAuthenticationCode>
+
+Storage* Storage::storageInstance = nullptr;
+
+Storage::Storage(QObject* parent) :
+    QObject(parent) {
+    storageInstance = this;
+}
+
+Storage::~Storage() {
+    if (storageInstance == this) storageInstance = nullptr;
+}
+
+Storage* Storage::instance() {
+    return storageInstance;
+}
+
+QVariantMap Storage::statistics() {
+    return {};
+}
+
+void Storage::releaseConnection() {
+}
+
+QByteArray Storage::backupKeyDigest(quint64 id, const QString& key) {
+    // Prefixing the user id keeps the same code from having the same digest for two users
+    return rekeyBackupKeyDigest(QCryptographicHash::hash(QStringLiteral("%1:%2").arg(id).arg(key).toUtf8(), QCryptographicHash::Sha256));
+}
+
+QByteArray Storage::rekeyBackupKeyDigest(const QByteArray& unkeyedDigest) {
+    // Backup keys are short enough to search exhaustively, so without the secret a copy of the database is no use for that
+    return QMessageAuthenticationCode::hash(unkeyedDigest, Configuration::current()->backupKeySecret, QCryptographicHash::Sha256);
+}
+
+QByteArray Storage::tokenDigest(const QString& token) {
+    return QCryptographicHash::hash(token.toUtf8(), QCryptographicHash::Sha256);
+}
+
+bool Storage::legacyTokenUsers(QStringList tokens, QHash<QString, quint64>* users) {
+    Q_UNUSED(tokens)
+    Q_UNUSED(users)
+    return true;
+}
+
+bool Storage::deleteLegacyToken(QString token) {
+    Q_UNUSED(token)
+    return true;
+}
+
+Storage* Storage::create(QString driver) {
+    // Anything other than the in-memory engine is handed to Qt SQL as a driver name
+    if (driver == "memory") return new MemoryStorage();
+    return new PostgresStorage();
+}
@@ -0,0 +1,170 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <QHash>
+#include <QObject>
+#include <functional>
+#include <optional>
+
+struct StoredUser {
+        quint64 id = 0;
+        QString username;
+        QString password;
+        QString email;
+        QString locale;
+        bool verified = false;
+};
+
+struct StoredOtp {
+        QString key;
+        bool enabled = false;
+};
+
+struct StoredAccount {
+        StoredUser user;
+        StoredOtp otp;
+};
+
+// Backup keys are only stored as digests; see Storage::backupKeyDigest
+struct StoredBackupKey {
+        QByteArray digest;
+        bool used = false;
+};
+
+struct StoredPasswordReset {
+        QString temporaryPassword;
+        qint64 expiry = 0;
+};
+
+// Everything a password login needs to know about a user
+struct StoredLoginState {
+        StoredUser user;
+        std::optional<StoredPasswordReset> passwordReset;
+        std::optional<StoredOtp> otp;
+};
+
+struct StoredFidoKey {
+        int id = 0;
+        QString name;
+        QString application;
+        QByteArray data;
+};
+
+// Everything the daemon persists goes through this interface, so the SQL in the PostgreSQL
+// implementation is the only place that knows about tables. Implementations must be safe to
+// call from any thread.
+class Storage : public QObject {
+        Q_OBJECT
+    public:
+        enum class Status {
+            Ok,
+            NotFound,
+            Failed
+        };
+
+        // Tables whose rows stop being useful after their expiry
+        enum class ExpiringTable {
+            Tokens,
+            Verifications,
+            PasswordResets
+        };
+
+        // A token's last use is only written again once it is at least this old
+        static constexpr qint64 tokenTouchInterval = 60 * 60 * 1000;
+
+        explicit Storage(QObject* parent = nullptr);
+        ~Storage() override;
+
+        static Storage* instance();
+        static Storage* create(QString driver);
+
+        static QByteArray backupKeyDigest(quint64 id, const QString& key);
+        static QByteArray rekeyBackupKeyDigest(const QByteArray& unkeyedDigest);
+        static QByteArray tokenDigest(const QString& token);
+
+        virtual bool init() = 0;
+        virtual QVariantMap statistics();
+
+        // Background tasks call this when they finish so that their thread doesn't keep holding on to a connection
+        virtual void releaseConnection();
+
+        // Users
+        virtual bool createUser(QString username, QString passwordHash, QString email, quint64* id) = 0;
+        virtual std::optional<StoredUser> user(quint64 id) = 0;
+        virtual quint64 userIdByUsername(QString username) = 0;
+        virtual bool userIdsByUsernames(QStringList usernames, QHash<QString, quint64>* ids) = 0;
+        virtual bool accounts(QList<quint64> ids, QList<StoredAccount>* accounts) = 0;
+        virtual bool userIdsAfter(quint64 afterId, uint limit, QList<quint64>* ids) = 0;
+        virtual bool forEachUserId(std::function<bool(quint64)> callback) = 0;
+        virtual bool setUsername(quint64 id, QString username) = 0;
+        virtual bool setEmail(quint64 id, QString email) = 0;
+        virtual bool setVerified(quint64 id, bool verified) = 0;
+        virtual bool setPassword(quint64 id, QString passwordHash) = 0;
+        virtual Status replacePassword(quint64 id, QString oldPasswordHash, QString passwordHash) = 0;
+
+        // Email verification
+        virtual bool setVerification(quint64 id, QString code, qint64 expiry) = 0;
+        virtual Status consumeVerification(quint64 id, QString code, qint64 now) = 0;
+
+        // Password resets
+        virtual std::optional<StoredPasswordReset> passwordReset(quint64 id) = 0;
+        virtual bool setPasswordReset(quint64 id, QString temporaryPasswordHash, qint64 expiry) = 0;
+        virtual bool deletePasswordReset(quint64 id) = 0;
+
+        // Two factor authentication
+        virtual std::optional<StoredOtp> otp(quint64 id, bool* ok = nullptr) = 0;
+        virtual bool setOtpKey(quint64 id, QString key) = 0;
+        virtual bool setOtpEnabled(quint64 id, bool enabled) = 0;
+        virtual bool backupKeys(quint64 id, QList<StoredBackupKey>* keys) = 0;
+        virtual bool replaceBackupKeys(quint64 id, QList<StoredBackupKey> keys) = 0;
+
+        // Logins
+        virtual Status loginState(QString username, StoredLoginState* state) = 0;
+        virtual Status issueToken(quint64 id, QByteArray tokenDigest, QString application, qint64 now, qint64 expiry, QByteArray backupKeyDigest = {}) = 0;
+
+        // Login tokens, stored and looked up by their digest; see Storage::tokenDigest
+        virtual bool insertToken(quint64 id, QByteArray tokenDigest, QString application, qint64 now, qint64 expiry) = 0;
+        virtual bool tokenUsers(QList<QByteArray> tokenDigests, qint64 now, QHash<QByteArray, quint64>* users) = 0;
+        virtual bool touchTokens(QList<QByteArray> tokenDigests, qint64 now, qint64 expiry) = 0;
+        virtual bool trimTokens(quint64 id, int maximum, QList<QByteArray>* trimmed) = 0;
+        virtual bool deleteToken(QByteArray tokenDigest) = 0;
+
+        // Login tokens stored before digests were, which only exist while they are being migrated
+        virtual bool legacyTokenUsers(QStringList tokens, QHash<QString, quint64>* users);
+        virtual bool deleteLegacyToken(QString token);
+
+        // Housekeeping; returns the number of rows removed, or -1 on failure
+        virtual int purgeExpired(ExpiringTable table, qint64 now, int limit) = 0;
+
+        // FIDO keys
+        virtual bool fidoKeys(quint64 id, QList<StoredFidoKey>* keys) = 0;
+        virtual bool fidoCredentials(quint64 id, std::optional<QString> application, QList<QByteArray>* credentials) = 0;
+        virtual int fidoKeyCount(quint64 id, QString application) = 0;
+        virtual bool insertFidoKey(quint64 id, QByteArray data, QString name, QString application) = 0;
+        virtual bool replaceFidoCredential(quint64 id, QByteArray oldCredential, QByteArray newCredential) = 0;
+        virtual Status deleteFidoKey(quint64 id, int keyId, StoredFidoKey* deletedKey) = 0;
+
+    private:
+        static Storage* storageInstance;
+};
+
+#endif // STORAGE_H
@@ -0,0 +1,185 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "admissioncontrol.h"
+
+#include "configuration.h"
+#include <QDBusMessage>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QTimer>
+
+namespace {
+    struct TokenBucket {
+            double tokens;
+            qint64 updated;
+    };
+
+    struct BucketPolicy {
+            double rate = 0;
+            double burst = 0;
+
+            bool enabled() const {
+                return rate > 0 && burst > 0;
+            }
+    };
+
+    // A bucket that has refilled completely behaves the same as one that doesn't exist yet, so
+    // these are dropped now and then to keep a flood of distinct usernames from piling up
+    constexpr int bucketSweepInterval = 60000;
+} // namespace
+
+struct AdmissionControlPrivate {
+        mutable QMutex mutex;
+        QElapsedTimer clock;
+        QTimer sweepTimer;
+
+        int maxPending;
+        BucketPolicy senderPolicy;
+        BucketPolicy usernamePolicy;
+
+        QHash<QString, TokenBucket> senderBuckets;
+        QHash<QString, TokenBucket> usernameBuckets;
+        int pending = 0;
+
+        quint64 admitted = 0;
+        quint64 busy = 0;
+        quint64 senderRateLimited = 0;
+        quint64 usernameRateLimited = 0;
+        int peakPending = 0;
+
+        // Takes a token from the bucket for this key, creating a full one if there isn't one yet
+        bool take(QHash<QString, TokenBucket>& buckets, const BucketPolicy& policy, const QString& key, qint64 now) {
+            if (!policy.enabled()) return true;
+
+            auto bucket = buckets.find(key);
+            if (bucket == buckets.end()) bucket = buckets.insert(key, {policy.burst, now});
+
+            bucket->tokens = qMin(policy.burst, bucket->tokens + (now - bucket->updated) * policy.rate / 1000);
+            bucket->updated = now;
+            if (bucket->tokens < 1) return false;
+
+            bucket->tokens -= 1;
+            return true;
+        }
+
+        static void sweep(QHash<QString, TokenBucket>& buckets, const BucketPolicy& policy, qint64 now) {
+            if (!policy.enabled()) {
+                buckets.clear();
+                return;
+            }
+
+            buckets.removeIf([&policy, now](const QHash<QString, TokenBucket>::iterator& bucket) {
+                return bucket->tokens + (now - bucket->updated) * policy.rate / 1000 >= policy.burst;
+            });
+        }
+};
+
+struct AdmissionControl::Ticket::Slot {
+        ~Slot() {
+            auto* d = AdmissionControl::instance()->d;
+            QMutexLocker locker(&d->mutex);
+            d->pending--;
+        }
+};
+
+AdmissionControl::AdmissionControl(QObject* parent) :
+    QObject(parent), d(new AdmissionControlPrivate) {
+    d->clock.start();
+    applyConfiguration();
+    connect(Configuration::instance(), &Configuration::reloaded, this, &AdmissionControl::applyConfiguration);
+
+    d->sweepTimer.setInterval(bucketSweepInterval);
+    connect(&d->sweepTimer, &QTimer::timeout, this, &AdmissionControl::sweep);
+    d->sweepTimer.start();
+}
+
+AdmissionControl::~AdmissionControl() {
+    delete d;
+}
+
+AdmissionControl* AdmissionControl::instance() {
+    static auto* instance = new AdmissionControl();
+    return instance;
+}
+
+AdmissionControl::Ticket::Ticket(const QDBusMessage& message, const QString& username) {
+    auto* d = AdmissionControl::instance()->d;
+    QMutexLocker locker(&d->mutex);
+
+    // Check the cheap, global limit first so that being busy doesn't use up anyone's allowance
+    if (d->maxPending > 0 && d->pending >= d->maxPending) {
+        d->busy++;
+        rejection = Utils::Busy;
+        return;
+    }
+
+    auto now = d->clock.elapsed();
+    if (!d->take(d->senderBuckets, d->senderPolicy, message.service(), now)) {
+        d->senderRateLimited++;
+        rejection = Utils::RateLimited;
+        return;
+    }
+    if (!d->take(d->usernameBuckets, d->usernamePolicy, username.toLower(), now)) {
+        d->usernameRateLimited++;
+        rejection = Utils::RateLimited;
+        return;
+    }
+
+    d->admitted++;
+    d->pending++;
+    d->peakPending = qMax(d->peakPending, d->pending);
+    slot = QSharedPointer<Slot>::create();
+}
+
+Utils::DBusError AdmissionControl::Ticket::error() const {
+    return rejection;
+}
+
+QVariantMap AdmissionControl::statistics() const {
+    QMutexLocker locker(&d->mutex);
+    return {
+        {"admitted",            d->admitted                                  },
+        {"busy",                d->busy                                      },
+        {"senderRateLimited",   d->senderRateLimited                         },
+        {"usernameRateLimited", d->usernameRateLimited                       },
+        {"pending",             d->pending                                   },
+        {"peakPending",         d->peakPending                               },
+        {"maxPending",          d->maxPending                                },
+        {"senderBuckets",       static_cast<qint64>(d->senderBuckets.size()) },
+        {"usernameBuckets",     static_cast<qint64>(d->usernameBuckets.size())}
+    };
+}
+
+void AdmissionControl::sweep() {
+    QMutexLocker locker(&d->mutex);
+    auto now = d->clock.elapsed();
+    AdmissionControlPrivate::sweep(d->senderBuckets, d->senderPolicy, now);
+    AdmissionControlPrivate::sweep(d->usernameBuckets, d->usernamePolicy, now);
+}
+
+void AdmissionControl::applyConfiguration() {
+    auto configuration = Configuration::current();
+
+    QMutexLocker locker(&d->mutex);
+    d->maxPending = configuration->admissionMaxPending;
+    d->senderPolicy = {configuration->admissionSenderRate, configuration->admissionSenderBurst};
+    d->usernamePolicy = {configuration->admissionUsernameRate, configuration->admissionUsernameBurst};
+}
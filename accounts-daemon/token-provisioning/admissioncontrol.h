@@ -0,0 +1,62 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef ADMISSIONCONTROL_H
+#define ADMISSIONCONTROL_H
+
+#include "utils.h"
+
+#include <QObject>
+#include <QSharedPointer>
+
+// Sheds password logins before they reach the hashing pool. Each D-Bus sender and each username
+// draws from its own token bucket, and only a bounded number of logins may be in progress at once.
+struct AdmissionControlPrivate;
+class AdmissionControl : public QObject {
+        Q_OBJECT
+    public:
+        ~AdmissionControl() override;
+
+        static AdmissionControl* instance();
+
+        // Holds one in-progress slot from the time it is admitted. Copies share the slot, which is
+        // given back when the last copy goes away, so a call that replies later should capture it.
+        class Ticket {
+            public:
+                Ticket(const QDBusMessage& message, const QString& username);
+
+                [[nodiscard]] Utils::DBusError error() const;
+
+            private:
+                struct Slot;
+                QSharedPointer<Slot> slot;
+                Utils::DBusError rejection = Utils::NoError;
+        };
+
+        [[nodiscard]] QVariantMap statistics() const;
+
+    private:
+        AdmissionControlPrivate* d;
+
+        explicit AdmissionControl(QObject* parent = nullptr);
+        void applyConfiguration();
+        void sweep();
+};
+
+#endif // ADMISSIONCONTROL_H
@@ -12,7 +12,7 @@ class FidoProvisioningMethod : public TokenProvisioningMethod {
         explicit FidoProvisioningMethod(AccountManager* parent);
 
         [[nodiscard]] QString tokenProvisioningMethod() const override;
-        [[nodiscard]] ProvisionResult provision(QVariantMap options, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const override;
+        [[nodiscard]] QFuture<ProvisionResult> provision(QVariantMap options, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const override;
         [[nodiscard]] bool available(quint64 userId, QString application, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const override;
 };
 
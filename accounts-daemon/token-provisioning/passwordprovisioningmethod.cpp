@@ -8,9 +8,11 @@
 #include "dbus/twofactor.h"
 #include "dbus/user.h"
 #include "dbus/useraccount.h"
+#include "storage/storage.h"
+#include "validation.h"
 
 #include <QDateTime>
-#include <QSqlQuery>
+#include <QtConcurrent>
 
 struct PasswordProvisioningMethodPrivate {
 };
@@ -23,132 +25,132 @@ QString PasswordProvisioningMethod::tokenProvisioningMethod() const {
     return QStringLiteral("password");
 }
 
-TokenProvisioningMethod::ProvisionResult PasswordProvisioningMethod::provision(QVariantMap options, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const {
+QFuture<TokenProvisioningMethod::ProvisionResult> PasswordProvisioningMethod::provision(QVariantMap options, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const {
     const auto username = options.value("username").toString();
-    auto password = options.value("password").toString();
+    const auto password = options.value("password").toString();
 
     if (username.isEmpty() || password.isEmpty()) {
-        return {0, Utils::InvalidInput};
+        return QtFuture::makeReadyFuture(ProvisionResult{0, Utils::InvalidInput});
     }
 
-    const auto id = accountManager()->userIdByUsername(username);
-    if (id == 0) {
-        return {0, Utils::NoAccount};
+    // Everything needed to decide on this login comes back in one round trip; the token is issued in a second
+    StoredLoginState state;
+    switch (Storage::instance()->loginState(username, &state)) {
+        case Storage::Status::Ok:
+            break;
+        case Storage::Status::NotFound:
+            return QtFuture::makeReadyFuture(ProvisionResult{0, Utils::NoAccount});
+        case Storage::Status::Failed:
+            return QtFuture::makeReadyFuture(ProvisionResult{0, Utils::QueryError});
     }
-
-    QSqlQuery userQuery;
-    userQuery.prepare("SELECT * FROM users WHERE id=:id");
-    userQuery.bindValue(":id", id);
-    userQuery.exec();
-    userQuery.next();
+    const auto id = state.user.id;
 
     // Ensure the password is correct
-    const auto passwordHash = userQuery.value("password").toString();
+    const auto passwordHash = state.user.password;
     if (passwordHash.startsWith("!")) {
-        return {0, Utils::DisabledAccount};
+        return QtFuture::makeReadyFuture(ProvisionResult{0, Utils::DisabledAccount});
     }
 
-    auto* account = UserAccount::accountForId(id);
-
     // Now check for password resets
-    bool havePasswordReset = false;
-    {
-        QSqlQuery resetQuery;
-        resetQuery.prepare("SELECT * FROM passwordresets WHERE userid=:id");
-        resetQuery.bindValue(":id", id);
-        resetQuery.exec();
-        while (resetQuery.next()) {
-            if (resetQuery.value("expiry").toLongLong() > QDateTime::currentMSecsSinceEpoch()) {
-                havePasswordReset = true;
-                const auto temporaryPassword = resetQuery.value("temporarypassword").toString();
-                if (Utils::verifyHashedPassword(password, temporaryPassword)) {
-                    if (!options.contains("newPassword")) {
-                        return {0, Utils::PasswordResetRequired};
-                    }
-
-                    // Set the new password on this user account
-                    const auto newPassword = options.value("newPassword").toString();
-                    if (const auto error = account->user()->setPassword(newPassword)) {
-                        return {0, error};
-                    }
-
-                    QSqlQuery deleteQuery;
-                    deleteQuery.prepare("DELETE FROM passwordresets WHERE userid=:id");
-                    deleteQuery.bindValue(":id", id);
-                    deleteQuery.exec();
-
-                    password = newPassword;
-                }
+    QString temporaryPassword;
+    if (state.passwordReset && state.passwordReset->expiry > QDateTime::currentMSecsSinceEpoch()) {
+        temporaryPassword = state.passwordReset->temporaryPassword;
+    }
+    const bool havePasswordReset = !temporaryPassword.isEmpty();
+
+    if (passwordHash == "x" && !havePasswordReset) {
+        return QtFuture::makeReadyFuture(ProvisionResult{0, Utils::PasswordResetRequired});
+    }
+
+    const bool haveNewPassword = options.contains("newPassword");
+    const auto newPassword = options.value("newPassword").toString();
+
+    struct PasswordCheck {
+            bool temporaryPasswordMatches = false;
+            bool passwordMatches = false;
+            QString newPasswordHash;
+    };
+
+    // Run every PBKDF2 derivation this login needs on the hashing pool
+    auto passwordCheck = QtConcurrent::run(Utils::hashingThreadPool(), [password, passwordHash, temporaryPassword, havePasswordReset, haveNewPassword, newPassword] {
+        PasswordCheck check;
+        if (havePasswordReset && Utils::verifyHashedPassword(password, temporaryPassword)) {
+            check.temporaryPasswordMatches = true;
+            if (haveNewPassword && Validation::validatePassword(newPassword)) {
+                check.newPasswordHash = Utils::generateHashedPassword(newPassword);
+
+                // After a reset the login carries on as if the new password had been given, but it is still checked
+                // against the hash from before the reset, so it normally fails and the client logs in again
+                if (passwordHash != "x") check.passwordMatches = Utils::verifyHashedPassword(newPassword, passwordHash);
             }
+            return check;
         }
-    }
 
-    if (passwordHash == "x") {
-        // Check if there is already a pending password reset.
-        // If there is already a pending password reset, tell the user that their password is incorrect instead.
-        if (havePasswordReset) {
-            return {0, Utils::IncorrectPassword};
+        if (passwordHash != "x") {
+            check.passwordMatches = Utils::verifyHashedPassword(password, passwordHash);
         }
+        return check;
+    });
 
-        return {0, Utils::PasswordResetRequired};
-    }
+    return passwordCheck.then(accountManager(), [id, options, provisioningPurpose, passwordHash, haveNewPassword, otp = state.otp](PasswordCheck check) -> ProvisionResult {
+        if (check.temporaryPasswordMatches) {
+            if (!haveNewPassword) {
+                return {0, Utils::PasswordResetRequired};
+            }
 
-    if (!Utils::verifyHashedPassword(password, passwordHash)) {
-        return {0, Utils::IncorrectPassword};
-    }
+            if (check.newPasswordHash.isEmpty()) {
+                return {0, Utils::InvalidInput};
+            }
+
+            auto* account = UserAccount::accountForId(id);
+            if (!account) {
+                return {0, Utils::NoAccount};
+            }
 
-    // Check TOTP if we're doing this to log in
-    if (provisioningPurpose == TokenProvisioningManager::TokenProvisioningPurpose::LoginToken) {
-        QSqlQuery otpQuery;
-        otpQuery.prepare("SELECT * FROM otp WHERE userid=:id");
-        otpQuery.bindValue(":id", id);
-        if (!otpQuery.exec()) {
-            return {0, Utils::QueryError};
+            // Set the new password on this user account
+            if (const auto error = account->user()->setHashedPassword(check.newPasswordHash)) {
+                return {0, error};
+            }
+
+            Storage::instance()->deletePasswordReset(id);
+
+            if (passwordHash == "x" || !check.passwordMatches) {
+                return {0, Utils::IncorrectPassword};
+            }
+        } else {
+            if (passwordHash == "x") {
+                // There is already a pending password reset, so tell the user that their password is incorrect instead.
+                return {0, Utils::IncorrectPassword};
+            }
+
+            if (!check.passwordMatches) {
+                return {0, Utils::IncorrectPassword};
+            }
+
+            // Bring the stored hash up to the current cost now that we know the password
+            Utils::upgradePasswordHash(id, options.value("password").toString(), passwordHash);
         }
 
-        if (otpQuery.next()) {
-            if (otpQuery.value("enabled").toBool()) {
-                if (!options.contains("otpToken")) {
-                    return {0, Utils::TwoFactorRequired};
-                }
-
-                const auto otpSecret = otpQuery.value("otpkey").toString();
-                const auto otpKey = options.value("otpToken").toString();
-                if (!Utils::isValidOtpKey(otpKey, otpSecret)) {
-                    // Check the backup keys
-                    QSqlQuery backupsQuery;
-                    backupsQuery.prepare("SELECT * FROM otpbackup WHERE userid=:id");
-                    backupsQuery.bindValue(":id", id);
-                    backupsQuery.exec();
-
-                    bool foundValidBackupKey = false;
-                    while (backupsQuery.next()) {
-                        auto backupKey = backupsQuery.value("backupkey").toString();
-                        if (!backupsQuery.value("used").toBool() && backupKey == otpKey) {
-                            QSqlQuery updateBackupQuery;
-                            updateBackupQuery.prepare("UPDATE otpbackup SET used=:used WHERE userid=:id AND backupkey=:key");
-                            updateBackupQuery.bindValue(":used", true);
-                            updateBackupQuery.bindValue(":id", id);
-                            updateBackupQuery.bindValue(":key", backupKey);
-                            if (!updateBackupQuery.exec()) {
-                                return {0, Utils::QueryError};
-                            }
-
-                            account->twoFactor()->reloadBackupKeys();
-
-                            foundValidBackupKey = true;
-                        }
-                    }
-
-                    if (!foundValidBackupKey) {
-                        return {0, Utils::TwoFactorRequired};
-                    }
-                }
+        // Check TOTP if we're doing this to log in
+        if (provisioningPurpose == TokenProvisioningManager::TokenProvisioningPurpose::LoginToken && otp && otp->enabled) {
+            if (!options.contains("otpToken")) {
+                return {0, Utils::TwoFactorRequired};
+            }
+
+            // Loaded accounts already have their key decoded
+            auto* account = UserAccount::cachedAccountForId(id);
+            const auto totp = account && account->twoFactor()->secretKey() == otp->key ? account->twoFactor()->totp() : Totp(otp->key);
+
+            const auto otpKey = options.value("otpToken").toString();
+            if (!totp.verify(id, otpKey)) {
+                // Treat it as a backup key. Whether it is one is only found out when the statement that issues
+                // the token tries to use it up, and the login fails with TwoFactorRequired if it isn't.
+                return {id, Utils::NoError, {}, Storage::backupKeyDigest(id, otpKey)};
             }
         }
-    }
 
-    return {id, Utils::NoError};
+        return {id, Utils::NoError};
+    });
 }
 
 bool PasswordProvisioningMethod::available(quint64 userId, QString application, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const {
@@ -13,7 +13,7 @@ class PasswordProvisioningMethod : public TokenProvisioningMethod {
         explicit PasswordProvisioningMethod(AccountManager* parent);
 
         [[nodiscard]] QString tokenProvisioningMethod() const override;
-        [[nodiscard]] ProvisionResult provision(QVariantMap options, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const override;
+        [[nodiscard]] QFuture<ProvisionResult> provision(QVariantMap options, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const override;
         [[nodiscard]] bool available(quint64 userId, QString application, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const override;
 };
 
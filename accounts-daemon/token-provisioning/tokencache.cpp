@@ -0,0 +1,172 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "tokencache.h"
+
+#include "configuration.h"
+
+#include <QDateTime>
+#include <QHash>
+#include <QMultiHash>
+#include <QMutex>
+#include <list>
+
+struct TokenCacheEntry {
+        quint64 userId;
+        TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose;
+        qint64 expiry;
+        std::list<QByteArray>::iterator recency;
+};
+
+struct TokenCachePrivate {
+        mutable QMutex mutex;
+
+        // Keyed by the digest of the token so raw tokens never sit in memory
+        QHash<QByteArray, TokenCacheEntry> entries;
+        QMultiHash<quint64, QByteArray> userTokens;
+
+        // Most recently used digests are at the front
+        std::list<QByteArray> recency;
+
+        int capacity;
+        qint64 ttl;
+
+        quint64 hits = 0;
+        quint64 misses = 0;
+        quint64 evictions = 0;
+        quint64 invalidations = 0;
+
+        void remove(QHash<QByteArray, TokenCacheEntry>::iterator entry) {
+            userTokens.remove(entry->userId, entry.key());
+            recency.erase(entry->recency);
+            entries.erase(entry);
+        }
+
+        void trim() {
+            while (entries.size() > capacity && !recency.empty()) {
+                remove(entries.find(recency.back()));
+                evictions++;
+            }
+        }
+};
+
+TokenCache::TokenCache(QObject* parent) :
+    QObject(parent), d(new TokenCachePrivate) {
+    applyConfiguration();
+    connect(Configuration::instance(), &Configuration::reloaded, this, [this] {
+        // Accounts are disabled by editing the database directly, so a reload is how an operator gets their tokens dropped
+        clear();
+        applyConfiguration();
+    });
+}
+
+TokenCache::~TokenCache() {
+    delete d;
+}
+
+TokenCache* TokenCache::instance() {
+    static auto* instance = new TokenCache();
+    return instance;
+}
+
+bool TokenCache::lookup(QByteArray tokenDigest, quint64* userId, TokenProvisioningManager::TokenProvisioningPurpose* provisioningPurpose) {
+    QMutexLocker locker(&d->mutex);
+    auto entry = d->entries.find(tokenDigest);
+    if (entry == d->entries.end()) {
+        d->misses++;
+        return false;
+    }
+
+    if (entry->expiry < QDateTime::currentMSecsSinceEpoch()) {
+        // Force this token to be looked up again in case it has been revoked behind our back
+        d->remove(entry);
+        d->misses++;
+        return false;
+    }
+
+    d->recency.splice(d->recency.begin(), d->recency, entry->recency);
+    d->hits++;
+
+    *userId = entry->userId;
+    *provisioningPurpose = entry->provisioningPurpose;
+    return true;
+}
+
+void TokenCache::insert(QByteArray tokenDigest, quint64 userId, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) {
+    QMutexLocker locker(&d->mutex);
+    if (d->capacity <= 0) return;
+
+    auto existing = d->entries.find(tokenDigest);
+    if (existing != d->entries.end()) d->remove(existing);
+
+    d->recency.push_front(tokenDigest);
+    d->entries.insert(tokenDigest, {userId, provisioningPurpose, QDateTime::currentMSecsSinceEpoch() + d->ttl, d->recency.begin()});
+    d->userTokens.insert(userId, tokenDigest);
+    d->trim();
+}
+
+void TokenCache::invalidate(QByteArray tokenDigest) {
+    QMutexLocker locker(&d->mutex);
+    auto entry = d->entries.find(tokenDigest);
+    if (entry == d->entries.end()) return;
+
+    d->remove(entry);
+    d->invalidations++;
+}
+
+void TokenCache::invalidateUser(quint64 userId) {
+    QMutexLocker locker(&d->mutex);
+    const auto digests = d->userTokens.values(userId);
+    for (const auto& digest : digests) {
+        auto entry = d->entries.find(digest);
+        if (entry == d->entries.end()) continue;
+
+        d->remove(entry);
+        d->invalidations++;
+    }
+}
+
+void TokenCache::clear() {
+    QMutexLocker locker(&d->mutex);
+    d->invalidations += d->entries.size();
+    d->entries.clear();
+    d->userTokens.clear();
+    d->recency.clear();
+}
+
+QVariantMap TokenCache::statistics() const {
+    QMutexLocker locker(&d->mutex);
+    return {
+        {"hits",          d->hits         },
+        {"misses",        d->misses       },
+        {"evictions",     d->evictions    },
+        {"invalidations", d->invalidations},
+        {"size",          static_cast<qint64>(d->entries.size())},
+        {"capacity",      d->capacity     }
+    };
+}
+
+void TokenCache::applyConfiguration() {
+    auto configuration = Configuration::current();
+
+    QMutexLocker locker(&d->mutex);
+    d->capacity = configuration->tokenCacheSize;
+    d->ttl = configuration->tokenCacheTtl;
+    d->trim();
+}
@@ -0,0 +1,53 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef TOKENCACHE_H
+#define TOKENCACHE_H
+
+#include "tokenprovisioningmanager.h"
+
+#include <QObject>
+
+struct TokenCachePrivate;
+class TokenCache : public QObject {
+        Q_OBJECT
+    public:
+        ~TokenCache() override;
+
+        static TokenCache* instance();
+
+        // Tokens are identified by their digest; see Storage::tokenDigest. A hit isn't checked against the account, so
+        // a token of an account that has since been disabled keeps verifying until its entry expires or is invalidated.
+        bool lookup(QByteArray tokenDigest, quint64* userId, TokenProvisioningManager::TokenProvisioningPurpose* provisioningPurpose);
+        void insert(QByteArray tokenDigest, quint64 userId, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose);
+
+        void invalidate(QByteArray tokenDigest);
+        void invalidateUser(quint64 userId);
+        void clear();
+
+        [[nodiscard]] QVariantMap statistics() const;
+
+    private:
+        TokenCachePrivate* d;
+
+        explicit TokenCache(QObject* parent = nullptr);
+        void applyConfiguration();
+};
+
+#endif // TOKENCACHE_H
@@ -4,19 +4,23 @@
 
 #include "tokenprovisioningmanager.h"
 
+#include "configuration.h"
 #include "fidoprovisioningmethod.h"
+#include "jwt.h"
 #include "passwordprovisioningmethod.h"
-#include "qjsonwebtoken.h"
+#include "storage/storage.h"
+#include "tokencache.h"
 #include "tokenprovisioningmethod.h"
 
 #include "../dbus/accountmanager.h"
+#include "../dbus/twofactor.h"
+#include "../dbus/useraccount.h"
 
 #include <QRandomGenerator>
-#include <QSqlQuery>
 
 struct TokenProvisioningManagerPrivate {
         QList<TokenProvisioningMethod*> tokenProvisioningMethods;
-        QString jwtSecret;
+        Jwt jwt;
 };
 
 TokenProvisioningManager::TokenProvisioningManager(AccountManager* parent) :
@@ -24,10 +28,9 @@ TokenProvisioningManager::TokenProvisioningManager(AccountManager* parent) :
     d->tokenProvisioningMethods.append(new PasswordProvisioningMethod(parent));
     d->tokenProvisioningMethods.append(new FidoProvisioningMethod(parent));
 
-    const auto characters = QStringLiteral("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
-    for (auto i = 0; i < 32; i++) {
-        d->jwtSecret.append(characters.at(QRandomGenerator::global()->bounded(characters.length())));
-    }
+    QByteArray jwtSecret(64, Qt::Uninitialized);
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32*>(jwtSecret.data()), jwtSecret.size() / sizeof(quint32));
+    d->jwt = Jwt(jwtSecret);
 }
 
 TokenProvisioningManager::~TokenProvisioningManager() {
@@ -42,57 +45,71 @@ TokenProvisioningManager::TokenProvisioningPurpose TokenProvisioningManager::pur
         .value(purpose, TokenProvisioningPurpose::Unknown);
 }
 
-TokenProvisioningManager::ProvisionResult TokenProvisioningManager::provision(QString method, TokenProvisioningPurpose provisioningPurpose, QString application, QVariantMap options) const {
+QFuture<TokenProvisioningManager::ProvisionResult> TokenProvisioningManager::provision(QString method, TokenProvisioningPurpose provisioningPurpose, QString application, QVariantMap options) const {
     if (provisioningPurpose == TokenProvisioningPurpose::Unknown) {
-        return {{}, Utils::DBusError::InvalidInput};
+        return QtFuture::makeReadyFuture(ProvisionResult{{}, Utils::DBusError::InvalidInput});
     }
 
     for (const auto tokenProvisioningMethod : d->tokenProvisioningMethods) {
         if (tokenProvisioningMethod->tokenProvisioningMethod() == method) {
-            auto [userId, error, optionsResult] = tokenProvisioningMethod->provision(options, provisioningPurpose);
-            if (error != Utils::NoError) {
-                return {{}, error};
-            }
-
-            if (!optionsResult.isEmpty()) {
-                return {optionsResult, Utils::NoError};
-            }
-
-            switch (provisioningPurpose) {
-                case TokenProvisioningPurpose::LoginToken:
-                    {
-                        // Create a new user token and save it in the database
-                        const QString newToken = Utils::generateSalt().toBase64();
-
-                        QSqlQuery tokenInsertQuery;
-                        tokenInsertQuery.prepare("INSERT INTO tokens(userid, token, application) VALUES(:id, :token, :application)");
-                        tokenInsertQuery.bindValue(":id", userId);
-                        tokenInsertQuery.bindValue(":token", newToken);
-                        tokenInsertQuery.bindValue(":application", application);
-                        if (!tokenInsertQuery.exec()) {
-                            return {{}, Utils::QueryError};
+            // Provisioning methods may need to do expensive work off the main thread;
+            // the token itself is always issued back on the main thread
+            return tokenProvisioningMethod->provision(options, provisioningPurpose).then(this->parent(), [this, provisioningPurpose, application](TokenProvisioningMethod::ProvisionResult methodResult) -> ProvisionResult {
+                auto [userId, error, optionsResult, backupKeyDigest] = methodResult;
+                if (error != Utils::NoError) {
+                    return {{}, error};
+                }
+
+                if (!optionsResult.isEmpty()) {
+                    return {optionsResult, Utils::NoError};
+                }
+
+                switch (provisioningPurpose) {
+                    case TokenProvisioningPurpose::LoginToken:
+                        {
+                            // Create a new user token and save it in the database, using up the backup key in the same statement
+                            const QString newToken = Utils::generateSalt().toBase64();
+                            auto configuration = Configuration::current();
+                            auto now = QDateTime::currentMSecsSinceEpoch();
+
+                            switch (Storage::instance()->issueToken(userId, Storage::tokenDigest(newToken), application, now, now + configuration->tokenLifetime, backupKeyDigest)) {
+                                case Storage::Status::Ok:
+                                    break;
+                                case Storage::Status::NotFound:
+                                    // Someone else used the backup key first
+                                    return {{}, Utils::TwoFactorRequired};
+                                case Storage::Status::Failed:
+                                    return {{}, Utils::QueryError};
+                            }
+
+                            if (!backupKeyDigest.isEmpty()) {
+                                if (auto* account = UserAccount::cachedAccountForId(userId)) account->twoFactor()->backupKeyUsed(backupKeyDigest);
+                            }
+
+                            // Make room by dropping the tokens that have gone unused the longest
+                            if (configuration->tokenMaxPerUser > 0) trimTokens(userId, configuration->tokenMaxPerUser);
+
+                            return {{{"token", newToken}}, Utils::NoError};
                         }
-
-                        return {{{"token", newToken}}, Utils::NoError};
-                    }
-                case TokenProvisioningPurpose::AccountModificationToken:
-                    {
-                        // Create a short-lived JWT that we can use to perform account modification actions
-                        QJsonWebToken jwt;
-                        jwt.setAlgorithmStr("HS512");
-                        jwt.setSecret(d->jwtSecret);
-                        jwt.appendClaim("sub", QString::number(userId));
-                        jwt.appendClaim("exp", QString::number(QDateTime::currentDateTimeUtc().addSecs(60 * 60).toMSecsSinceEpoch())); // One hour
-                        jwt.appendClaim("pur", QString::number(static_cast<int>(provisioningPurpose)));
-                        return {
-                            {{"token", jwt.getToken()}},
-                            Utils::NoError};
-                    }
-                default:; // noop
-            }
+                    case TokenProvisioningPurpose::AccountModificationToken:
+                        {
+                            // Create a short-lived JWT that we can use to perform account modification actions
+                            auto token = d->jwt.sign({
+                                {"sub", QString::number(userId)},
+                                {"exp", QString::number(QDateTime::currentDateTimeUtc().addSecs(60 * 60).toMSecsSinceEpoch())}, // One hour
+                                {"pur", QString::number(static_cast<int>(provisioningPurpose))}
+                            });
+                            return {
+                                {{"token", token}},
+                                Utils::NoError};
+                        }
+                    default:; // noop
+                }
+                return {{}, Utils::DBusError::InternalError};
+            });
         }
     }
-    return {{}, Utils::DBusError::InternalError};
+    return QtFuture::makeReadyFuture(ProvisionResult{{}, Utils::DBusError::InternalError});
 }
 
 QStringList TokenProvisioningManager::availableMethods(quint64 userId, QString application, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const {
@@ -106,42 +123,111 @@ QStringList TokenProvisioningManager::availableMethods(quint64 userId, QString a
 }
 
 bool TokenProvisioningManager::verifyToken(QString token, quint64* userId, TokenProvisioningPurpose* provisioningPurpose) const {
-    // First try to understand the token as a JWT
-    auto jwt = QJsonWebToken::fromTokenAndSecret(token, d->jwtSecret);
-    if (jwt.isValid()) {
-        auto exp = jwt.claim("exp").toULongLong();
-        if (exp < QDateTime::currentMSecsSinceEpoch()) {
-            // JWT has expired
-            return false;
+    auto verification = verifyTokens({token}).first();
+    if (!verification.valid) return false;
+
+    *userId = verification.userId;
+    *provisioningPurpose = verification.purpose;
+    return true;
+}
+
+QList<TokenProvisioningManager::TokenVerification> TokenProvisioningManager::verifyTokens(QStringList tokens) const {
+    QList<TokenVerification> verifications(tokens.size());
+    QList<QByteArray> digests(tokens.size());
+    QMultiHash<QByteArray, int> databaseTokens;
+    for (auto i = 0; i < tokens.size(); i++) {
+        const auto& token = tokens.at(i);
+        auto& verification = verifications[i];
+
+        // Account modification tokens are JWTs; anything else can only be a login token
+        if (Jwt::isJwt(token)) {
+            QJsonObject claims;
+            if (!d->jwt.verify(token, &claims)) {
+                continue;
+            }
+
+            auto exp = claims.value("exp").toString().toULongLong();
+            if (exp < QDateTime::currentMSecsSinceEpoch()) {
+                // JWT has expired
+                continue;
+            }
+
+            bool userIdOk;
+            auto tokenUserId = claims.value("sub").toString().toInt(&userIdOk);
+            if (!userIdOk) {
+                continue;
+            }
+
+            bool purposeOk;
+            auto purpose = claims.value("pur").toString().toInt(&purposeOk);
+            if (!purposeOk) {
+                continue;
+            }
+
+            verification = {true, static_cast<quint64>(tokenUserId), static_cast<TokenProvisioningPurpose>(purpose)};
+            continue;
         }
 
-        bool userIdOk;
-        auto tokenUserId = jwt.claim("sub").toInt(&userIdOk);
-        if (!userIdOk) {
-            return false;
+        // Most tokens we see have been verified recently
+        digests[i] = Storage::tokenDigest(token);
+        if (TokenCache::instance()->lookup(digests.at(i), &verification.userId, &verification.purpose)) {
+            verification.valid = true;
+            continue;
         }
-        *userId = tokenUserId;
 
-        bool purposeOk;
-        auto purpose = jwt.claim("pur").toInt(&purposeOk);
-        if (!purposeOk) {
-            return false;
+        databaseTokens.insert(digests.at(i), i);
+    }
+
+    if (databaseTokens.isEmpty()) return verifications;
+
+    // Look up everything else in the database in one go
+    auto now = QDateTime::currentMSecsSinceEpoch();
+    QHash<QByteArray, quint64> tokenUsers;
+    Storage::instance()->tokenUsers(databaseTokens.uniqueKeys(), now, &tokenUsers);
+
+    // Tokens that are being used stay valid for another full lifetime
+    if (!tokenUsers.isEmpty()) Storage::instance()->touchTokens(tokenUsers.keys(), now, now + Configuration::current()->tokenLifetime);
+
+    for (auto tokenUser = tokenUsers.constBegin(); tokenUser != tokenUsers.constEnd(); tokenUser++) {
+        TokenCache::instance()->insert(tokenUser.key(), tokenUser.value(), TokenProvisioningPurpose::LoginToken);
+        for (auto index : databaseTokens.values(tokenUser.key())) {
+            verifications[index] = {true, tokenUser.value(), TokenProvisioningPurpose::LoginToken};
         }
-        *provisioningPurpose = static_cast<TokenProvisioningPurpose>(purpose);
-        return true;
+        databaseTokens.remove(tokenUser.key());
     }
 
-    // Now read the database for tokens
-    QSqlQuery query;
-    query.prepare("SELECT * FROM tokens WHERE token=:token");
-    query.bindValue(":token", token);
-    query.exec();
+    if (databaseTokens.isEmpty()) return verifications;
+
+    // Tokens that haven't been migrated to digests yet can still only be found by their raw value
+    QStringList legacyTokens;
+    for (auto index : databaseTokens) legacyTokens.append(tokens.at(index));
+
+    QHash<QString, quint64> legacyTokenUsers;
+    Storage::instance()->legacyTokenUsers(legacyTokens, &legacyTokenUsers);
 
-    if (query.next()) {
-        *userId = query.value("userid").toULongLong();
-        *provisioningPurpose = TokenProvisioningPurpose::LoginToken;
-        return true;
+    for (auto index : databaseTokens) {
+        auto userId = legacyTokenUsers.constFind(tokens.at(index));
+        if (userId == legacyTokenUsers.constEnd()) continue;
+
+        TokenCache::instance()->insert(digests.at(index), *userId, TokenProvisioningPurpose::LoginToken);
+        verifications[index] = {true, *userId, TokenProvisioningPurpose::LoginToken};
     }
 
-    return false;
-}
\ No newline at end of file
+    return verifications;
+}
+
+bool TokenProvisioningManager::revokeToken(QString token) const {
+    const auto digest = Storage::tokenDigest(token);
+    TokenCache::instance()->invalidate(digest);
+
+    return Storage::instance()->deleteToken(digest) && Storage::instance()->deleteLegacyToken(token);
+}
+
+bool TokenProvisioningManager::trimTokens(quint64 userId, int maximum) {
+    QList<QByteArray> trimmed;
+    auto success = Storage::instance()->trimTokens(userId, maximum, &trimmed);
+    for (const auto& digest : std::as_const(trimmed)) {
+        TokenCache::instance()->invalidate(digest);
+    }
+    return success;
+}
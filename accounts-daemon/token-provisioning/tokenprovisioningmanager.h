@@ -7,6 +7,7 @@
 
 #include "utils.h"
 
+#include <QFuture>
 #include <QObject>
 
 class AccountManager;
@@ -25,13 +26,24 @@ class TokenProvisioningManager : public QObject {
             Unknown = 0xFFFF
         };
 
+        struct TokenVerification {
+                bool valid = false;
+                quint64 userId = 0;
+                TokenProvisioningPurpose purpose = TokenProvisioningPurpose::Unknown;
+        };
+
         explicit TokenProvisioningManager(AccountManager* parent = nullptr);
         ~TokenProvisioningManager() override;
 
         TokenProvisioningPurpose purposeForString(QString purpose);
-        [[nodiscard]] ProvisionResult provision(QString method, TokenProvisioningPurpose provisioningPurpose, QString application, QVariantMap options) const;
+        [[nodiscard]] QFuture<ProvisionResult> provision(QString method, TokenProvisioningPurpose provisioningPurpose, QString application, QVariantMap options) const;
         [[nodiscard]] QStringList availableMethods(quint64 userId, QString application, TokenProvisioningPurpose provisioningPurpose) const;
         bool verifyToken(QString token, quint64* userId, TokenProvisioningPurpose* provisioningPurpose) const;
+        [[nodiscard]] QList<TokenVerification> verifyTokens(QStringList tokens) const;
+        bool revokeToken(QString token) const;
+
+        // Drops all but the most recently used tokens of a user, and from the cache too
+        static bool trimTokens(quint64 userId, int maximum);
 
     private:
         TokenProvisioningManagerPrivate* d;
@@ -12,6 +12,7 @@ struct TokenProvisioningMethodPrivate {
 
 TokenProvisioningMethod::TokenProvisioningMethod(AccountManager* parent) :
     QObject(parent), d(new TokenProvisioningMethodPrivate) {
+    d->accountManager = parent;
 }
 
 TokenProvisioningMethod::~TokenProvisioningMethod() {
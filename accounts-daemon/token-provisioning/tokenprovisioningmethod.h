@@ -7,6 +7,7 @@
 #include "tokenprovisioningmanager.h"
 #include "utils.h"
 
+#include <QFuture>
 #include <QObject>
 
 class AccountManager;
@@ -18,13 +19,16 @@ class TokenProvisioningMethod : public QObject {
                 quint64 userId;
                 Utils::DBusError error = Utils::DBusError::NoError;
                 QVariantMap options;
+
+                // Digest of a backup key to consume when the login token is issued
+                QByteArray backupKeyDigest;
         };
 
         explicit TokenProvisioningMethod(AccountManager* parent);
         ~TokenProvisioningMethod() override;
 
         [[nodiscard]] virtual QString tokenProvisioningMethod() const = 0;
-        [[nodiscard]] virtual ProvisionResult provision(QVariantMap parameters, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const = 0;
+        [[nodiscard]] virtual QFuture<ProvisionResult> provision(QVariantMap parameters, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const = 0;
         [[nodiscard]] virtual bool available(quint64 userId, QString application, TokenProvisioningManager::TokenProvisioningPurpose provisioningPurpose) const = 0;
 
     protected:
@@ -0,0 +1,216 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "totp.h"
+
+#include "configuration.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+    constexpr int blockSize = 64;
+    constexpr qint64 stepLength = 30;
+
+    constexpr std::array<quint32, 5> sha1InitialState = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    inline quint32 rotateLeft(quint32 value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    // One round of the SHA-1 compression function
+    void sha1Block(std::array<quint32, 5>& state, const uchar* block) {
+        quint32 w[80];
+        for (int i = 0; i < 16; i++) w[i] = qFromBigEndian<quint32>(block + i * 4);
+        for (int i = 16; i < 80; i++) w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        auto [a, b, c, d, e] = state;
+        for (int i = 0; i < 80; i++) {
+            quint32 f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            auto temp = rotateLeft(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+
+    // Finishes a hash that has already absorbed one 64 byte block, given the remaining message of at most 55 bytes
+    void sha1Finish(std::array<quint32, 5>& state, const uchar* data, int length) {
+        uchar block[blockSize] = {};
+        memcpy(block, data, length);
+        block[length] = 0x80;
+        qToBigEndian<quint64>(static_cast<quint64>(blockSize + length) * 8, block + blockSize - 8);
+        sha1Block(state, block);
+    }
+
+    // Parses a six digit code; anything else can never match
+    int parseCode(const QString& code) {
+        if (code.length() != 6) return -1;
+
+        int value = 0;
+        for (auto c : code) {
+            auto digit = c.unicode();
+            if (digit < '0' || digit > '9') return -1;
+            value = value * 10 + (digit - '0');
+        }
+        return value;
+    }
+
+    struct ReplayCache {
+            QMutex mutex;
+            QHash<quint64, qint64> lastSteps;
+    };
+
+    ReplayCache replayCache;
+} // namespace
+
+Totp::Totp(const QString& sharedKey) {
+    // Decode the base32 key; padding and spaces are ignored and any other character makes the key unusable
+    QByteArray key;
+    key.reserve(sharedKey.length() * 5 / 8);
+    quint32 buffer = 0;
+    int bits = 0;
+    for (auto c : sharedKey) {
+        int value;
+        auto upper = c.toUpper().unicode();
+        if (upper >= 'A' && upper <= 'Z') {
+            value = upper - 'A';
+        } else if (upper >= '2' && upper <= '7') {
+            value = upper - '2' + 26;
+        } else if (upper == '=' || upper == ' ') {
+            continue;
+        } else {
+            return;
+        }
+
+        buffer = (buffer << 5) | value;
+        bits += 5;
+        if (bits >= 8) {
+            bits -= 8;
+            key.append(static_cast<char>((buffer >> bits) & 0xFF));
+        }
+    }
+    if (key.isEmpty()) return;
+
+    if (key.size() > blockSize) key = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
+
+    uchar innerPad[blockSize];
+    uchar outerPad[blockSize];
+    for (int i = 0; i < blockSize; i++) {
+        uchar keyByte = i < key.size() ? static_cast<uchar>(key.at(i)) : 0;
+        innerPad[i] = keyByte ^ 0x36;
+        outerPad[i] = keyByte ^ 0x5C;
+    }
+
+    innerState = sha1InitialState;
+    sha1Block(innerState, innerPad);
+    outerState = sha1InitialState;
+    sha1Block(outerState, outerPad);
+    valid = true;
+}
+
+bool Totp::isNull() const {
+    return !valid;
+}
+
+qint64 Totp::currentStep() {
+    return QDateTime::currentSecsSinceEpoch() / stepLength;
+}
+
+quint32 Totp::code(qint64 step) const {
+    uchar counter[8];
+    qToBigEndian<quint64>(static_cast<quint64>(step), counter);
+
+    auto inner = innerState;
+    sha1Finish(inner, counter, sizeof(counter));
+
+    uchar innerDigest[20];
+    for (int i = 0; i < 5; i++) qToBigEndian<quint32>(inner[i], innerDigest + i * 4);
+
+    auto outer = outerState;
+    sha1Finish(outer, innerDigest, sizeof(innerDigest));
+
+    uchar hmac[20];
+    for (int i = 0; i < 5; i++) qToBigEndian<quint32>(outer[i], hmac + i * 4);
+
+    // Dynamic truncation from RFC 4226
+    auto offset = hmac[19] & 0xF;
+    quint32 number = (hmac[offset] & 0x7F) << 24 | hmac[offset + 1] << 16 | hmac[offset + 2] << 8 | hmac[offset + 3];
+    return number % 1000000;
+}
+
+qint64 Totp::matchingStep(const QString& code, qint64 now) const {
+    if (!valid) return -1;
+
+    auto value = parseCode(code);
+    if (value < 0) return -1;
+
+    // Check the current step first since that is where almost every code comes from
+    auto window = Configuration::current()->otpWindow;
+    if (this->code(now) == static_cast<quint32>(value)) return now;
+    for (int offset = 1; offset <= window; offset++) {
+        if (this->code(now - offset) == static_cast<quint32>(value)) return now - offset;
+        if (this->code(now + offset) == static_cast<quint32>(value)) return now + offset;
+    }
+    return -1;
+}
+
+bool Totp::verify(quint64 userId, const QString& code, qint64 now) const {
+    auto step = matchingStep(code, now);
+    if (step < 0) return false;
+
+    QMutexLocker locker(&replayCache.mutex);
+    auto& lastStep = replayCache.lastSteps[userId];
+    if (step <= lastStep) return false;
+    lastStep = step;
+
+    // Nothing older than the window can be replayed anyway, so the cache only needs recent entries
+    if (replayCache.lastSteps.size() > 10000) {
+        auto oldest = now - Configuration::current()->otpWindow;
+        replayCache.lastSteps.removeIf([oldest](const QHash<quint64, qint64>::iterator& entry) {
+            return entry.value() < oldest;
+        });
+    }
+    return true;
+}
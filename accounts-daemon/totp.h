@@ -0,0 +1,53 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef TOTP_H
+#define TOTP_H
+
+#include <QString>
+#include <array>
+
+// Time-based one time passwords (RFC 6238) for one shared key. The key is decoded and the HMAC
+// pads are hashed when the object is made, so checking a code takes two SHA-1 blocks per step
+// and never allocates.
+class Totp {
+    public:
+        Totp() = default;
+        explicit Totp(const QString& sharedKey);
+
+        bool isNull() const;
+
+        static qint64 currentStep();
+        quint32 code(qint64 step) const;
+
+        // Returns the step within the configured window that the code belongs to, or -1
+        qint64 matchingStep(const QString& code, qint64 now = currentStep()) const;
+
+        // Like matchingStep, but also refuses a code from a step this user has already logged in with
+        bool verify(quint64 userId, const QString& code, qint64 now = currentStep()) const;
+
+    private:
+        using State = std::array<quint32, 5>;
+
+        bool valid = false;
+        State innerState = {};
+        State outerState = {};
+};
+
+#endif // TOTP_H
@@ -18,31 +18,68 @@
  *
  * *************************************/
 
+#include <QCoreApplication>
 #include <QRandomGenerator64>
 #include <QPasswordDigestor>
-#include <QSettings>
 #include <QtConcurrent>
-#include <QMessageAuthenticationCode>
-#include <QSqlQuery>
+#include <QThread>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include "configuration.h"
+#include "storage/storage.h"
 #include "logger.h"
 #include "utils.h"
+#include "mailqueue.h"
 #include "mailtemplate.h"
+#include "metrics.h"
+#include "totp.h"
 
 #include <src/SmtpMime>
 
 QDBusConnection Utils::accountsBus() {
-    QSettings settings(Utils::settingsFile(), QSettings::IniFormat);
-    if (settings.value("dbus/bus").toString() == "dedicated") {
+    // The bus can't change once we have registered on it, so only look at the configuration once
+    static const bool dedicatedBus = Configuration::current()->dedicatedBus;
+    if (dedicatedBus) {
         return QDBusConnection("accounts");
     } else {
         return QDBusConnection::sessionBus();
     }
 }
 
-QString Utils::generateHashedPassword(QString password, int iterations) {
+QDBusConnection Utils::accountsRelayBus() {
+    // Qt answers calls a connection makes to its own service without going through the bus, and can't pass delayed
+    // replies back that way, so calls the daemon hands to itself go out over a second connection instead
+    static const bool connected = [] {
+        if (Configuration::current()->dedicatedBus) {
+            QDBusConnection::connectToBus(dedicatedBusAddress, "accounts-relay");
+        } else {
+            QDBusConnection::connectToBus(QDBusConnection::SessionBus, "accounts-relay");
+        }
+        return true;
+    }();
+    Q_UNUSED(connected)
+    return QDBusConnection("accounts-relay");
+}
+
+namespace {
+    // Zero until the cost has been calibrated
+    std::atomic<int> calibratedIterations = 0;
+
+    // Calibration is noisy, so a cost only counts as higher than another once it is at least this many percent higher.
+    // Otherwise every restart would mark the hashes stored at the last calibration as outdated.
+    constexpr int significantIncreasePercent = 10;
+
+    bool significantlyHigher(qint64 iterations, qint64 than) {
+        return iterations * 100 >= than * (100 + significantIncreasePercent);
+    }
+} // namespace
+
+QString Utils::generateHashedPassword(QString password) {
+    const auto iterations = passwordHashIterations();
     QByteArray saltByteArray = generateSalt();
     QString saltString = saltByteArray.toBase64();
 
+    Metrics::Timer timer("pbkdf2");
     QByteArray hash = QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha3_512, password.toUtf8(), saltByteArray, iterations, 512);
     return QStringLiteral("PBKDF2.SHA3_512.%1.%2.%3").arg(iterations).arg(saltString, hash.toBase64());
 }
@@ -57,34 +94,128 @@ bool Utils::verifyHashedPassword(QString password, QString hash) {
     QByteArray salt = QByteArray::fromBase64(parts.at(3).toUtf8());
     QByteArray storedHash = QByteArray::fromBase64(parts.at(4).toUtf8());
 
+    Metrics::Timer timer("pbkdf2");
     QByteArray comparedHash = QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha3_512, password.toUtf8(), salt, iterations, 512);
     if (storedHash != comparedHash) return false;
     return true;
 }
 
-void Utils::sendDbusError(DBusError error, const QDBusMessage& replyTo) {
-    const QMap<DBusError, QPair<QString, QString>> errors = {
-        {InternalError, {"com.vicr123.accounts.Error.InternalError", "Internal Error"}},
-        {NoAccount, {"com.vicr123.accounts.Error.NoAccount", "The user account does not exist"}},
-        {QueryError, {"com.vicr123.accounts.Error.QueryError", "Could not execute the query on the database"}},
-        {IncorrectPassword, {"com.vicr123.accounts.Error.IncorrectPassword", "The password is incorrect"}},
-        {PasswordResetRequired, {"com.vicr123.accounts.Error.PasswordResetRequired", "A password reset is required"}},
-        {DisabledAccount, {"com.vicr123.accounts.Error.DisabledAccount", "The account is disabled"}},
-        {TwoFactorEnabled, {"com.vicr123.accounts.Error.TwoFactorEnabled", "Two Factor Authentication is already enabled"}},
-        {TwoFactorDisabled, {"com.vicr123.accounts.Error.TwoFactorDisabled", "Two Factor Authentication is already disabled"}},
-        {TwoFactorRequired, {"com.vicr123.accounts.Error.TwoFactorRequired", "Two Factor Authentication is required"}},
-        {VerificationCodeIncorrect, {"com.vicr123.accounts.Error.VerificationCodeIncorrect", "The Verification code is incorrect"}},
-        {InvalidInput, {"com.vicr123.accounts.Error.InvalidInput", "The input is invalid"}},
-        {PasswordResetRequestRequired, {"com.vicr123.accounts.Error.PasswordResetRequestRequired", "A password reset must be requested"}},
-        {FidoSupportUnavailable, {"com.vicr123.accounts.Error.FidoSupportUnavailable", "FIDO U2F support is not available"}},
-        {AccountEmailNotVerified, {"com.vicr123.accounts.Error.AccountEmailNotVerified", "Account Email is not verified"}},
-        {EmailError, {"com.vicr123.accounts.Error.EmailError", "Unable to send the email"}}
+int Utils::passwordHashIterations() {
+    auto iterations = calibratedIterations.load();
+    return iterations > 0 ? iterations : Configuration::current()->passwordMinimumIterations;
+}
+
+int Utils::calibratePasswordHashing() {
+    auto configuration = Configuration::current();
+    if (configuration->passwordHashTarget <= 0) {
+        // Calibration is turned off; always use the minimum
+        calibratedIterations = configuration->passwordMinimumIterations;
+        return calibratedIterations;
+    }
+
+    // Time a short derivation a few times and keep the fastest, which is the least disturbed by other work
+    constexpr int sampleIterations = 1000;
+    const auto salt = generateSalt();
+    qint64 fastest = std::numeric_limits<qint64>::max();
+    for (int i = 0; i < 5; i++) {
+        QElapsedTimer timer;
+        timer.start();
+        QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha3_512, QByteArrayLiteral("calibration"), salt, sampleIterations, 512);
+        fastest = qMin(fastest, qMax<qint64>(timer.nsecsElapsed(), 1));
+    }
+
+    // Round down to a whole thousand so the stored hashes don't churn between runs
+    auto iterations = configuration->passwordHashTarget * 1000000LL * sampleIterations / fastest;
+    iterations = qBound<qint64>(configuration->passwordMinimumIterations, iterations / 1000 * 1000, 100000000);
+
+    // Keep the current cost unless the new one is meaningfully different
+    auto current = calibratedIterations.load();
+    if (current >= configuration->passwordMinimumIterations && !significantlyHigher(iterations, current) && !significantlyHigher(current, iterations)) {
+        iterations = current;
+    }
+
+    calibratedIterations = static_cast<int>(iterations);
+    Logger::log() << "Password hashes take " << iterations << " PBKDF2 iterations to meet the " << configuration->passwordHashTarget << " ms target\n";
+    return calibratedIterations;
+}
+
+bool Utils::passwordHashOutdated(QString hash) {
+    QStringList parts = hash.split(".");
+    if (parts.length() != 5 || parts.at(0) != "PBKDF2" || parts.at(1) != "SHA3_512") return false;
+
+    // Anything under the configured minimum is always upgraded
+    auto iterations = parts.at(2).toInt();
+    return iterations < Configuration::current()->passwordMinimumIterations || significantlyHigher(passwordHashIterations(), iterations);
+}
+
+QThreadPool* Utils::hashingThreadPool() {
+    // Password hashing is CPU bound, so keep it off the main event loop and
+    // out of the global pool, and never run more hashes than we have cores
+    static QThreadPool* pool = [] {
+        auto* pool = new QThreadPool();
+        pool->setObjectName(QStringLiteral("HashingThreadPool"));
+        pool->setMaxThreadCount(QThread::idealThreadCount());
+        return pool;
+    }();
+    return pool;
+}
+
+QFuture<QString> Utils::generateHashedPasswordAsync(QString password) {
+    return QtConcurrent::run(hashingThreadPool(), [password] {
+        return generateHashedPassword(password);
+    });
+}
+
+QFuture<bool> Utils::verifyHashedPasswordAsync(QString password, QString hash) {
+    return QtConcurrent::run(hashingThreadPool(), [password, hash] {
+        return verifyHashedPassword(password, hash);
+    });
+}
+
+void Utils::upgradePasswordHash(quint64 user, QString password, QString hash) {
+    // Called once the password is known to be correct; the stored hash is only replaced if it hasn't changed meanwhile
+    if (!passwordHashOutdated(hash)) return;
+
+    // Only the hashing happens on the pool; its threads don't hold database connections, so the write happens back here
+    generateHashedPasswordAsync(password).then(QCoreApplication::instance(), [user, hash](QString newHash) {
+        if (Storage::instance()->replacePassword(user, hash, newHash) == Storage::Status::Failed) {
+            Logger::warning() << "Could not upgrade the password hash for user " << user << "\n";
+        }
+    });
+}
+
+namespace {
+    const QMap<Utils::DBusError, QPair<QString, QString>> dbusErrors = {
+        {Utils::InternalError, {"com.vicr123.accounts.Error.InternalError", "Internal Error"}},
+        {Utils::NoAccount, {"com.vicr123.accounts.Error.NoAccount", "The user account does not exist"}},
+        {Utils::QueryError, {"com.vicr123.accounts.Error.QueryError", "Could not execute the query on the database"}},
+        {Utils::IncorrectPassword, {"com.vicr123.accounts.Error.IncorrectPassword", "The password is incorrect"}},
+        {Utils::PasswordResetRequired, {"com.vicr123.accounts.Error.PasswordResetRequired", "A password reset is required"}},
+        {Utils::DisabledAccount, {"com.vicr123.accounts.Error.DisabledAccount", "The account is disabled"}},
+        {Utils::TwoFactorEnabled, {"com.vicr123.accounts.Error.TwoFactorEnabled", "Two Factor Authentication is already enabled"}},
+        {Utils::TwoFactorDisabled, {"com.vicr123.accounts.Error.TwoFactorDisabled", "Two Factor Authentication is already disabled"}},
+        {Utils::TwoFactorRequired, {"com.vicr123.accounts.Error.TwoFactorRequired", "Two Factor Authentication is required"}},
+        {Utils::VerificationCodeIncorrect, {"com.vicr123.accounts.Error.VerificationCodeIncorrect", "The Verification code is incorrect"}},
+        {Utils::InvalidInput, {"com.vicr123.accounts.Error.InvalidInput", "The input is invalid"}},
+        {Utils::PasswordResetRequestRequired, {"com.vicr123.accounts.Error.PasswordResetRequestRequired", "A password reset must be requested"}},
+        {Utils::FidoSupportUnavailable, {"com.vicr123.accounts.Error.FidoSupportUnavailable", "FIDO U2F support is not available"}},
+        {Utils::AccountEmailNotVerified, {"com.vicr123.accounts.Error.AccountEmailNotVerified", "Account Email is not verified"}},
+        {Utils::EmailError, {"com.vicr123.accounts.Error.EmailError", "Unable to send the email"}},
+        {Utils::Busy, {"com.vicr123.accounts.Error.Busy", "Too many logins are in progress; try again shortly"}},
+        {Utils::RateLimited, {"com.vicr123.accounts.Error.RateLimited", "Too many login attempts; try again later"}}
     };
+} // namespace
+
+QString Utils::dbusErrorName(DBusError error) {
+    return dbusErrors.value(error).first;
+}
 
-    QPair<QString, QString> errorStrings = errors.value(error);
+void Utils::sendDbusError(DBusError error, const QDBusMessage& replyTo) {
+    QPair<QString, QString> errorStrings = dbusErrors.value(error);
 
     replyTo.setDelayedReply(true);
     Utils::accountsBus().send(replyTo.createErrorReply(errorStrings.first, errorStrings.second));
+    Metrics::countError(replyTo);
 }
 
 QByteArray Utils::generateSalt() {
@@ -98,8 +229,9 @@ QByteArray Utils::generateSalt() {
 }
 
 void Utils::sendTemplateEmail(QString templateName, QList<QString> recipients, QString locale, QMap<QString, QString> replacements) {
+    auto configuration = Configuration::current();
     auto message = new MimeMessage();
-    message->setSender(EmailAddress(qEnvironmentVariable("SMTP_SENDER_EMAIL"), qEnvironmentVariable("SMTP_SENDER_NAME")));
+    message->setSender(EmailAddress(configuration->smtpSenderEmail, configuration->smtpSenderName));
     for (QString recipient : recipients) {
         message->addRecipient(EmailAddress(recipient));
     }
@@ -116,40 +248,7 @@ void Utils::sendTemplateEmail(QString templateName, QList<QString> recipients, Q
 }
 
 QString Utils::otpKey(QString sharedKey, int offset) {
-    char* decodedKey = new char[sharedKey.length() * 5 / 8];
-    std::fill(decodedKey, decodedKey + sharedKey.length() * 5 / 8, 0);
-    int next = 0;
-    for (QChar c : sharedKey.toUpper()) {
-        int bits;
-        if (c.isNumber()) {
-            bits = c.toLatin1() - '2' + 26;
-        } else {
-            bits = c.toLatin1() - 'A';
-        }
-
-        for (int i = 4; i >= 0; i--) {
-            decodedKey[next / 8] |= (bits >> i & 0b1) << (7 - (next % 8));
-            next++;
-        }
-    }
-
-    QByteArray decodedBytes = QByteArray(reinterpret_cast<char*>(decodedKey), sharedKey.length() * 5 / 8);
-    for (int i = 0; i < decodedBytes.size(); i++) {
-        decodedBytes.data()[i] = qFromBigEndian(decodedBytes.data()[i]);
-    }
-
-    delete[] decodedKey;
-
-    quint64 currentNumber = qToBigEndian(static_cast<quint64>(QDateTime::currentSecsSinceEpoch() / 30) + offset);
-    QByteArray hmac = QMessageAuthenticationCode::hash(QByteArray(reinterpret_cast<char*>(&currentNumber), sizeof(quint64)), decodedBytes, QCryptographicHash::Sha1);
-    char truncationStart = hmac.at(hmac.length() - 1) & 0xf;
-
-    qint32 number = ((hmac.at(truncationStart) & 0x7f) << 24) |
-        (hmac.at(truncationStart + 1) & 0xff) << 16 |
-        (hmac.at(truncationStart + 2) & 0xff) << 8 |
-        (hmac.at(truncationStart + 3) & 0xff);
-
-    return QString::number(number % 1000000).rightJustified(6, '0', true);
+    return QString::number(Totp(sharedKey).code(Totp::currentStep() + offset)).rightJustified(6, '0');
 }
 
 QString Utils::generateSharedOtpKey() {
@@ -162,9 +261,7 @@ QString Utils::generateSharedOtpKey() {
 }
 
 bool Utils::isValidOtpKey(QString otpKey, QString sharedKey) {
-    return otpKey == Utils::otpKey(sharedKey, -1) ||
-        otpKey == Utils::otpKey(sharedKey, 0) ||
-        otpKey == Utils::otpKey(sharedKey, 1);
+    return Totp(sharedKey).matchingStep(otpKey) >= 0;
 }
 
 QByteArray Utils::generateRandomBytes(int count) {
@@ -178,23 +275,14 @@ QByteArray Utils::generateRandomBytes(int count) {
 }
 
 bool Utils::sendVerificationEmail(quint64 user) {
-    QSqlQuery query;
-    query.prepare("SELECT * FROM users WHERE id=:id");
-    query.bindValue(":id", user);
-    query.exec();
-    if (!query.next()) return false;
+    auto storedUser = Storage::instance()->user(user);
+    if (!storedUser) return false;
 
     QString code = QString::number(QRandomGenerator::system()->bounded(999999)).rightJustified(6, '0');
+    if (!Storage::instance()->setVerification(user, code, QDateTime::currentMSecsSinceEpoch() + 1000 * 60 * 60 * 24)) return false;
 
-    QSqlQuery verificationsQuery;
-    verificationsQuery.prepare("INSERT INTO verifications(userid, verificationstring, expiry) VALUES(:id, :code, :expiry) ON CONFLICT ON CONSTRAINT pk_verifications DO UPDATE SET verificationstring=:code, expiry=:expiry");
-    verificationsQuery.bindValue(":id", user);
-    verificationsQuery.bindValue(":code", code);
-    verificationsQuery.bindValue(":expiry", QDateTime::currentMSecsSinceEpoch() + 1000 * 60 * 60 * 24);
-    if (!verificationsQuery.exec()) return false;
-
-    Utils::sendTemplateEmail("verify", {query.value("email").toString()}, "en", {
-        {"name", query.value("username").toString()},
+    Utils::sendTemplateEmail("verify", {storedUser->email}, "en", {
+        {"name", storedUser->username},
         {"code", code}
     });
     return true;
@@ -202,51 +290,11 @@ bool Utils::sendVerificationEmail(quint64 user) {
 
 QString Utils::fidoHelperPath()
 {
-    QSettings settings(Utils::settingsFile(), QSettings::IniFormat);
-    return settings.value("fido/executable").toString();
+    return Configuration::current()->fidoExecutable;
 }
 
 QFuture<void> Utils::sendMailMessage(MimeMessage* message) {
-    return QtConcurrent::run([ message ](QPromise<void>& promise) {
-        QString securityTypeString = qEnvironmentVariable("SMTP_SECURITY");
-        SmtpClient::ConnectionType securityType;
-        if (securityTypeString == "STARTTLS") {
-            securityType = SmtpClient::TlsConnection;
-        } else if (securityTypeString == "true") {
-            securityType = SmtpClient::SslConnection;
-        } else {
-            securityType = SmtpClient::TcpConnection;
-        }
-
-        SmtpClient client(qEnvironmentVariable("SMTP_HOST"), qEnvironmentVariableIntValue("SMTP_PORT"), securityType);
-        client.connectToHost();
-
-        if (!client.waitForReadyConnected()) {
-            Logger::error() << "Could not connect to SMTP server";
-            promise.setException(QException());
-            return;
-        }
-
-        client.login(qEnvironmentVariable("SMTP_USERNAME"), qEnvironmentVariable("SMTP_PASSWORD"), SmtpClient::AuthLogin);
-        if (!client.waitForAuthenticated()) {
-            Logger::error() << "Could not log in to SMTP server";
-            promise.setException(QException());
-            return;
-        }
-
-        client.sendMail(*message);
-
-        if (!client.waitForMailSent()) {
-            message->deleteLater();
-            Logger::error() << "Could not send email";
-            promise.setException(QException());
-            return;
-        }
-
-        message->deleteLater();
-        client.quit();
-        promise.finish();
-    });
+    return MailQueue::instance()->enqueue(message);
 }
 
 QString Utils::settingsFile() {
@@ -25,6 +25,8 @@
 #include <QDBusMessage>
 #include <QFuture>
 
+class QThreadPool;
+
 namespace Utils {
     enum DBusError {
         NoError,
@@ -42,16 +44,29 @@ namespace Utils {
         InvalidInput,
         FidoSupportUnavailable,
         AccountEmailNotVerified,
-        EmailError
+        EmailError,
+        Busy,
+        RateLimited
     };
 
     QString settingsFile();
+    constexpr auto dedicatedBusAddress = "unix:path=/var/vicr123-accounts/vicr123-accounts-bus";
+
     QDBusConnection accountsBus();
+    QDBusConnection accountsRelayBus();
     QString fidoHelperPath();
     QByteArray generateRandomBytes(int count);
     QByteArray generateSalt();
-    QString generateHashedPassword(QString password, int iterations = 10000);
+    QString generateHashedPassword(QString password);
     bool verifyHashedPassword(QString password, QString hash);
+    int passwordHashIterations();
+    int calibratePasswordHashing();
+    bool passwordHashOutdated(QString hash);
+    QThreadPool* hashingThreadPool();
+    QFuture<QString> generateHashedPasswordAsync(QString password);
+    QFuture<bool> verifyHashedPasswordAsync(QString password, QString hash);
+    void upgradePasswordHash(quint64 user, QString password, QString hash);
+    QString dbusErrorName(DBusError error);
     void sendDbusError(DBusError error, const QDBusMessage& replyTo);
     void sendTemplateEmail(QString templateName, QList<QString> recipients, QString locale, QMap<QString, QString> replacements);
     QFuture<void> sendMailMessage(MimeMessage* message);
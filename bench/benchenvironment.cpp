@@ -0,0 +1,218 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "benchenvironment.h"
+
+#include "smtpsink.h"
+#include <QDBusConnectionInterface>
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QUuid>
+#include <QThread>
+
+struct BenchEnvironmentPrivate {
+        QTemporaryDir* directory = nullptr;
+        QProcess* busDaemon = nullptr;
+        QProcess* accountsDaemon = nullptr;
+        SmtpSink* smtpSink = nullptr;
+
+        QString busAddress;
+        QString pgCtl;
+        bool postgresRunning = false;
+
+        static constexpr auto busConnectionName = "vicr123-accounts-bench";
+};
+
+BenchEnvironment::BenchEnvironment(QObject* parent) :
+    QObject(parent) {
+    d = new BenchEnvironmentPrivate();
+}
+
+BenchEnvironment::~BenchEnvironment() {
+    stop();
+    delete d;
+}
+
+bool BenchEnvironment::start(const Options& options) {
+    d->directory = new QTemporaryDir(QDir::temp().absoluteFilePath("vicr123-accounts-bench-XXXXXX"));
+    if (!d->directory->isValid()) {
+        QTextStream(stderr) << "Could not create a temporary directory\n";
+        return false;
+    }
+    d->directory->setAutoRemove(!options.keepDirectory);
+
+    if (!startBus()) return false;
+    if (!startPostgres(options)) return false;
+
+    d->smtpSink = new SmtpSink(this);
+    if (!d->smtpSink->listen()) {
+        QTextStream(stderr) << "Could not start the SMTP sink\n";
+        return false;
+    }
+
+    return startDaemon(options);
+}
+
+void BenchEnvironment::stop() {
+    if (d->accountsDaemon) {
+        d->accountsDaemon->terminate();
+        if (!d->accountsDaemon->waitForFinished(10000)) d->accountsDaemon->kill();
+        delete d->accountsDaemon;
+        d->accountsDaemon = nullptr;
+    }
+
+    if (d->postgresRunning) {
+        QProcess::execute(d->pgCtl, {"-D", d->directory->filePath("postgres"), "-m", "fast", "-w", "stop"});
+        d->postgresRunning = false;
+    }
+
+    if (d->busDaemon) {
+        QDBusConnection::disconnectFromBus(BenchEnvironmentPrivate::busConnectionName);
+        d->busDaemon->terminate();
+        if (!d->busDaemon->waitForFinished(5000)) d->busDaemon->kill();
+        delete d->busDaemon;
+        d->busDaemon = nullptr;
+    }
+
+    if (d->directory) {
+        if (!d->directory->autoRemove()) QTextStream(stderr) << "Logs kept in " << d->directory->path() << "\n";
+        delete d->directory;
+        d->directory = nullptr;
+    }
+}
+
+QDBusConnection BenchEnvironment::bus() const {
+    return QDBusConnection(BenchEnvironmentPrivate::busConnectionName);
+}
+
+SmtpSink* BenchEnvironment::smtpSink() const {
+    return d->smtpSink;
+}
+
+bool BenchEnvironment::startBus() {
+    QFile busConfig(d->directory->filePath("bus.conf"));
+    busConfig.open(QFile::WriteOnly);
+    busConfig.write(QStringLiteral(R"(<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+    <type>session</type>
+    <listen>unix:dir=%1</listen>
+    <auth>EXTERNAL</auth>
+    <policy context="default">
+        <allow send_destination="*" eavesdrop="true"/>
+        <allow eavesdrop="true"/>
+        <allow own="*"/>
+    </policy>
+</busconfig>
+)")
+                        .arg(d->directory->path())
+                        .toUtf8());
+    busConfig.close();
+
+    d->busDaemon = new QProcess();
+    d->busDaemon->start("dbus-daemon", {"--config-file", busConfig.fileName(), "--nofork", "--nopidfile", "--print-address=1"});
+    if (!d->busDaemon->waitForStarted() || !d->busDaemon->waitForReadyRead(10000)) {
+        QTextStream(stderr) << "Could not start dbus-daemon\n";
+        return false;
+    }
+
+    d->busAddress = QString::fromUtf8(d->busDaemon->readLine()).trimmed();
+    if (!QDBusConnection::connectToBus(d->busAddress, BenchEnvironmentPrivate::busConnectionName).isConnected()) {
+        QTextStream(stderr) << "Could not connect to the private bus at " << d->busAddress << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool BenchEnvironment::startPostgres(const Options& options) {
+    auto tool = [&options](QString name) {
+        return options.postgresBinDir.isEmpty() ? name : QDir(options.postgresBinDir).absoluteFilePath(name);
+    };
+    d->pgCtl = tool("pg_ctl");
+
+    auto dataDirectory = d->directory->filePath("postgres");
+    if (QProcess::execute(tool("initdb"), {"-D", dataDirectory, "-A", "trust", "-U", "postgres", "--no-sync"}) != 0) {
+        QTextStream(stderr) << "Could not initialise a PostgreSQL cluster; pass --pg-bindir if initdb is not in PATH\n";
+        return false;
+    }
+
+    // Only listen on a Unix socket inside the temporary directory so the cluster never collides with anything else
+    auto serverOptions = QStringLiteral("-k %1 -c listen_addresses= -c max_connections=200").arg(d->directory->path());
+    if (QProcess::execute(d->pgCtl, {"-D", dataDirectory, "-l", d->directory->filePath("postgres.log"), "-o", serverOptions, "-w", "start"}) != 0) {
+        QTextStream(stderr) << "Could not start PostgreSQL\n";
+        return false;
+    }
+
+    d->postgresRunning = true;
+    return true;
+}
+
+bool BenchEnvironment::startDaemon(const Options& options) {
+    auto settingsPath = d->directory->filePath("vicr123-accounts.conf");
+    {
+        QSettings settings(settingsPath, QSettings::IniFormat);
+        settings.setValue("dbus/bus", "session");
+        settings.setValue("database/driver", "QPSQL");
+        settings.setValue("database/hostname", d->directory->path());
+        settings.setValue("database/database", "postgres");
+        settings.setValue("database/username", "postgres");
+        settings.setValue("database/password", "");
+        settings.setValue("otp/backupkeysecret", QUuid::createUuid().toString(QUuid::WithoutBraces));
+        settings.setValue("mail/maildir", options.mailDir);
+        settings.setValue("mail/host", "127.0.0.1");
+        settings.setValue("mail/port", d->smtpSink->port());
+        settings.setValue("mail/security", "none");
+        settings.setValue("mail/username", "bench");
+        settings.setValue("mail/password", "bench");
+        settings.setValue("mail/senderemail", "bench@localhost.localdomain");
+        settings.setValue("mail/sendername", "vicr123-accounts-bench");
+        settings.sync();
+    }
+
+    auto environment = QProcessEnvironment::systemEnvironment();
+    environment.insert("ACCOUNTS_SETTINGS", settingsPath);
+    environment.insert("DBUS_SESSION_BUS_ADDRESS", d->busAddress);
+
+    d->accountsDaemon = new QProcess();
+    d->accountsDaemon->setProcessEnvironment(environment);
+    d->accountsDaemon->setStandardOutputFile(d->directory->filePath("daemon.log"));
+    d->accountsDaemon->setStandardErrorFile(d->directory->filePath("daemon.log"), QIODevice::Append);
+    d->accountsDaemon->start(options.daemonPath, {});
+    if (!d->accountsDaemon->waitForStarted()) {
+        QTextStream(stderr) << "Could not start " << options.daemonPath << "\n";
+        return false;
+    }
+
+    // The daemon is ready once it has claimed its name on the bus
+    QDeadlineTimer deadline(30000);
+    while (!bus().interface()->isServiceRegistered("com.vicr123.accounts")) {
+        if (deadline.hasExpired() || d->accountsDaemon->state() != QProcess::Running) {
+            QTextStream(stderr) << "The accounts daemon did not come up; see " << d->directory->filePath("daemon.log") << "\n";
+            d->directory->setAutoRemove(false);
+            return false;
+        }
+        QThread::msleep(100);
+    }
+    return true;
+}
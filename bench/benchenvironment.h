@@ -0,0 +1,57 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef BENCHENVIRONMENT_H
+#define BENCHENVIRONMENT_H
+
+#include <QDBusConnection>
+#include <QObject>
+
+class SmtpSink;
+struct BenchEnvironmentPrivate;
+class BenchEnvironment : public QObject {
+        Q_OBJECT
+    public:
+        explicit BenchEnvironment(QObject* parent = nullptr);
+        ~BenchEnvironment();
+
+        struct Options {
+                QString daemonPath;
+                QString postgresBinDir;
+                QString mailDir;
+                bool keepDirectory = false;
+        };
+
+        bool start(const Options& options);
+        void stop();
+
+        QDBusConnection bus() const;
+        SmtpSink* smtpSink() const;
+
+    signals:
+
+    private:
+        BenchEnvironmentPrivate* d;
+
+        bool startBus();
+        bool startPostgres(const Options& options);
+        bool startDaemon(const Options& options);
+};
+
+#endif // BENCHENVIRONMENT_H
@@ -0,0 +1,135 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTextStream>
+
+#include "benchenvironment.h"
+#include "smtpsink.h"
+#include "tokenbenchmark.h"
+#include "workload.h"
+
+int main(int argc, char* argv[]) {
+    QCoreApplication a(argc, argv);
+    a.setApplicationName("vicr123-accounts-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives a private instance of vicr123-accounts over D-Bus and reports latency and throughput as JSON");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"users",       "Number of users to seed before measuring.",                                  "count",   "1000"                                                                            },
+        {"concurrency", "Number of calls kept in flight at once.",                                    "calls",   "16"                                                                              },
+        {"duration",    "Seconds to run the workload for.",                                           "seconds", "30"                                                                              },
+        {"mix",         "Comma separated Method=weight pairs describing the workload.",               "mix",     "UserById=30,UserForToken=30,TokenProvisioningMethods=20,ProvisionToken=15,CreateUser=5"},
+        {"daemon",      "Path to the vicr123-accounts executable.",                                   "path",    ACCOUNTS_DAEMON_PATH                                                              },
+        {"pg-bindir",   "Directory containing initdb and pg_ctl, if they are not in PATH.",           "path"                                                                                       },
+        {"mail-dir",    "Directory containing the mail templates.",                                   "path",    ACCOUNTS_MAIL_DIR                                                                 },
+        {"output",      "Write the report to this file instead of standard output.",                  "file"                                                                                       },
+        {"keep",        "Keep the temporary directory with the daemon, bus and database logs."                                                                                                    },
+        {"microbenchmark", "Time token verification in process for this many iterations instead of running the workload.", "iterations"                                                            }
+    });
+    parser.process(a);
+
+    auto writeReport = [&parser](const QJsonObject& report) {
+        auto json = QJsonDocument(report).toJson();
+        if (parser.isSet("output")) {
+            QFile output(parser.value("output"));
+            if (!output.open(QFile::WriteOnly)) {
+                QTextStream(stderr) << "Could not write " << output.fileName() << "\n";
+                return 1;
+            }
+            output.write(json);
+        } else {
+            QTextStream(stdout) << json;
+        }
+        return 0;
+    };
+
+    if (parser.isSet("microbenchmark")) {
+        auto iterations = parser.value("microbenchmark").toInt();
+        if (iterations <= 0) {
+            QTextStream(stderr) << "The microbenchmark option must be positive\n";
+            return 1;
+        }
+
+        return writeReport({
+            {"microbenchmarks", QJsonObject{{"tokens", TokenBenchmark::run(iterations)}}}
+        });
+    }
+
+    Workload::Options workloadOptions;
+    workloadOptions.users = parser.value("users").toInt();
+    workloadOptions.concurrency = parser.value("concurrency").toInt();
+    workloadOptions.duration = parser.value("duration").toInt();
+    int totalWeight = 0;
+    for (const auto& part : parser.value("mix").split(",", Qt::SkipEmptyParts)) {
+        auto pair = part.split("=");
+        if (pair.length() != 2 || !Workload::supportedMethods().contains(pair.first()) || pair.last().toInt() < 0) {
+            QTextStream(stderr) << "Invalid workload entry " << part << "; supported methods are " << Workload::supportedMethods().join(", ") << "\n";
+            return 1;
+        }
+        workloadOptions.mix.append({pair.first(), pair.last().toInt()});
+        totalWeight += pair.last().toInt();
+    }
+
+    // Every call is picked at random by weight, so at least one method needs a weight above zero
+    if (workloadOptions.users <= 0 || workloadOptions.concurrency <= 0 || workloadOptions.duration <= 0 || totalWeight <= 0) {
+        QTextStream(stderr) << "The users, concurrency, duration and mix options must all be positive\n";
+        return 1;
+    }
+
+    BenchEnvironment environment;
+    if (!environment.start({parser.value("daemon"), parser.value("pg-bindir"), parser.value("mail-dir"), parser.isSet("keep")})) {
+        return 1;
+    }
+
+    Workload workload(environment.bus(), workloadOptions);
+    QTextStream(stderr) << "Seeding " << workloadOptions.users << " users\n";
+    auto seed = workload.seed();
+    QTextStream(stderr) << "Running workload for " << workloadOptions.duration << " seconds\n";
+    auto results = workload.run();
+
+    QJsonObject mix;
+    for (const auto& [method, weight] : workloadOptions.mix) mix.insert(method, weight);
+
+    QJsonObject configuration = {
+        {"users",       workloadOptions.users      },
+        {"concurrency", workloadOptions.concurrency},
+        {"duration",    workloadOptions.duration   },
+        {"mix",         mix                        }
+    };
+
+    QJsonObject mail = {
+        {"messagesReceived", static_cast<qint64>(environment.smtpSink()->messagesReceived())}
+    };
+
+    QJsonObject report = {
+        {"configuration", configuration},
+        {"seed",          seed         },
+        {"results",       results      },
+        {"mail",          mail         }
+    };
+
+    environment.stop();
+
+    return writeReport(report);
+}
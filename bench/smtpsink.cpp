@@ -0,0 +1,109 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "smtpsink.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+
+struct SmtpSinkPrivate {
+        QTcpServer* server;
+        quint64 messagesReceived = 0;
+};
+
+struct SmtpSinkSession {
+        bool inData = false;
+        int authLoginStage = 0;
+};
+
+SmtpSink::SmtpSink(QObject* parent) :
+    QObject(parent) {
+    d = new SmtpSinkPrivate();
+    d->server = new QTcpServer(this);
+    connect(d->server, &QTcpServer::newConnection, this, &SmtpSink::acceptConnection);
+}
+
+SmtpSink::~SmtpSink() {
+    delete d;
+}
+
+bool SmtpSink::listen() {
+    return d->server->listen(QHostAddress::LocalHost);
+}
+
+quint16 SmtpSink::port() const {
+    return d->server->serverPort();
+}
+
+quint64 SmtpSink::messagesReceived() const {
+    return d->messagesReceived;
+}
+
+void SmtpSink::acceptConnection() {
+    while (auto* socket = d->server->nextPendingConnection()) {
+        auto session = QSharedPointer<SmtpSinkSession>::create();
+        connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket, session] {
+            // Accept whatever the daemon sends just well enough to keep its SMTP client happy
+            while (socket->canReadLine()) {
+                auto line = socket->readLine().trimmed();
+                if (session->inData) {
+                    if (line == ".") {
+                        session->inData = false;
+                        d->messagesReceived++;
+                        socket->write("250 Queued\r\n");
+                    }
+                    continue;
+                }
+
+                if (session->authLoginStage == 1) {
+                    session->authLoginStage = 2;
+                    socket->write("334 UGFzc3dvcmQ6\r\n");
+                    continue;
+                }
+
+                if (session->authLoginStage == 2) {
+                    session->authLoginStage = 0;
+                    socket->write("235 Authenticated\r\n");
+                    continue;
+                }
+
+                auto command = line.left(4).toUpper();
+                if (command == "EHLO" || command == "HELO") {
+                    socket->write("250-vicr123-accounts-bench\r\n250 AUTH LOGIN PLAIN\r\n");
+                } else if (line.toUpper() == "AUTH LOGIN") {
+                    session->authLoginStage = 1;
+                    socket->write("334 VXNlcm5hbWU6\r\n");
+                } else if (command == "AUTH") {
+                    socket->write("235 Authenticated\r\n");
+                } else if (command == "DATA") {
+                    session->inData = true;
+                    socket->write("354 Go ahead\r\n");
+                } else if (command == "QUIT") {
+                    socket->write("221 Bye\r\n");
+                    socket->disconnectFromHost();
+                } else {
+                    socket->write("250 OK\r\n");
+                }
+            }
+        });
+
+        socket->write("220 vicr123-accounts-bench ESMTP\r\n");
+    }
+}
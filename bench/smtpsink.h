@@ -0,0 +1,44 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef SMTPSINK_H
+#define SMTPSINK_H
+
+#include <QObject>
+
+struct SmtpSinkPrivate;
+class SmtpSink : public QObject {
+        Q_OBJECT
+    public:
+        explicit SmtpSink(QObject* parent = nullptr);
+        ~SmtpSink();
+
+        bool listen();
+        quint16 port() const;
+        quint64 messagesReceived() const;
+
+    signals:
+
+    private:
+        SmtpSinkPrivate* d;
+
+        void acceptConnection();
+};
+
+#endif // SMTPSINK_H
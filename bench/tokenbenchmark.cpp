@@ -0,0 +1,89 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "tokenbenchmark.h"
+
+#include "jwt.h"
+#include "qjsonwebtoken.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <functional>
+
+namespace {
+    QJsonObject measure(int iterations, std::function<bool()> operation) {
+        // Keep the results alive so the calls can't be optimised away
+        volatile int accepted = 0;
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < iterations; i++) {
+            if (operation()) accepted = accepted + 1;
+        }
+        auto elapsed = timer.nsecsElapsed();
+
+        return {
+            {"iterations", iterations                                },
+            {"accepted",   accepted                                  },
+            {"nsPerOp",    static_cast<double>(elapsed) / iterations}
+        };
+    }
+} // namespace
+
+QJsonObject TokenBenchmark::run(int iterations) {
+    QByteArray salt(64, Qt::Uninitialized);
+    QRandomGenerator::global()->fillRange(reinterpret_cast<quint32*>(salt.data()), salt.size() / sizeof(quint32));
+    const auto opaqueToken = QString::fromLatin1(salt.toBase64());
+
+    const auto secret = QStringLiteral("0123456789abcdefghijklmnopqrstuv");
+    const auto expiry = QString::number(QDateTime::currentDateTimeUtc().addSecs(60 * 60).toMSecsSinceEpoch());
+
+    QJsonWebToken currentJwt;
+    currentJwt.setAlgorithmStr("HS512");
+    currentJwt.setSecret(secret);
+    currentJwt.appendClaim("sub", "1234567");
+    currentJwt.appendClaim("exp", expiry);
+    currentJwt.appendClaim("pur", "1");
+    const auto currentToken = currentJwt.getToken();
+
+    const Jwt nativeJwt(secret.toUtf8());
+    const auto nativeToken = nativeJwt.sign({
+        {"sub", "1234567"},
+        {"exp", expiry   },
+        {"pur", "1"      }
+    });
+
+    return {
+        {"opaqueToken", QJsonObject{
+                            {"current", measure(iterations, [&] {
+                                 return QJsonWebToken::fromTokenAndSecret(opaqueToken, secret).isValid();
+                             })},
+                            {"native", measure(iterations, [&] {
+                                 return Jwt::isJwt(opaqueToken);
+                             })}}},
+        {"jwt", QJsonObject{
+                    {"current", measure(iterations, [&] {
+                         return QJsonWebToken::fromTokenAndSecret(currentToken, secret).isValid();
+                     })},
+                    {"native", measure(iterations, [&] {
+                         QJsonObject claims;
+                         return Jwt::isJwt(nativeToken) && nativeJwt.verify(nativeToken, &claims);
+                     })}}}
+    };
+}
@@ -0,0 +1,32 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef TOKENBENCHMARK_H
+#define TOKENBENCHMARK_H
+
+#include <QJsonObject>
+
+// Times the daemon's token verification code in process, comparing the native HS512 verifier
+// against the QJsonWebToken path it replaced
+class TokenBenchmark {
+    public:
+        static QJsonObject run(int iterations);
+};
+
+#endif // TOKENBENCHMARK_H
@@ -0,0 +1,217 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "workload.h"
+
+#include <QDBusObjectPath>
+#include <QDBusPendingCallWatcher>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonArray>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+
+struct WorkloadPrivate {
+        QDBusConnection bus = QDBusConnection(QString());
+        Workload::Options options;
+        int totalWeight = 0;
+
+        QList<quint64> userIds;
+        QStringList tokens;
+        quint64 createdUsers = 0;
+
+        static constexpr auto password = "bench-password";
+        static constexpr auto application = "vicr123-accounts-bench";
+};
+
+Workload::Workload(QDBusConnection bus, Options options, QObject* parent) :
+    QObject(parent) {
+    d = new WorkloadPrivate();
+    d->bus = bus;
+    d->options = options;
+    for (const auto& [method, weight] : options.mix) d->totalWeight += weight;
+}
+
+Workload::~Workload() {
+    delete d;
+}
+
+QStringList Workload::supportedMethods() {
+    return {"CreateUser", "ProvisionToken", "UserForToken", "TokenProvisioningMethods", "UserById"};
+}
+
+QJsonObject Workload::seed() {
+    // Create every user, then log each of them in once so there are tokens to look up
+    d->userIds.resize(d->options.users);
+    d->tokens.resize(d->options.users);
+
+    int next = 0;
+    auto createStats = execute([this, &next]() -> std::optional<Call> {
+        if (next == d->options.users) return std::nullopt;
+        auto index = next++;
+        return createCall("CreateUser", {QStringLiteral("bench-user-%1").arg(index), WorkloadPrivate::password, QStringLiteral("bench-user-%1@localhost.localdomain").arg(index)}, [this, index](const QDBusMessage& reply) {
+            auto path = reply.arguments().first().value<QDBusObjectPath>().path();
+            d->userIds[index] = path.mid(path.lastIndexOf("User") + 4).toULongLong();
+        });
+    });
+
+    next = 0;
+    auto tokenStats = execute([this, &next]() -> std::optional<Call> {
+        if (next == d->options.users) return std::nullopt;
+        auto index = next++;
+        return createCall("ProvisionToken", {QStringLiteral("bench-user-%1").arg(index), WorkloadPrivate::password, WorkloadPrivate::application, QVariantMap()}, [this, index](const QDBusMessage& reply) {
+            d->tokens[index] = reply.arguments().first().toString();
+        });
+    });
+
+    return {
+        {"users",  createStats},
+        {"tokens", tokenStats }
+    };
+}
+
+QJsonObject Workload::run() {
+    QElapsedTimer timer;
+    timer.start();
+    auto duration = static_cast<qint64>(d->options.duration) * 1000;
+    return execute([this, &timer, duration]() -> std::optional<Call> {
+        if (timer.hasExpired(duration)) return std::nullopt;
+        return randomCall();
+    });
+}
+
+QJsonObject Workload::execute(std::function<std::optional<Call>()> nextCall) {
+    struct MethodStats {
+            QList<qint64> latencies;
+            quint64 errors = 0;
+    };
+    QMap<QString, MethodStats> stats;
+
+    QEventLoop loop;
+    int inFlight = 0;
+    bool exhausted = false;
+
+    QElapsedTimer wallClock;
+    wallClock.start();
+
+    // Keep exactly `concurrency` calls in flight until the generator runs dry
+    std::function<void()> issue = [&] {
+        if (exhausted) return;
+        auto call = nextCall();
+        if (!call) {
+            exhausted = true;
+            if (inFlight == 0) loop.quit();
+            return;
+        }
+
+        inFlight++;
+        QElapsedTimer latency;
+        latency.start();
+        auto* watcher = new QDBusPendingCallWatcher(d->bus.asyncCall(call->message, 60000), this);
+        connect(watcher, &QDBusPendingCallWatcher::finished, this, [&, watcher, latency, call = *call] {
+            auto& methodStats = stats[call.method];
+            methodStats.latencies.append(latency.nsecsElapsed());
+
+            auto reply = watcher->reply();
+            if (reply.type() == QDBusMessage::ErrorMessage) {
+                methodStats.errors++;
+            } else if (call.onReply) {
+                call.onReply(reply);
+            }
+            watcher->deleteLater();
+
+            inFlight--;
+            issue();
+            if (exhausted && inFlight == 0) loop.quit();
+        });
+    };
+
+    for (auto i = 0; i < d->options.concurrency; i++) issue();
+    if (inFlight != 0) loop.exec();
+
+    auto elapsed = wallClock.nsecsElapsed() / 1e9;
+    auto percentile = [](const QList<qint64>& sorted, double p) {
+        if (sorted.isEmpty()) return 0.0;
+        auto index = qBound<qsizetype>(0, static_cast<qsizetype>(std::ceil(p * sorted.size())) - 1, sorted.size() - 1);
+        return sorted.at(index) / 1000.0;
+    };
+
+    QJsonObject methods;
+    quint64 totalCount = 0;
+    quint64 totalErrors = 0;
+    for (auto method = stats.begin(); method != stats.end(); method++) {
+        auto& latencies = method->latencies;
+        std::sort(latencies.begin(), latencies.end());
+        totalCount += latencies.size();
+        totalErrors += method->errors;
+
+        methods.insert(method.key(), QJsonObject{
+                                         {"count",        static_cast<qint64>(latencies.size())},
+                                         {"errors",       static_cast<qint64>(method->errors)  },
+                                         {"opsPerSecond", latencies.size() / elapsed           },
+                                         {"p50Us",        percentile(latencies, 0.5)           },
+                                         {"p99Us",        percentile(latencies, 0.99)          },
+                                         {"p999Us",       percentile(latencies, 0.999)         }
+        });
+    }
+
+    return {
+        {"seconds",      elapsed                         },
+        {"count",        static_cast<qint64>(totalCount) },
+        {"errors",       static_cast<qint64>(totalErrors)},
+        {"opsPerSecond", totalCount / elapsed            },
+        {"methods",      methods                         }
+    };
+}
+
+Workload::Call Workload::createCall(QString method, QVariantList arguments, std::function<void(const QDBusMessage&)> onReply) {
+    auto message = QDBusMessage::createMethodCall("com.vicr123.accounts", "/com/vicr123/accounts", "com.vicr123.accounts.Manager", method);
+    message.setArguments(arguments);
+    return {method, message, onReply};
+}
+
+Workload::Call Workload::randomCall() {
+    auto* random = QRandomGenerator::global();
+    auto user = random->bounded(d->options.users);
+
+    auto pick = random->bounded(d->totalWeight);
+    QString method;
+    for (const auto& [candidate, weight] : d->options.mix) {
+        if (pick < weight) {
+            method = candidate;
+            break;
+        }
+        pick -= weight;
+    }
+
+    if (method == "CreateUser") {
+        auto index = d->createdUsers++;
+        return createCall(method, {QStringLiteral("bench-new-%1").arg(index), WorkloadPrivate::password, QStringLiteral("bench-new-%1@localhost.localdomain").arg(index)});
+    } else if (method == "ProvisionToken") {
+        return createCall(method, {QStringLiteral("bench-user-%1").arg(user), WorkloadPrivate::password, WorkloadPrivate::application, QVariantMap()});
+    } else if (method == "UserForToken") {
+        return createCall(method, {d->tokens.at(user)});
+    } else if (method == "TokenProvisioningMethods") {
+        return createCall(method, {QStringLiteral("bench-user-%1").arg(user), WorkloadPrivate::application});
+    } else {
+        return createCall(method, {QVariant::fromValue(d->userIds.at(user))});
+    }
+}
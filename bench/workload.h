@@ -0,0 +1,65 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QJsonObject>
+#include <QObject>
+#include <functional>
+#include <optional>
+
+struct WorkloadPrivate;
+class Workload : public QObject {
+        Q_OBJECT
+    public:
+        struct Options {
+                int users = 1000;
+                int concurrency = 16;
+                int duration = 30;
+                QList<QPair<QString, int>> mix;
+        };
+
+        explicit Workload(QDBusConnection bus, Options options, QObject* parent = nullptr);
+        ~Workload();
+
+        static QStringList supportedMethods();
+
+        QJsonObject seed();
+        QJsonObject run();
+
+    signals:
+
+    private:
+        WorkloadPrivate* d;
+
+        struct Call {
+                QString method;
+                QDBusMessage message;
+                std::function<void(const QDBusMessage&)> onReply;
+        };
+
+        QJsonObject execute(std::function<std::optional<Call>()> nextCall);
+        Call createCall(QString method, QVariantList arguments, std::function<void(const QDBusMessage&)> onReply = {});
+        Call randomCall();
+};
+
+#endif // WORKLOAD_H
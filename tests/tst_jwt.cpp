@@ -0,0 +1,107 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "jwt.h"
+
+#include <QTest>
+
+namespace {
+    // Signed by an independent HMAC-SHA512 implementation with the secret below
+    constexpr char knownSecret[] = "a test secret";
+    constexpr char knownToken[] = "eyJhbGciOiJIUzUxMiIsInR5cCI6IkpXVCJ9"
+                                  ".eyJleHAiOjE3MDAwMDAwMDAsInB1ciI6IjEiLCJzdWIiOiIxMjM0NTY3ODkwIn0"
+                                  ".j-fqv4cfcwxoQ2-eJp4fIU6A8P7gWwJCjg-6sAAWRJYUoN9qPCQUkMt24T1qE-zPTbtMoNGi0_Dv_i4AFGbhrw";
+
+    QJsonObject knownClaims() {
+        return {
+            {"exp", 1700000000  },
+            {"pur", "1"         },
+            {"sub", "1234567890"}
+        };
+    }
+} // namespace
+
+class TestJwt : public QObject {
+        Q_OBJECT
+
+    private slots:
+        void signsKnownAnswer() {
+            QCOMPARE(Jwt(knownSecret).sign(knownClaims()), QString(knownToken));
+        }
+
+        void verifiesKnownAnswer() {
+            QJsonObject claims;
+            QVERIFY(Jwt(knownSecret).verify(knownToken, &claims));
+            QCOMPARE(claims, knownClaims());
+        }
+
+        void roundTrips() {
+            Jwt jwt(QByteArray(200, 'k'));
+            QJsonObject claims;
+            QVERIFY(jwt.verify(jwt.sign(knownClaims()), &claims));
+            QCOMPARE(claims, knownClaims());
+        }
+
+        void rejectsOtherSecret() {
+            QJsonObject claims;
+            QVERIFY(!Jwt("another secret").verify(knownToken, &claims));
+            QVERIFY(!Jwt().verify(knownToken, &claims));
+        }
+
+        void rejectsTamperedToken_data() {
+            QTest::addColumn<QString>("token");
+
+            QString token(knownToken);
+            auto payloadStart = token.indexOf('.') + 1;
+            auto signatureStart = token.lastIndexOf('.') + 1;
+
+            QString flippedPayload = token;
+            flippedPayload[payloadStart + 5] = flippedPayload[payloadStart + 5] == 'A' ? 'B' : 'A';
+            QTest::newRow("payload character") << flippedPayload;
+
+            QString flippedSignature = token;
+            flippedSignature[signatureStart] = flippedSignature[signatureStart] == 'A' ? 'B' : 'A';
+            QTest::newRow("signature character") << flippedSignature;
+
+            // Characters that share their low byte with the originals must not hash the same
+            QString wideCharacters = token;
+            for (auto i = payloadStart + 40; i < payloadStart + 44; i++) wideCharacters[i] = QChar(wideCharacters[i].unicode() + 0x100);
+            QTest::newRow("wide characters") << wideCharacters;
+
+            QTest::newRow("padded payload") << QString(token).insert(signatureStart - 1, "==");
+            QTest::newRow("extra segment") << QString(token).insert(signatureStart - 1, ".e30");
+            QTest::newRow("truncated signature") << token.chopped(1);
+            QTest::newRow("other header") << QString(token).replace(0, 36, "eyJhbGciOiJub25lIiwidHlwIjoiSldUIn0");
+            QTest::newRow("no signature") << token.first(signatureStart - 1);
+        }
+
+        void rejectsTamperedToken() {
+            QFETCH(QString, token);
+            QJsonObject claims;
+            QVERIFY(!Jwt(knownSecret).verify(token, &claims));
+        }
+
+        void tellsTokensApart() {
+            QVERIFY(Jwt::isJwt(knownToken));
+            QVERIFY(!Jwt::isJwt("bG9naW4gdG9rZW4+/w=="));
+        }
+};
+
+QTEST_APPLESS_MAIN(TestJwt)
+#include "tst_jwt.moc"
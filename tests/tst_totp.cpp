@@ -0,0 +1,110 @@
+/****************************************
+ *
+ *   INSERT-PROJECT-NAME-HERE - INSERT-GENERIC-NAME-HERE
+ *   Copyright (C) 2021 Victor Tran
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *************************************/
+#include "totp.h"
+
+#include "configuration.h"
+#include <QTest>
+
+namespace {
+    // The SHA-1 secret from the RFC 6238 test vectors, "12345678901234567890", in base32
+    constexpr char rfcKey[] = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ";
+
+    constexpr qint64 stepLength = 30;
+} // namespace
+
+// Stands in for the daemon's configuration, which only the window is read from
+QSharedPointer<const ConfigurationSnapshot> Configuration::current() {
+    static auto snapshot = [] {
+        auto snapshot = QSharedPointer<ConfigurationSnapshot>::create();
+        snapshot->otpWindow = 1;
+        return snapshot;
+    }();
+    return snapshot;
+}
+
+class TestTotp : public QObject {
+        Q_OBJECT
+
+    private slots:
+        void matchesRfcVectors_data() {
+            QTest::addColumn<qint64>("time");
+            QTest::addColumn<QString>("code");
+
+            // The RFC lists eight digit codes; these are their last six digits
+            QTest::newRow("59") << 59ll << QString("287082");
+            QTest::newRow("1111111109") << 1111111109ll << QString("081804");
+            QTest::newRow("1111111111") << 1111111111ll << QString("050471");
+            QTest::newRow("1234567890") << 1234567890ll << QString("005924");
+            QTest::newRow("2000000000") << 2000000000ll << QString("279037");
+        }
+
+        void matchesRfcVectors() {
+            QFETCH(qint64, time);
+            QFETCH(QString, code);
+
+            Totp totp(rfcKey);
+            auto step = time / stepLength;
+            QCOMPARE(totp.code(step), code.toUInt());
+            QCOMPARE(totp.matchingStep(code, step), step);
+        }
+
+        void acceptsCodesAtTheEdgeOfTheWindow() {
+            Totp totp(rfcKey);
+            const qint64 now = 1234567890 / stepLength;
+            auto code = [&totp](qint64 step) {
+                return QStringLiteral("%1").arg(totp.code(step), 6, 10, QLatin1Char('0'));
+            };
+
+            QCOMPARE(totp.matchingStep(code(now - 1), now), now - 1);
+            QCOMPARE(totp.matchingStep(code(now + 1), now), now + 1);
+            QCOMPARE(totp.matchingStep(code(now - 2), now), qint64(-1));
+            QCOMPARE(totp.matchingStep(code(now + 2), now), qint64(-1));
+        }
+
+        void rejectsMalformedCodes() {
+            Totp totp(rfcKey);
+            const qint64 now = 59 / stepLength;
+            QCOMPARE(totp.matchingStep("28708", now), qint64(-1));
+            QCOMPARE(totp.matchingStep("2870820", now), qint64(-1));
+            QCOMPARE(totp.matchingStep("28708a", now), qint64(-1));
+            QCOMPARE(Totp("not base32!").matchingStep("287082", now), qint64(-1));
+        }
+
+        void rejectsReplayedCodes() {
+            Totp totp(rfcKey);
+            const qint64 now = 2000000000 / stepLength;
+            auto code = [&totp](qint64 step) {
+                return QStringLiteral("%1").arg(totp.code(step), 6, 10, QLatin1Char('0'));
+            };
+
+            QVERIFY(totp.verify(1, code(now), now));
+            QVERIFY(!totp.verify(1, code(now), now));
+
+            // A code from an earlier step in the window can't be used once a later one has been
+            QVERIFY(!totp.verify(1, code(now - 1), now));
+
+            // Other users are tracked separately, and a later step is still accepted
+            QVERIFY(totp.verify(2, code(now), now));
+            QVERIFY(totp.verify(1, code(now + 1), now));
+        }
+};
+
+QTEST_APPLESS_MAIN(TestTotp)
+#include "tst_totp.moc"